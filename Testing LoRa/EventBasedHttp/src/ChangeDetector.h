@@ -0,0 +1,147 @@
+#pragma once
+
+// Send-on-delta change detection over a fixed set of fields.
+//
+// Each field is compared against the value last sent (its reference):
+//  - deadband: |value - reference| exceeds max(absolute, relative * |reference|)
+//  - rate: the change since the previous sample, per second, exceeds rate
+//  - hysteresis: moving back against the direction of the last sent change
+//    needs a band widened by this fraction, so a value hovering at the edge
+//    of the deadband does not flip-flop
+// A heartbeat fires when nothing was sent for maxSilentInterval, so the
+// receiver can tell a steady sensor from a dead one.
+//
+// evaluate() only decides; call commit() once the reading was actually
+// delivered so a failed send is retried on the next sample.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+struct DeadbandConfig {
+  float absolute;    // field units, 0 disables
+  float relative;    // fraction of the reference, 0 disables
+  float rate;        // field units per second, 0 disables
+  float hysteresis;  // fraction of the band added for reversals
+};
+
+enum ChangeReason : uint8_t {
+  CHANGE_NONE = 0,
+  CHANGE_FIRST = 1,
+  CHANGE_DEADBAND = 2,
+  CHANGE_RATE = 4,
+  CHANGE_HEARTBEAT = 8
+};
+
+inline const char* changeReasonName(uint8_t reasons) {
+  if (reasons & CHANGE_FIRST) return "first";
+  if (reasons & CHANGE_RATE) return "rate";
+  if (reasons & CHANGE_DEADBAND) return "deadband";
+  if (reasons & CHANGE_HEARTBEAT) return "heartbeat";
+  return "none";
+}
+
+template <size_t N>
+class ChangeDetector {
+public:
+  struct Stats {
+    unsigned long samples = 0;
+    unsigned long sends = 0;
+    unsigned long deadbandTriggers = 0;
+    unsigned long rateTriggers = 0;
+    unsigned long heartbeats = 0;
+    unsigned long fieldTriggers[N] = {};
+  };
+
+  ChangeDetector(const DeadbandConfig (&configs)[N], unsigned long maxSilentInterval)
+      : _configs(configs), _maxSilentInterval(maxSilentInterval) {}
+
+  // Returns a mask of ChangeReason; CHANGE_NONE means the reading can be
+  // suppressed. Updates the previous-sample state used for rate triggers.
+  uint8_t evaluate(const float (&values)[N], unsigned long now) {
+    _stats.samples++;
+    uint8_t reasons = CHANGE_NONE;
+
+    if (!_hasReference) {
+      reasons |= CHANGE_FIRST;
+    } else {
+      for (size_t i = 0; i < N; i++) {
+        uint8_t field = evaluateField(i, values[i], now);
+        if (field != CHANGE_NONE) _stats.fieldTriggers[i]++;
+        reasons |= field;
+      }
+      if (reasons == CHANGE_NONE && now - _lastSentAt >= _maxSilentInterval) {
+        reasons |= CHANGE_HEARTBEAT;
+      }
+    }
+
+    for (size_t i = 0; i < N; i++) _previous[i] = values[i];
+    _previousAt = now;
+    _hasPrevious = true;
+    _pending = reasons;
+    return reasons;
+  }
+
+  // Makes values the new reference after a successful send.
+  void commit(const float (&values)[N], unsigned long now) {
+    for (size_t i = 0; i < N; i++) {
+      if (_hasReference && values[i] != _reference[i]) {
+        _direction[i] = values[i] > _reference[i] ? 1 : -1;
+      }
+      _reference[i] = values[i];
+    }
+    _lastSentAt = now;
+    _hasReference = true;
+
+    _stats.sends++;
+    if (_pending & CHANGE_DEADBAND) _stats.deadbandTriggers++;
+    if (_pending & CHANGE_RATE) _stats.rateTriggers++;
+    if (_pending & CHANGE_HEARTBEAT) _stats.heartbeats++;
+    _pending = CHANGE_NONE;
+  }
+
+  const Stats& stats() const { return _stats; }
+
+  float reference(size_t field) const { return _reference[field]; }
+
+  // Fraction of samples that did not need to be sent
+  float suppressionRatio() const {
+    return _stats.samples ? 1.0f - (float)_stats.sends / _stats.samples : 0.0f;
+  }
+
+private:
+  uint8_t evaluateField(size_t i, float value, unsigned long now) {
+    const DeadbandConfig& config = _configs[i];
+    uint8_t reasons = CHANGE_NONE;
+
+    float delta = value - _reference[i];
+    float band = config.absolute;
+    float relativeBand = config.relative * fabsf(_reference[i]);
+    if (relativeBand > band) band = relativeBand;
+    if (_direction[i] != 0 && (delta > 0) != (_direction[i] > 0)) {
+      band *= 1.0f + config.hysteresis;
+    }
+    if (band > 0 && fabsf(delta) > band) {
+      reasons |= CHANGE_DEADBAND;
+    }
+
+    if (config.rate > 0 && _hasPrevious && now != _previousAt) {
+      float perSecond = fabsf(value - _previous[i]) * 1000.0f / (float)(now - _previousAt);
+      if (perSecond > config.rate) reasons |= CHANGE_RATE;
+    }
+    return reasons;
+  }
+
+  const DeadbandConfig (&_configs)[N];
+  unsigned long _maxSilentInterval;
+
+  float _reference[N] = {};
+  int8_t _direction[N] = {};
+  float _previous[N] = {};
+  unsigned long _previousAt = 0;
+  unsigned long _lastSentAt = 0;
+  bool _hasReference = false;
+  bool _hasPrevious = false;
+  uint8_t _pending = CHANGE_NONE;
+  Stats _stats;
+};
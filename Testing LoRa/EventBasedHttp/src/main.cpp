@@ -1,27 +1,70 @@
 #include <Arduino.h>
+#include <esp_timer.h>
 #include <ArduinoJson.h>
 #include <HTTPClient.h>
 #include <axp20x.h>
 #include <Wire.h>
-#include <DHT.h>
-#include <Adafruit_Sensor.h>
+#include "Scheduler.h"
+#include "ChangeDetector.h"
+#include "SensorFilter.h"
+#include "Log.h"
+#include "StageTrace.h"
+#include "Dht22Rmt.h"
 
-#define DHTPIN 25     // Pin where the DHT sensor is connected
-#define DHTTYPE DHT22 // Change to DHT11 if you are using a DHT11
+#define DHTPIN GPIO_NUM_25  // DHT22 (AM2302) data pin
 
-DHT dht(DHTPIN, DHTTYPE);
-bool hasValidPreviousData = false;
-float previousTemp = 0.0;
+// Task periods (ms)
+const unsigned long SAMPLE_INTERVAL = 2000;        // DHT22 minimum sampling period
+const unsigned long DHT_POLL_INTERVAL = 10;        // Read in progress, see Dht22Rmt.h
+const unsigned long WIFI_CHECK_INTERVAL = 10000;
+const unsigned long STATS_INTERVAL = 300000;
+const unsigned long SERIAL_INTERVAL = 100;
+
+Scheduler scheduler(millis, micros);
+
+// Logging, see Log.h. Tasks only queue records; logTask() formats and
+// prints them at low priority on core 0
+#define LOG_DRAIN_MS 20
+Logger<LOG_QUEUE_SIZE> logger(millis);
+int detectTaskId = -1;
+int dhtTaskId = -1;
+
+// Stage latency, see StageTrace.h. Send 't' over Serial for the
+// histograms, 'r' to reset them
+enum { STAGE_DHT, STAGE_AXP, STAGE_HTTP, STAGE_COUNT };
+const char* const STAGE_NAMES[STAGE_COUNT] = {"dht", "axp", "http"};
+StageTracer<STAGE_COUNT> tracer(STAGE_NAMES, esp_timer_get_time);
+
+Dht22Rmt dht(DHTPIN);
 
 // Constants
 const int LAHAN_ID = 1;
-const float PROXIMITY_THRESHOLD = 0.8; // Significant difference threshold
 const char* SSID = "MAKER 2024";
 const char* PASSWORD = "Makerdotindo24";
 const String GOOGLE_SCRIPT_ID = "AKfycbxGHNdjSwgf25ju2himYqfTNPLvRr3q6elo4Dy126nzG7861HWMGtzQKY2XG9s5_Y9Y";
 float temp;
 float humidity;
-String previousJsonString;
+
+// Change detection, see ChangeDetector.h
+enum { FIELD_TEMPERATURE, FIELD_HUMIDITY, FIELD_COUNT };
+const DeadbandConfig DEADBANDS[FIELD_COUNT] = {
+    // absolute, relative, rate (per s), hysteresis. A rate has to exceed one
+    // DHT22 step (0.1) per SAMPLE_INTERVAL, or every flicker fires it
+    {0.8, 0.0, 0.10, 0.25},  // Temperature (°C)
+    {2.0, 0.0, 0.10, 0.25},  // Humidity (%), DHT22 accuracy is ±2%
+};
+const unsigned long MAX_SILENT_INTERVAL = 900000;  // Heartbeat after 15 minutes
+
+// Sample filtering, see SensorFilter.h. The DHT22 reads every
+// SAMPLE_INTERVAL; a median of 3 drops one-off glitches and the average
+// settles its ±0.1 jitter, while a jump past the snap goes straight through
+const FilterConfig FILTERS[FIELD_COUNT] = {
+    // interval (ms), scale, median window, smoothing, snap
+    {SAMPLE_INTERVAL, 100, 3, 2, 0.4},  // Temperature (°C)
+    {SAMPLE_INTERVAL, 100, 3, 2, 1.0},  // Humidity (%)
+};
+ChangeDetector<FIELD_COUNT> changeDetector(DEADBANDS, MAX_SILENT_INTERVAL);
+SensorPipeline<FIELD_COUNT> sensorFilters(FILTERS);
 
 
 // AXP20X Battery Management
@@ -34,45 +77,154 @@ String constructUrl(float humidity, float temperature, float ec, float ph, float
 void logSensorData(float vbat, float batCurrent, float batPower, int batChargeCurrent, int batLevel);
 float randomFloat(float min, float max);
 void initPowerMonitor();
-void sendToGoogleSheet(String url);
+bool sendToGoogleSheet(String url);
 void getBatteryStats(float &vbat, float &batCurrent, float &batPower, int &batChargeCurrent, int &batLevel);
-bool significantChange(float humidity);
+void sampleTask();
+void dhtTask();
+void detectTask();
+void wifiTask();
+void printTaskStats();
+void serialTask();
+void printTraceStats();
+void logTask(void* parameter);
 
 void setup() {
     Serial.begin(115200);
-    dht.begin(); // Initialize the DHT sensor
+    xTaskCreatePinnedToCore(logTask, "log", 4096, nullptr, 1, nullptr, 0);
+    if (!dht.begin()) {
+        LOG_ERROR("DHT22 RMT setup failed");
+    }
     initPowerMonitor();
     connectToWiFi();
-    Serial.println("Event-based Sensor Data Generator Started!");
+
+    // Sampling starts a DHT22 read, which triggers change detection as soon
+    // as it is in
+    detectTaskId = scheduler.event("detect", detectTask);
+    dhtTaskId = scheduler.event("dht", dhtTask);
+    scheduler.every("sample", SAMPLE_INTERVAL, sampleTask);
+    scheduler.every("wifi", WIFI_CHECK_INTERVAL, wifiTask, WIFI_CHECK_INTERVAL);
+    scheduler.every("stats", STATS_INTERVAL, printTaskStats, STATS_INTERVAL);
+    scheduler.every("serial", SERIAL_INTERVAL, serialTask);
+
+    LOG_INFO("Event-based Sensor Data Generator Started!");
 }
 
 void loop() {
-    temp = dht.readTemperature();
-    humidity = dht.readHumidity();
+    scheduler.run();
+}
 
-    // Check for valid readings
-    if (isnan(temp) || isnan(humidity)) {
-        Serial.println("Failed to read from DHT sensor!");
+void sampleTask() {
+    if (dht.start(micros())) {
+        scheduler.trigger(dhtTaskId, DHT_POLL_INTERVAL);
+    }
+}
+
+void dhtTask() {
+    int64_t dhtStart = tracer.now();
+    DhtStatus status = dht.poll(micros());
+    tracer.recordSince(STAGE_DHT, dhtStart);
+    if (status == DHT_PENDING) {
+        scheduler.trigger(dhtTaskId, DHT_POLL_INTERVAL);
+        return;
+    }
+    if (status != DHT_OK) {
+        // The last good reading stays in place
+        LOG_ERROR("Failed to read from DHT sensor: %s", dhtStatusName(status));
         return;
     }
 
-    Serial.print("Temperature: ");
-    Serial.println(temp);
-    Serial.print("Humidity: ");
-    Serial.println(humidity);
+    // Change detection sees the filtered values
+    DhtReading reading;
+    dht.cache().latest(reading);
+    unsigned long now = millis();
+    sensorFilters.add(FIELD_TEMPERATURE, reading.temperature, now);
+    sensorFilters.add(FIELD_HUMIDITY, reading.humidity, now);
+    temp = sensorFilters.value(FIELD_TEMPERATURE);
+    humidity = sensorFilters.value(FIELD_HUMIDITY);
+    scheduler.trigger(detectTaskId);
+}
 
+void detectTask() {
+    if (WiFi.status() != WL_CONNECTED) {
+        return;
+    }
     parseAndSendData();
-    
-    delay(10000); // Delay between data parsing
+}
+
+void wifiTask() {
+    if (WiFi.status() != WL_CONNECTED) {
+        LOG_WARN("WiFi connection lost. Reconnecting...");
+        WiFi.reconnect();
+    }
+}
+
+void printTaskStats() {
+    LOG_INFO("Task Statistics:");
+    for (size_t id = 0; id < scheduler.capacity(); id++) {
+        const SchedulerTask &task = scheduler.task(id);
+        if (!task.active) continue;
+        LOG_INFO("%-8s runs: %lu, avg: %lu us, max: %lu us, max late: %lu ms",
+                 task.name, task.runs, task.runs ? task.totalMicros / task.runs : 0,
+                 task.maxMicros, task.maxLateness);
+    }
+
+    const ChangeDetector<FIELD_COUNT>::Stats &stats = changeDetector.stats();
+    LOG_INFO("Change detection: %lu samples, %lu sent, %.1f%% suppressed "
+             "(deadband %lu, rate %lu, heartbeat %lu)",
+             stats.samples, stats.sends, changeDetector.suppressionRatio() * 100,
+             stats.deadbandTriggers, stats.rateTriggers, stats.heartbeats);
+
+    SensorFilter::Stats filterStats = sensorFilters.stats();
+    LOG_INFO("Filters: %lu samples, %lu rejected, %lu snaps",
+             filterStats.samples, filterStats.rejected, filterStats.snaps);
+
+    const DhtCache &dhtCache = dht.cache();
+    const DhtCache::Stats &dhtStats = dhtCache.stats();
+    LOG_INFO("DHT22: %lu reads, %lu failed, max %lu in a row",
+             dhtStats.reads, dhtCache.failures(), dhtStats.maxConsecutiveFailures);
+    LOG_INFO("DHT22 failures: no response %lu, late start %lu, timing %lu, truncated %lu, "
+             "checksum %lu, range %lu",
+             dhtStats.errors[DHT_NO_RESPONSE], dhtStats.errors[DHT_LATE_START],
+             dhtStats.errors[DHT_TIMING], dhtStats.errors[DHT_TRUNCATED],
+             dhtStats.errors[DHT_CHECKSUM], dhtStats.errors[DHT_RANGE]);
+    printTraceStats();
+}
+
+// 't' prints the stage histograms, 'r' resets them
+void serialTask() {
+    while (Serial.available() > 0) {
+        int command = Serial.read();
+        if (command == 't') {
+            printTraceStats();
+        } else if (command == 'r') {
+            tracer.reset();
+            LOG_INFO("Stage histograms reset");
+        }
+    }
+}
+
+void printTraceStats() {
+    LOG_INFO("Stage Latency (us):");
+    for (size_t i = 0; i < tracer.size(); i++) {
+        const StageHistogram &h = tracer.histogram(i);
+        if (h.count == 0) continue;
+        LOG_INFO("%-5s n=%lu avg %lu, p50 %lu, p90 %lu, p99 %lu, max %lu", tracer.name(i),
+                 h.count, traceAverage(h), tracePercentile(h, 0.5f), tracePercentile(h, 0.9f),
+                 tracePercentile(h, 0.99f), h.maxMicros);
+    }
+}
+
+void logTask(void* parameter) {
+    for (;;) {
+        logger.drain([](const char* line, size_t len) { Serial.write((const uint8_t*)line, len); });
+        vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_MS));
+    }
 }
 
 void connectToWiFi() {
+    // Connection completes in the background; detectTask waits for it
+    LOG_INFO("Connecting to WiFi...");
     WiFi.begin(SSID, PASSWORD);
-    while (WiFi.status() != WL_CONNECTED) {
-        delay(500);
-        Serial.println("Connecting to WiFi...");
-    }
-    Serial.println("Connected to WiFi");
 }
 
 void parseAndSendData() {
@@ -90,14 +242,19 @@ void parseAndSendData() {
     String url = constructUrl(humidity, temp, ec, ph, nitrogen, phosphorus, potassium, vbat, batCurrent, batPower, batChargeCurrent, batLevel);
     logSensorData(vbat, batCurrent, batPower, batChargeCurrent, batLevel);
 
-    if (!hasValidPreviousData || significantChange(temp)) {
-        previousJsonString = url;
-        previousTemp = temp;
-        hasValidPreviousData = true;
-        Serial.println("Sending data...");
-        sendToGoogleSheet(url);
+    float values[FIELD_COUNT] = {temp, humidity};
+    unsigned long now = millis();
+    uint8_t reasons = changeDetector.evaluate(values, now);
+
+    if (reasons != CHANGE_NONE) {
+        LOG_INFO("Sending data (%s)...", changeReasonName(reasons));
+        if (sendToGoogleSheet(url)) {
+            changeDetector.commit(values, now);
+        }
     } else {
-        Serial.printf("No significant change (diff: %.2f). Previous: %.2f, Current: %.2f\n", abs(temp - previousTemp), previousTemp, temp);
+        LOG_DEBUG("No significant change. Previous: %.2f°C %.2f%%, Current: %.2f°C %.2f%%",
+                  changeDetector.reference(FIELD_TEMPERATURE), changeDetector.reference(FIELD_HUMIDITY),
+                  temp, humidity);
     }
 }
 
@@ -119,46 +276,46 @@ String constructUrl(float humidity, float temperature, float ec, float ph, float
 }
 
 void logSensorData(float vbat, float batCurrent, float batPower, int batChargeCurrent, int batLevel) {
-    Serial.printf("Temperature: %.2f°C, Humidity: %.2f%%\n", temp, humidity);
+    LOG_DEBUG("Temperature: %.2f°C, Humidity: %.2f%%", temp, humidity);
     if (isPowerMonitorFound) {
-        Serial.println("Battery Status:");
-        Serial.printf("Voltage: %.2fV\nCurrent: %.2fmA\nPower: %.2fmW\nCharge Current: %dmA\nBattery Level: %d%%\n",
-                      vbat, batCurrent, batPower, batChargeCurrent, batLevel);
+        LOG_DEBUG("Battery: %.2fV, %.2fmA, %.2fmW, charge %dmA, level %d%%",
+                  vbat, batCurrent, batPower, batChargeCurrent, batLevel);
     }
 }
 
-bool significantChange(float currentValue) {
-    return abs(currentValue - previousTemp) > PROXIMITY_THRESHOLD;
-}
-
-void sendToGoogleSheet(String url) {
+bool sendToGoogleSheet(String url) {
+    TRACE_SCOPE(tracer, STAGE_HTTP);
     HTTPClient http;
     http.begin(url);
     http.setFollowRedirects(HTTPC_STRICT_FOLLOW_REDIRECTS);
-    Serial.println("Sending URL: " + url);
+    // The URL and response are Strings that are gone before the log is
+    // drained, so only their sizes are logged
+    LOG_INFO("Sending URL (%u bytes)", url.length());
   
     int httpCode = http.GET();
+    bool ok = httpCode == HTTP_CODE_OK;
     if (httpCode > 0) {
         if (httpCode == HTTP_CODE_OK) {
             String payload = http.getString();
-            Serial.println("Data sent successfully: " + payload);
+            LOG_INFO("Data sent successfully (%u byte response)", payload.length());
         } else {
-            Serial.printf("HTTP Error: %d\n", httpCode);
+            LOG_ERROR("HTTP Error: %d", httpCode);
         }
     } else {
-        Serial.println("Failed to send data");
+        LOG_ERROR("Failed to send data");
     }
     http.end();
+    return ok;
 }
 
 void initPowerMonitor() {
     Wire.begin(21, 22); // SDA, SCL
     if (!axp.begin(Wire, AXP192_SLAVE_ADDRESS)) {
-        Serial.println("AXP PASS!");
+        LOG_INFO("AXP PASS!");
         isPowerMonitorFound = true;
         return;
     }
-    Serial.println("AXP192 Power monitor initialized!");
+    LOG_INFO("AXP192 Power monitor initialized!");
     isPowerMonitorFound = true;
 
     // Configure power outputs
@@ -177,6 +334,7 @@ void getBatteryStats(float &vbat, float &batCurrent, float &batPower, int &batCh
         return;
     }
 
+    TRACE_SCOPE(tracer, STAGE_AXP);
     vbat = axp.getBattVoltage() / 1000.0;
     batCurrent = axp.getBattDischargeCurrent();
     batPower = axp.getBattInpower();
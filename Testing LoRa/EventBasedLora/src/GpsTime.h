@@ -0,0 +1,362 @@
+#pragma once
+
+// GPS time: an NMEA parser and a PPS-disciplined clock.
+//
+// NmeaParser takes the receiver's output a character at a time and pulls
+// UTC out of RMC sentences ($GPRMC, $GNRMC, ...) that pass the checksum and
+// report a valid fix.
+//
+// GpsClock maps the local microsecond clock (esp_timer_get_time on the
+// board) to Unix time. Its best source is the receiver's PPS output: each
+// pulse starts a UTC second and the RMC sentence that follows names it.
+// Once one pulse is labelled, later pulses are labelled by counting seconds,
+// and the local time between them measures the oscillator's rate error,
+// which is corrected between pulses and for GPS_HOLDOVER_US after they stop.
+//
+// Without PPS the clock falls back on when RMC sentences arrive, less
+// GPS_NMEA_DELAY_US. The receiver's output timing and the polling loop only
+// ever add delay, so the fallback keeps the earliest-arriving sentence of
+// the last GPS_NMEA_FILTER to two; expect a few ms rather than the few us
+// of PPS.
+//
+// Both classes take timestamps as arguments and have no Arduino dependency,
+// so recorded NMEA streams replay on the host, see TelemetryTools gps_replay.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define NMEA_MAX_SENTENCE 82  // Characters between '$' and the line end
+
+#ifndef GPS_NMEA_DELAY_US
+#define GPS_NMEA_DELAY_US 100000  // From the second's edge to the end of its RMC
+#endif
+#ifndef GPS_HOLDOVER_US
+#define GPS_HOLDOVER_US 600000000LL  // PPS time is kept 10 minutes after the last pulse
+#endif
+#define GPS_NMEA_MAX_WAIT_US 900000    // An RMC ends this soon after the pulse it names
+#define GPS_NMEA_MAX_GAP_US 50000      // Widest arrival window still paired with a pulse
+#define GPS_NMEA_TIMEOUT_US 10000000   // NMEA-only time is dropped 10 s after the last RMC
+#define GPS_NMEA_FILTER 16             // Sentences per block of the fallback filter
+#define GPS_PPS_TOLERANCE_US 1000      // Pulse distance from the predicted edge, plus drift
+#define GPS_MAX_DRIFT_PPB 200000       // 200 ppm; a larger rate error means a bad pulse
+
+struct GpsUtc {
+  uint16_t year;
+  uint8_t month;
+  uint8_t day;
+  uint8_t hour;
+  uint8_t minute;
+  uint8_t second;
+  uint16_t millis;
+};
+
+// Seconds since 1970-01-01 for a proleptic Gregorian UTC date
+inline int64_t gpsUnixSeconds(const GpsUtc& t) {
+  int32_t y = t.year - (t.month <= 2 ? 1 : 0);
+  int32_t era = (y >= 0 ? y : y - 399) / 400;
+  int32_t yearOfEra = y - era * 400;
+  int32_t dayOfYear = (153 * (t.month + (t.month > 2 ? -3 : 9)) + 2) / 5 + t.day - 1;
+  int32_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  int64_t days = (int64_t)era * 146097 + dayOfEra - 719468;
+  return days * 86400 + t.hour * 3600 + t.minute * 60 + t.second;
+}
+
+enum NmeaEvent : uint8_t {
+  NMEA_NONE = 0,      // Nothing complete yet, or a damaged sentence
+  NMEA_SENTENCE = 1,  // A valid sentence without time
+  NMEA_TIME = 2       // An RMC with a valid fix, see time()
+};
+
+class NmeaParser {
+public:
+  struct Stats {
+    unsigned long sentences = 0;       // Checksum good
+    unsigned long checksumErrors = 0;
+    unsigned long overruns = 0;        // Longer than NMEA_MAX_SENTENCE
+    unsigned long times = 0;           // RMC with a valid fix
+    unsigned long noFix = 0;           // RMC without one
+  };
+
+  NmeaEvent feed(char c) {
+    if (c == '$') {
+      _len = 0;
+      _active = true;
+      return NMEA_NONE;
+    }
+    if (!_active) return NMEA_NONE;
+    if (c == '\r' || c == '\n') {
+      _active = false;
+      _buffer[_len] = '\0';
+      return parse();
+    }
+    if (_len >= NMEA_MAX_SENTENCE) {
+      _active = false;
+      _stats.overruns++;
+      return NMEA_NONE;
+    }
+    _buffer[_len++] = c;
+    return NMEA_NONE;
+  }
+
+  // The last complete sentence, without '$' and line end
+  const char* sentence() const { return _buffer; }
+  const GpsUtc& time() const { return _time; }
+  int64_t unixMicros() const { return gpsUnixSeconds(_time) * 1000000 + _time.millis * 1000LL; }
+  const Stats& stats() const { return _stats; }
+
+private:
+  static int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+  }
+
+  static bool digits(const char* p, size_t count, int& value) {
+    value = 0;
+    for (size_t i = 0; i < count; i++) {
+      if (p[i] < '0' || p[i] > '9') return false;
+      value = value * 10 + (p[i] - '0');
+    }
+    return true;
+  }
+
+  // Field index of the sentence body (0 is the address, e.g. "GPRMC");
+  // nullptr if the sentence has fewer fields
+  const char* field(size_t index, size_t& len) const {
+    const char* p = _buffer;
+    const char* end = _buffer + _bodyLen;
+    for (size_t i = 0; i < index; i++) {
+      while (p < end && *p != ',') p++;
+      if (p == end) return nullptr;
+      p++;
+    }
+    const char* start = p;
+    while (p < end && *p != ',') p++;
+    len = (size_t)(p - start);
+    return start;
+  }
+
+  NmeaEvent parse() {
+    // "<body>*hh"
+    if (_len < 4 || _buffer[_len - 3] != '*') {
+      _stats.checksumErrors++;
+      return NMEA_NONE;
+    }
+    int high = hexDigit(_buffer[_len - 2]);
+    int low = hexDigit(_buffer[_len - 1]);
+    uint8_t checksum = 0;
+    _bodyLen = _len - 3;
+    for (size_t i = 0; i < _bodyLen; i++) checksum ^= (uint8_t)_buffer[i];
+    if (high < 0 || low < 0 || checksum != (uint8_t)(high << 4 | low)) {
+      _stats.checksumErrors++;
+      return NMEA_NONE;
+    }
+    _stats.sentences++;
+
+    // Any talker: GP (GPS), GN (combined), GL, GA, BD, ...
+    size_t len;
+    const char* address = field(0, len);
+    if (len != 5 || address[2] != 'R' || address[3] != 'M' || address[4] != 'C') return NMEA_SENTENCE;
+
+    const char* status = field(2, len);
+    if (status == nullptr || len != 1 || *status != 'A') {
+      _stats.noFix++;
+      return NMEA_SENTENCE;
+    }
+
+    // hhmmss[.s[s[s]]] and ddmmyy
+    size_t timeLen, dateLen;
+    const char* time = field(1, timeLen);
+    const char* date = field(9, dateLen);
+    int hour, minute, second, day, month, year;
+    if (time == nullptr || date == nullptr || timeLen < 6 || dateLen != 6 ||
+        !digits(time, 2, hour) || !digits(time + 2, 2, minute) || !digits(time + 4, 2, second) ||
+        !digits(date, 2, day) || !digits(date + 2, 2, month) || !digits(date + 4, 2, year) ||
+        hour > 23 || minute > 59 || second > 60 || day < 1 || day > 31 || month < 1 || month > 12) {
+      _stats.noFix++;
+      return NMEA_SENTENCE;
+    }
+    int millis = 0;
+    if (timeLen > 7 && time[6] == '.') {
+      int scale = 100;
+      for (size_t i = 7; i < timeLen && scale > 0; i++, scale /= 10) {
+        if (time[i] < '0' || time[i] > '9') break;
+        millis += (time[i] - '0') * scale;
+      }
+    }
+
+    _time.year = (uint16_t)(2000 + year);
+    _time.month = (uint8_t)month;
+    _time.day = (uint8_t)day;
+    _time.hour = (uint8_t)hour;
+    _time.minute = (uint8_t)minute;
+    _time.second = (uint8_t)(second > 59 ? 59 : second);  // A leap second reads as :59
+    _time.millis = (uint16_t)millis;
+    _stats.times++;
+    return NMEA_TIME;
+  }
+
+  char _buffer[NMEA_MAX_SENTENCE + 1] = {};
+  size_t _len = 0;
+  size_t _bodyLen = 0;
+  bool _active = false;
+  GpsUtc _time = {};
+  Stats _stats;
+};
+
+enum GpsTimeSource : uint8_t { GPS_TIME_NONE, GPS_TIME_NMEA, GPS_TIME_PPS };
+
+inline const char* gpsTimeSourceName(GpsTimeSource source) {
+  switch (source) {
+    case GPS_TIME_PPS: return "pps";
+    case GPS_TIME_NMEA: return "nmea";
+    default: return "none";
+  }
+}
+
+class GpsClock {
+public:
+  struct Stats {
+    unsigned long pulses = 0;
+    unsigned long rejected = 0;     // Pulses too far from the predicted edge
+    unsigned long locks = 0;        // Pulses labelled from an RMC
+    unsigned long mismatches = 0;   // An RMC contradicted the pulse count
+    unsigned long nmeaTimes = 0;
+    int32_t lastResidual = 0;       // us, last pulse against its prediction
+    uint32_t maxResidual = 0;       // us, absolute
+  };
+
+  // A PPS edge, timestamped in the interrupt
+  void onPulse(int64_t local) {
+    _stats.pulses++;
+    _lastPulse = local;
+    _hasPulse = true;
+    if (!_locked) return;
+
+    int64_t elapsed = local - _ppsLocal;
+    if (elapsed <= 0) return;
+    if (elapsed > GPS_HOLDOVER_US) {
+      _locked = false;  // Too long to count seconds reliably, wait for an RMC
+      return;
+    }
+
+    int64_t predicted = _ppsUnix + corrected(elapsed);
+    int64_t second = (predicted + 500000) / 1000000 * 1000000;
+    int64_t residual = predicted - second;
+    int64_t tolerance = GPS_PPS_TOLERANCE_US + elapsed * GPS_MAX_DRIFT_PPB / 1000000000;
+    if (second <= _ppsUnix || residual > tolerance || residual < -tolerance) {
+      _stats.rejected++;
+      return;
+    }
+    _stats.lastResidual = (int32_t)residual;
+    uint32_t magnitude = (uint32_t)(residual < 0 ? -residual : residual);
+    if (magnitude > _stats.maxResidual) _stats.maxResidual = magnitude;
+
+    // Rate error from the local time between two labelled pulses
+    int64_t utcElapsed = second - _ppsUnix;
+    int64_t measured = (elapsed - utcElapsed) * 1000000000 / utcElapsed;
+    if (measured <= GPS_MAX_DRIFT_PPB && measured >= -GPS_MAX_DRIFT_PPB) {
+      _driftPpb = _hasDrift ? _driftPpb + (int32_t)((measured - _driftPpb) / 8) : (int32_t)measured;
+      _hasDrift = true;
+    }
+    _ppsLocal = local;
+    _ppsUnix = second;
+  }
+
+  // An RMC time whose sentence ended somewhere between receivedAfter and
+  // receivedAt (the previous and the current poll of the UART)
+  void onNmeaTime(int64_t unixMicros, int64_t receivedAfter, int64_t receivedAt) {
+    _stats.nmeaTimes++;
+    int64_t offset = unixMicros + GPS_NMEA_DELAY_US - receivedAt;
+    if (_nmeaCount == 0 || offset > _nmeaBest) _nmeaBest = offset;
+    if (++_nmeaCount >= GPS_NMEA_FILTER) {
+      _nmeaPrevious = _nmeaBest;
+      _hasNmeaPrevious = true;
+      _nmeaCount = 0;
+    }
+    _lastNmea = receivedAt;
+    _hasNmea = true;
+
+    // Pair with the pulse before the sentence, when that is unambiguous:
+    // the window is narrow, the pulse came before it and not too long ago
+    if (unixMicros % 1000000 != 0 || !_hasPulse) return;
+    if (receivedAt - receivedAfter > GPS_NMEA_MAX_GAP_US) return;
+    if (_lastPulse >= receivedAfter || receivedAt - _lastPulse > GPS_NMEA_MAX_WAIT_US) return;
+
+    if (!_locked) {
+      _stats.locks++;
+    } else if (_ppsLocal != _lastPulse) {
+      return;  // The pulse was rejected; the lock holds until holdover ends
+    } else if (_ppsUnix == unixMicros) {
+      return;
+    } else {
+      _stats.mismatches++;
+    }
+    _ppsLocal = _lastPulse;
+    _ppsUnix = unixMicros;
+    _locked = true;
+  }
+
+  GpsTimeSource source(int64_t local) const {
+    if (_locked && distance(local, _ppsLocal) <= GPS_HOLDOVER_US) return GPS_TIME_PPS;
+    if (_hasNmea && distance(local, _lastNmea) <= GPS_NMEA_TIMEOUT_US) return GPS_TIME_NMEA;
+    return GPS_TIME_NONE;
+  }
+
+  // Unix time for a local timestamp; false if there is no usable source
+  bool toUnixMicros(int64_t local, int64_t& unixMicros) const {
+    switch (source(local)) {
+      case GPS_TIME_PPS:
+        unixMicros = _ppsUnix + corrected(local - _ppsLocal);
+        return true;
+      case GPS_TIME_NMEA:
+        unixMicros = local + nmeaOffset();
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // Unix ms, 0 if unknown
+  uint64_t unixMillis(int64_t local) const {
+    int64_t unixMicros;
+    return toUnixMicros(local, unixMicros) && unixMicros > 0 ? (uint64_t)(unixMicros / 1000) : 0;
+  }
+
+  // Local oscillator rate error, positive when it runs fast
+  int32_t driftPpb() const { return _driftPpb; }
+  const Stats& stats() const { return _stats; }
+
+private:
+  static int64_t distance(int64_t a, int64_t b) { return a > b ? a - b : b - a; }
+
+  int64_t corrected(int64_t elapsed) const {
+    return elapsed - elapsed * _driftPpb / 1000000000;
+  }
+
+  int64_t nmeaOffset() const {
+    if (!_hasNmeaPrevious) return _nmeaBest;
+    if (_nmeaCount == 0) return _nmeaPrevious;
+    return _nmeaBest > _nmeaPrevious ? _nmeaBest : _nmeaPrevious;
+  }
+
+  // PPS anchor: the last labelled pulse
+  bool _locked = false;
+  int64_t _ppsLocal = 0;
+  int64_t _ppsUnix = 0;
+  int32_t _driftPpb = 0;
+  bool _hasDrift = false;
+  int64_t _lastPulse = 0;
+  bool _hasPulse = false;
+
+  // NMEA fallback: Unix minus local time, largest over two filter blocks
+  int64_t _nmeaBest = 0;
+  int64_t _nmeaPrevious = 0;
+  size_t _nmeaCount = 0;
+  bool _hasNmeaPrevious = false;
+  int64_t _lastNmea = 0;
+  bool _hasNmea = false;
+
+  Stats _stats;
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+// LoRa time on air, following the SX1276 datasheet (section 4.1.1.7):
+//
+//   Tsym     = 2^SF / BW
+//   Tpream   = (preamble + 4.25) * Tsym
+//   payload  = 8 + max(ceil((8PL - 4SF + 28 + 16CRC - 20IH) / (4(SF - 2DE))) * (CR + 4), 0)
+//
+// DE (low data rate optimisation) is on when a symbol is longer than 16 ms.
+// Everything is constexpr so airtime of fixed-size frames can be checked at
+// compile time.
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct LoRaModulation {
+  uint8_t spreadingFactor;  // 6..12
+  uint32_t bandwidth;       // Hz
+  uint8_t codingRate;       // denominator of 4/x, 5..8
+  uint16_t preambleLength;  // symbols
+  bool explicitHeader;
+  bool crc;
+};
+
+// What LoRa.begin() leaves the radio at: SF7, 125 kHz, 4/5, 8 symbol
+// preamble, explicit header, CRC off
+constexpr LoRaModulation LORA_DEFAULT_MODULATION = {7, 125000, 5, 8, true, false};
+
+constexpr uint32_t loraSymbolMicros(const LoRaModulation& m) {
+  return (uint32_t)(((uint64_t)1000000 << m.spreadingFactor) / m.bandwidth);
+}
+
+constexpr bool loraLowDataRateOptimize(const LoRaModulation& m) {
+  return loraSymbolMicros(m) > 16000;
+}
+
+constexpr int32_t loraPayloadBits(const LoRaModulation& m, size_t length) {
+  return 8 * (int32_t)length - 4 * m.spreadingFactor + 28 + (m.crc ? 16 : 0) - (m.explicitHeader ? 0 : 20);
+}
+
+constexpr int32_t loraBitsPerBlock(const LoRaModulation& m) {
+  return 4 * (m.spreadingFactor - (loraLowDataRateOptimize(m) ? 2 : 0));
+}
+
+constexpr uint32_t loraPayloadSymbols(const LoRaModulation& m, size_t length) {
+  return 8 + (loraPayloadBits(m, length) > 0
+                  ? (uint32_t)((loraPayloadBits(m, length) + loraBitsPerBlock(m) - 1) / loraBitsPerBlock(m)) *
+                        m.codingRate
+                  : 0);
+}
+
+// Time on air of a packet with length payload bytes, in microseconds
+constexpr uint32_t loraAirtimeMicros(const LoRaModulation& m, size_t length) {
+  return (4 * m.preambleLength + 17) * loraSymbolMicros(m) / 4 + loraPayloadSymbols(m, length) * loraSymbolMicros(m);
+}
+
+static_assert(loraAirtimeMicros(LORA_DEFAULT_MODULATION, 25) == 61696, "SF7/125 kHz, 25 byte frame");
@@ -0,0 +1,267 @@
+#pragma once
+
+// Reed-Solomon forward error correction over GF(256) for LoRa frames.
+//
+// A packet is one shortened RS codeword: the data bytes followed by
+// `parity` check bytes, correcting up to parity / 2 corrupted bytes
+// anywhere in the packet. A LoRa symbol carries SF bits, so a bad symbol
+// damages one or two bytes; a byte-oriented code fits that error pattern
+// better than bit-level parity.
+//
+// The field polynomial is x^8 + x^4 + x^3 + x^2 + 1 (0x11d) with generator
+// 2, and the code's roots are 2^0 .. 2^(parity - 1). Decoding is
+// errors-only: syndromes, Berlekamp-Massey, Chien search, Forney.
+//
+// Radio CRC has to be off for FEC to help, otherwise the radio drops a
+// damaged packet before the decoder sees it. That leaves nothing to catch
+// a miscorrection, where a packet with more errors than the code can fix
+// lands on a different valid codeword, so the codeword carries its own
+// CRC-16 of the payload, checked after decoding.
+//
+// Frames on air:
+//    0     1  LORA_FEC_MAGIC
+//    1     1  parity bytes
+//    2     -  codeword: payload, CRC-16/CCITT of the payload (big endian),
+//             then parity
+// The two header bytes are not protected.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define LORA_FEC_MAGIC 0xF1
+#define FEC_HEADER_SIZE 2
+#define FEC_CHECK_SIZE 2
+#define FEC_UNREPAIRABLE -1   // More errors than the code can fix
+#define FEC_BAD_CHECK -2      // Decoded, but the CRC does not match
+#define RS_MAX_PARITY 32
+#define RS_MAX_CODEWORD 255
+
+namespace reed_solomon {
+
+struct Tables {
+  uint8_t exp[512];  // doubled so products need no modulo
+  uint8_t log[256];
+
+  Tables() {
+    uint16_t x = 1;
+    for (int i = 0; i < 255; i++) {
+      exp[i] = (uint8_t)x;
+      log[x] = (uint8_t)i;
+      x <<= 1;
+      if (x & 0x100) x ^= 0x11d;
+    }
+    for (int i = 255; i < 512; i++) exp[i] = exp[i - 255];
+    log[0] = 0;
+  }
+};
+
+inline const Tables& tables() {
+  static const Tables t;
+  return t;
+}
+
+inline uint8_t mul(uint8_t a, uint8_t b) {
+  if (a == 0 || b == 0) return 0;
+  const Tables& t = tables();
+  return t.exp[t.log[a] + t.log[b]];
+}
+
+inline uint8_t div(uint8_t a, uint8_t b) {
+  if (a == 0) return 0;
+  const Tables& t = tables();
+  return t.exp[t.log[a] + 255 - t.log[b]];
+}
+
+// 2^power
+inline uint8_t alpha(int power) {
+  power %= 255;
+  if (power < 0) power += 255;
+  return tables().exp[power];
+}
+
+// CRC-16/CCITT-FALSE: polynomial 0x1021, initial value 0xffff
+inline uint16_t crc16(const uint8_t* data, size_t len) {
+  uint16_t crc = 0xffff;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= (uint16_t)(data[i] << 8);
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (uint16_t)(crc << 1 ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+}  // namespace reed_solomon
+
+class ReedSolomon {
+public:
+  // parity: check bytes per codeword, even, at most RS_MAX_PARITY
+  explicit ReedSolomon(uint8_t parity) : _parity(parity) {
+    using namespace reed_solomon;
+    // generator(x) = (x - 2^0)(x - 2^1)...(x - 2^(parity-1)), highest
+    // degree first
+    memset(_generator, 0, sizeof(_generator));
+    _generator[0] = 1;
+    for (uint8_t i = 0; i < parity; i++) {
+      uint8_t root = alpha(i);
+      for (int j = i + 1; j > 0; j--) {
+        _generator[j] ^= mul(_generator[j - 1], root);
+      }
+    }
+  }
+
+  uint8_t parity() const { return _parity; }
+
+  // Appends parity bytes to data[0..len) in out, which may be data itself.
+  // Returns the codeword length, or 0 if it would exceed RS_MAX_CODEWORD.
+  size_t encode(const uint8_t* data, size_t len, uint8_t* out) const {
+    using namespace reed_solomon;
+    if (len + _parity > RS_MAX_CODEWORD) return 0;
+    if (out != data) memmove(out, data, len);
+
+    uint8_t* remainder = out + len;
+    memset(remainder, 0, _parity);
+    for (size_t i = 0; i < len; i++) {
+      uint8_t factor = out[i] ^ remainder[0];
+      memmove(remainder, remainder + 1, _parity - 1);
+      remainder[_parity - 1] = 0;
+      if (factor == 0) continue;
+      for (uint8_t j = 0; j < _parity; j++) {
+        remainder[j] ^= mul(_generator[j + 1], factor);
+      }
+    }
+    return len + _parity;
+  }
+
+  // Corrects codeword[0..len) in place. Returns the number of corrected
+  // bytes, or -1 if there were more errors than the code can fix.
+  static int decode(uint8_t* codeword, size_t len, uint8_t parity) {
+    using namespace reed_solomon;
+    if (parity == 0 || parity > RS_MAX_PARITY || len <= parity || len > RS_MAX_CODEWORD) return -1;
+
+    // Syndromes S_j = r(2^j); all zero means no errors
+    uint8_t syndromes[RS_MAX_PARITY];
+    bool clean = true;
+    for (uint8_t j = 0; j < parity; j++) {
+      uint8_t x = alpha(j);
+      uint8_t s = 0;
+      for (size_t i = 0; i < len; i++) s = mul(s, x) ^ codeword[i];
+      syndromes[j] = s;
+      if (s != 0) clean = false;
+    }
+    if (clean) return 0;
+
+    // Berlekamp-Massey: error locator lambda(x), lowest degree first
+    uint8_t lambda[RS_MAX_PARITY + 1] = {1};
+    uint8_t previous[RS_MAX_PARITY + 1] = {1};
+    uint8_t errors = 0;
+    uint8_t shift = 1;
+    uint8_t lastDiscrepancy = 1;
+    for (uint8_t n = 0; n < parity; n++) {
+      uint8_t d = syndromes[n];
+      for (uint8_t i = 1; i <= errors; i++) d ^= mul(lambda[i], syndromes[n - i]);
+      if (d == 0) {
+        shift++;
+        continue;
+      }
+      uint8_t scale = div(d, lastDiscrepancy);
+      if (2 * errors <= n) {
+        uint8_t saved[RS_MAX_PARITY + 1];
+        memcpy(saved, lambda, sizeof(saved));
+        for (int i = 0; i + shift <= RS_MAX_PARITY; i++) lambda[i + shift] ^= mul(scale, previous[i]);
+        errors = n + 1 - errors;
+        memcpy(previous, saved, sizeof(previous));
+        lastDiscrepancy = d;
+        shift = 1;
+      } else {
+        for (int i = 0; i + shift <= RS_MAX_PARITY; i++) lambda[i + shift] ^= mul(scale, previous[i]);
+        shift++;
+      }
+    }
+    if (2 * errors > parity) return -1;
+
+    // Chien search: byte i holds the coefficient of x^(len-1-i), so an
+    // error there has locator 2^(len-1-i), a root of lambda at its inverse
+    uint8_t positions[RS_MAX_PARITY / 2];
+    uint8_t found = 0;
+    for (size_t power = 0; power < len; power++) {
+      uint8_t x = alpha(-(int)power);
+      uint8_t value = 0;
+      for (int i = errors; i >= 0; i--) value = mul(value, x) ^ lambda[i];
+      if (value == 0) {
+        if (found == errors) return -1;
+        positions[found++] = (uint8_t)power;
+      }
+    }
+    if (found != errors) return -1;
+
+    // Forney: omega(x) = S(x) lambda(x) mod x^parity, and with the first
+    // root at 2^0 the error value is X * omega(1/X) / lambda'(1/X)
+    uint8_t omega[RS_MAX_PARITY];
+    for (uint8_t i = 0; i < parity; i++) {
+      uint8_t v = 0;
+      for (uint8_t j = 0; j <= i && j <= errors; j++) v ^= mul(lambda[j], syndromes[i - j]);
+      omega[i] = v;
+    }
+    for (uint8_t k = 0; k < found; k++) {
+      uint8_t power = positions[k];
+      uint8_t xInverse = alpha(-(int)power);
+
+      uint8_t numerator = 0;
+      for (int i = parity - 1; i >= 0; i--) numerator = mul(numerator, xInverse) ^ omega[i];
+      // Formal derivative keeps the odd terms: lambda'(x) = sum lambda_i x^(i-1), i odd
+      uint8_t denominator = 0;
+      uint8_t xInverseSquared = mul(xInverse, xInverse);
+      for (int i = errors - (errors % 2 == 0 ? 1 : 0); i >= 1; i -= 2) {
+        denominator = mul(denominator, xInverseSquared) ^ lambda[i];
+      }
+      if (denominator == 0) return -1;
+      uint8_t magnitude = mul(alpha(power), div(numerator, denominator));
+      codeword[len - 1 - power] ^= magnitude;
+    }
+    return found;
+  }
+
+private:
+  uint8_t _parity;
+  uint8_t _generator[RS_MAX_PARITY + 1];
+};
+
+// Wraps payload in a FEC frame. Returns 0 if it does not fit in capacity.
+inline size_t encodeFecFrame(const ReedSolomon& rs, const uint8_t* payload, size_t len,
+                             uint8_t* out, size_t capacity) {
+  if (capacity < FEC_HEADER_SIZE + len + FEC_CHECK_SIZE + rs.parity()) return 0;
+  uint8_t* codeword = out + FEC_HEADER_SIZE;
+  if (codeword != payload) memmove(codeword, payload, len);
+  uint16_t crc = reed_solomon::crc16(codeword, len);
+  codeword[len] = (uint8_t)(crc >> 8);
+  codeword[len + 1] = (uint8_t)crc;
+  out[0] = LORA_FEC_MAGIC;
+  out[1] = rs.parity();
+  size_t n = rs.encode(codeword, len + FEC_CHECK_SIZE, codeword);
+  return n ? FEC_HEADER_SIZE + n : 0;
+}
+
+inline bool isFecFrame(const uint8_t* data, size_t len) {
+  return len > FEC_HEADER_SIZE && data[0] == LORA_FEC_MAGIC;
+}
+
+// Corrects a FEC frame in place and points payload at the data inside it.
+// Returns the number of corrected bytes, FEC_UNREPAIRABLE, or FEC_BAD_CHECK
+// if the decoder settled on a codeword whose CRC is wrong.
+inline int decodeFecFrame(uint8_t* data, size_t len, uint8_t*& payload, size_t& payloadLen) {
+  if (!isFecFrame(data, len)) return FEC_UNREPAIRABLE;
+  uint8_t parity = data[1];
+  if (len < FEC_HEADER_SIZE + FEC_CHECK_SIZE + (size_t)parity + 1) return FEC_UNREPAIRABLE;
+  uint8_t* codeword = data + FEC_HEADER_SIZE;
+  int corrected = ReedSolomon::decode(codeword, len - FEC_HEADER_SIZE, parity);
+  if (corrected < 0) return FEC_UNREPAIRABLE;
+
+  size_t dataLen = len - FEC_HEADER_SIZE - FEC_CHECK_SIZE - parity;
+  uint16_t crc = (uint16_t)(codeword[dataLen] << 8 | codeword[dataLen + 1]);
+  if (crc != reed_solomon::crc16(codeword, dataLen)) return FEC_BAD_CHECK;
+  payload = codeword;
+  payloadLen = dataLen;
+  return corrected;
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+// Per-channel sample filtering ahead of change detection.
+//
+// Each channel takes samples at its own interval into a fixed ring buffer,
+// in fixed point (value * scale, rounded), and produces:
+//  - median: the median of the last `window` samples, which drops single
+//    spikes; until the ring fills it uses what it has, so there is no
+//    start-up delay
+//  - smoothing: an exponential moving average of the median with weight
+//    1/2^smoothing for the newest value, kept in an accumulator with
+//    `smoothing` extra fractional bits so small steps are not rounded away
+//  - snap: when the median moves further than this from the average, the
+//    average restarts at the median, so a real step goes through with only
+//    the median's delay instead of the average's slow approach
+//
+// A NaN sample is counted and skipped. Clocks are passed in so there is no
+// Arduino dependency.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+#define FILTER_MAX_WINDOW 9
+#define FILTER_MAX_SMOOTHING 8
+#define FILTER_LIMIT (INT32_MAX >> FILTER_MAX_SMOOTHING)  // Largest fixed-point sample
+
+struct FilterConfig {
+  unsigned long interval;  // ms between samples
+  uint16_t scale;          // fixed-point counts per unit, e.g. 100 for 0.01
+  uint8_t window;          // median of this many samples, 1 disables
+  uint8_t smoothing;       // average weight 1/2^smoothing, 0 disables
+  float snap;              // units, 0 disables
+};
+
+class SensorFilter {
+public:
+  struct Stats {
+    unsigned long samples = 0;
+    unsigned long rejected = 0;  // NaN
+    unsigned long snaps = 0;
+  };
+
+  void configure(const FilterConfig& config) {
+    _config = &config;
+    _window = config.window < 1 ? 1 : (config.window > FILTER_MAX_WINDOW ? FILTER_MAX_WINDOW : config.window);
+    _smoothing = config.smoothing > FILTER_MAX_SMOOTHING ? FILTER_MAX_SMOOTHING : config.smoothing;
+    _snap = (int32_t)lroundf(config.snap * config.scale);
+  }
+
+  bool due(unsigned long now) const {
+    return _count == 0 || now - _sampledAt >= _config->interval;
+  }
+
+  void add(float value, unsigned long now) {
+    _sampledAt = now;
+    if (isnan(value)) {
+      _stats.rejected++;
+      return;
+    }
+    _stats.samples++;
+
+    float scaled = value * _config->scale;
+    if (scaled > FILTER_LIMIT) scaled = FILTER_LIMIT;
+    if (scaled < -FILTER_LIMIT) scaled = -FILTER_LIMIT;
+    _ring[_head] = (int32_t)lroundf(scaled);
+    _head = (uint8_t)((_head + 1) % _window);
+    if (_count < _window) _count++;
+
+    int32_t median = this->median();
+    if (!_ready) {
+      _accumulator = median * (1 << _smoothing);
+      _ready = true;
+      return;
+    }
+    int32_t step = median - output();
+    if (_smoothing > 0 && _snap > 0 && (step > _snap || step < -_snap)) {
+      _accumulator = median * (1 << _smoothing);
+      _stats.snaps++;
+      return;
+    }
+    _accumulator += step;
+  }
+
+  bool ready() const { return _ready; }
+
+  // Filtered value, fixed point and in units
+  int32_t raw() const { return output(); }
+  float value() const { return (float)output() / _config->scale; }
+
+  const Stats& stats() const { return _stats; }
+
+private:
+  int32_t median() const {
+    int32_t sorted[FILTER_MAX_WINDOW];
+    for (uint8_t i = 0; i < _count; i++) {
+      int32_t sample = _ring[i];
+      uint8_t j = i;
+      while (j > 0 && sorted[j - 1] > sample) {
+        sorted[j] = sorted[j - 1];
+        j--;
+      }
+      sorted[j] = sample;
+    }
+    // Lower median for an even count
+    return sorted[(_count - 1) / 2];
+  }
+
+  // The accumulator holds the average scaled by 2^smoothing; round to nearest
+  int32_t output() const {
+    if (_smoothing == 0) return _accumulator;
+    return (_accumulator + (1 << (_smoothing - 1))) >> _smoothing;
+  }
+
+  const FilterConfig* _config = nullptr;
+  uint8_t _window = 1;
+  uint8_t _smoothing = 0;
+  int32_t _snap = 0;
+  int32_t _ring[FILTER_MAX_WINDOW] = {};
+  uint8_t _head = 0;
+  uint8_t _count = 0;
+  int32_t _accumulator = 0;
+  bool _ready = false;
+  unsigned long _sampledAt = 0;
+  Stats _stats;
+};
+
+template <size_t N>
+class SensorPipeline {
+public:
+  explicit SensorPipeline(const FilterConfig (&configs)[N]) {
+    for (size_t i = 0; i < N; i++) _filters[i].configure(configs[i]);
+  }
+
+  bool due(size_t channel, unsigned long now) const { return _filters[channel].due(now); }
+  void add(size_t channel, float value, unsigned long now) { _filters[channel].add(value, now); }
+
+  // Every channel has a filtered value
+  bool ready() const {
+    for (size_t i = 0; i < N; i++) {
+      if (!_filters[i].ready()) return false;
+    }
+    return true;
+  }
+
+  float value(size_t channel) const { return _filters[channel].value(); }
+  const SensorFilter& channel(size_t channel) const { return _filters[channel]; }
+
+  // Filtered values for ChangeDetector::evaluate() and the payload
+  void values(float (&out)[N]) const {
+    for (size_t i = 0; i < N; i++) out[i] = _filters[i].value();
+  }
+
+  // Summed over all channels
+  SensorFilter::Stats stats() const {
+    SensorFilter::Stats total;
+    for (size_t i = 0; i < N; i++) {
+      const SensorFilter::Stats& stats = _filters[i].stats();
+      total.samples += stats.samples;
+      total.rejected += stats.rejected;
+      total.snaps += stats.snaps;
+    }
+    return total;
+  }
+
+private:
+  SensorFilter _filters[N];
+};
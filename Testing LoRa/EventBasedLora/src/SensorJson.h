@@ -0,0 +1,117 @@
+#pragma once
+
+// Heap-free JSON for sensor readings.
+//
+// writeSensorJson() writes the uplink document straight into the caller's
+// buffer, with no JsonDocument (ArduinoJson 7 documents allocate from the
+// heap whatever their declared size) and no printf. Keys come in the order
+// the gateway and JsonCompressor.h's dictionary expect:
+//
+//   {"type":"sensor","lahanID":1,"ts":...,"sensor":{"Humidity":...,
+//    "Temperature":...,"Ec":...,"Ph":...,"Nitrogen":...,"Phosporus":...,
+//    "Kalium":...},"battery":{"voltage":...,"dischargeCurrent":...,
+//    "percentage":...,"chargeCurrent":...}}
+//
+// "ts" is only present when capturedAt is known. Numbers carry up to two
+// decimals with trailing zeros dropped, as ArduinoJson prints them; a value
+// that is not finite is written as null.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include "SensorFrame.h"
+
+class FixedJsonWriter {
+public:
+  FixedJsonWriter(char* out, size_t size) : _out(out), _size(size) {}
+
+  void raw(const char* text) {
+    while (*text) put(*text++);
+  }
+
+  void integer(uint64_t value) {
+    char digits[20];
+    size_t n = 0;
+    do {
+      digits[n++] = (char)('0' + value % 10);
+      value /= 10;
+    } while (value != 0);
+    while (n > 0) put(digits[--n]);
+  }
+
+  // Two decimals, rounded
+  void number(float value) {
+    if (!isfinite(value) || fabsf(value) >= 1e15f) {
+      raw("null");
+      return;
+    }
+    int64_t hundredths = (int64_t)llroundf(value * 100.0f);
+    if (hundredths < 0) {
+      put('-');
+      hundredths = -hundredths;
+    }
+    integer((uint64_t)(hundredths / 100));
+    int fraction = (int)(hundredths % 100);
+    if (fraction != 0) {
+      put('.');
+      put((char)('0' + fraction / 10));
+      if (fraction % 10 != 0) put((char)('0' + fraction % 10));
+    }
+  }
+
+  // NUL-terminates; the length written, or 0 if it did not fit
+  size_t finish() {
+    if (_overflow || _length >= _size) return 0;
+    _out[_length] = '\0';
+    return _length;
+  }
+
+private:
+  void put(char c) {
+    if (_length + 1 < _size) {
+      _out[_length++] = c;
+    } else {
+      _overflow = true;
+    }
+  }
+
+  char* _out;
+  size_t _size;
+  size_t _length = 0;
+  bool _overflow = false;
+};
+
+// Length of the document without the NUL, or 0 if it does not fit in size
+inline size_t writeSensorJson(const SensorReading& reading, char* out, size_t size) {
+  FixedJsonWriter json(out, size);
+  json.raw("{\"type\":\"sensor\",\"lahanID\":");
+  json.integer(reading.lahanID);
+  if (reading.capturedAt != 0) {
+    json.raw(",\"ts\":");
+    json.integer(reading.capturedAt);
+  }
+  json.raw(",\"sensor\":{\"Humidity\":");
+  json.number(reading.humidity);
+  json.raw(",\"Temperature\":");
+  json.number(reading.temperature);
+  json.raw(",\"Ec\":");
+  json.number(reading.ec);
+  json.raw(",\"Ph\":");
+  json.number(reading.ph);
+  json.raw(",\"Nitrogen\":");
+  json.number(reading.nitrogen);
+  json.raw(",\"Phosporus\":");
+  json.number(reading.phosphorus);
+  json.raw(",\"Kalium\":");
+  json.number(reading.potassium);
+  json.raw("},\"battery\":{\"voltage\":");
+  json.number(reading.batteryVoltage);
+  json.raw(",\"dischargeCurrent\":");
+  json.number(reading.dischargeCurrent);
+  json.raw(",\"percentage\":");
+  json.number(reading.batteryPercentage);
+  json.raw(",\"chargeCurrent\":");
+  json.number(reading.chargeCurrent);
+  json.raw("}}");
+  return json.finish();
+}
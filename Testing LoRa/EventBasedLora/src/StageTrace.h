@@ -0,0 +1,131 @@
+#pragma once
+
+// Per-stage latency histograms.
+//
+// Each stage of the pipeline (sensor read, serialization, TX, ...) gets a
+// fixed histogram with power-of-two buckets: bucket 0 counts durations
+// under 1 us, bucket b durations in [2^(b-1), 2^b) us, and the last bucket
+// everything from about 8 s up. Recording is a handful of integer
+// operations and no allocation, so stages can stay instrumented in
+// production builds.
+//
+// Percentiles are estimated from the buckets, so they are only exact to
+// within the bucket width; count, average, min and max are exact.
+//
+// The clock is passed in (esp_timer_get_time on the board) so the class has
+// no Arduino dependency. Time a block with
+//   TRACE_SCOPE(tracer, STAGE_ID);
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TRACE_BUCKETS 25
+
+struct StageHistogram {
+  uint32_t count;
+  uint32_t minMicros;
+  uint32_t maxMicros;
+  uint64_t totalMicros;
+  uint32_t buckets[TRACE_BUCKETS];
+};
+
+inline size_t traceBucket(uint32_t micros) {
+  size_t bucket = 0;
+  while (micros != 0 && bucket < TRACE_BUCKETS - 1) {
+    micros >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+// Duration below which a fraction q of the samples fall, interpolated
+// linearly inside the bucket that holds it
+inline uint32_t tracePercentile(const StageHistogram& h, float q) {
+  if (h.count == 0) return 0;
+  uint32_t rank = (uint32_t)(q * h.count + 0.5f);
+  if (rank < 1) rank = 1;
+  uint32_t seen = 0;
+  for (size_t b = 0; b < TRACE_BUCKETS; b++) {
+    if (seen + h.buckets[b] < rank) {
+      seen += h.buckets[b];
+      continue;
+    }
+    uint32_t lower = b > 0 ? (uint32_t)1 << (b - 1) : 0;
+    uint32_t upper = b < TRACE_BUCKETS - 1 ? ((uint32_t)1 << b) - 1 : h.maxMicros;
+    if (lower < h.minMicros) lower = h.minMicros;
+    if (upper > h.maxMicros) upper = h.maxMicros;
+    if (upper <= lower) return lower;
+    float position = (float)(rank - seen) / h.buckets[b];
+    return lower + (uint32_t)((upper - lower) * position);
+  }
+  return h.maxMicros;
+}
+
+inline uint32_t traceAverage(const StageHistogram& h) {
+  return h.count ? (uint32_t)(h.totalMicros / h.count) : 0;
+}
+
+template <size_t N>
+class StageTracer {
+public:
+  typedef int64_t (*ClockFn)();
+
+  StageTracer(const char* const (&names)[N], ClockFn clock) : _names(names), _clock(clock) {
+    reset();
+  }
+
+  int64_t now() const { return _clock(); }
+
+  void record(size_t stage, uint32_t micros) {
+    if (stage >= N) return;
+    StageHistogram& h = _histograms[stage];
+    if (h.count == 0 || micros < h.minMicros) h.minMicros = micros;
+    if (micros > h.maxMicros) h.maxMicros = micros;
+    h.count++;
+    h.totalMicros += micros;
+    h.buckets[traceBucket(micros)]++;
+  }
+
+  void recordSince(size_t stage, int64_t start) {
+    record(stage, (uint32_t)(_clock() - start));
+  }
+
+  void reset() {
+    for (size_t i = 0; i < N; i++) {
+      StageHistogram& h = _histograms[i];
+      h.count = h.minMicros = h.maxMicros = 0;
+      h.totalMicros = 0;
+      for (size_t b = 0; b < TRACE_BUCKETS; b++) h.buckets[b] = 0;
+    }
+  }
+
+  size_t size() const { return N; }
+  const char* name(size_t stage) const { return _names[stage]; }
+  const StageHistogram& histogram(size_t stage) const { return _histograms[stage]; }
+
+private:
+  const char* const (&_names)[N];
+  ClockFn _clock;
+  StageHistogram _histograms[N];
+};
+
+// Records the lifetime of the scope as one sample of a stage
+template <typename Tracer>
+class TraceScope {
+public:
+  TraceScope(Tracer& tracer, size_t stage) : _tracer(tracer), _stage(stage), _start(tracer.now()) {}
+  ~TraceScope() { _tracer.recordSince(_stage, _start); }
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+  Tracer& _tracer;
+  size_t _stage;
+  int64_t _start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(tracer, stage) \
+  TraceScope<decltype(tracer)> TRACE_CONCAT(traceScope, __LINE__)(tracer, stage)
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Coalesces single-byte writes into chunks before handing them to the
+// target. serializeJson() emits one character at a time, and PubSubClient
+// forwards every write() straight to the TCP socket, so without this each
+// byte of a streamed payload would become its own socket write.
+template <size_t N>
+class BufferedPrint : public Print {
+public:
+  explicit BufferedPrint(Print& target) : _target(target) {}
+  ~BufferedPrint() { flush(); }
+
+  size_t write(uint8_t c) override {
+    _buffer[_length++] = c;
+    if (_length == N) flush();
+    return 1;
+  }
+
+  size_t write(const uint8_t* data, size_t size) override {
+    for (size_t i = 0; i < size; i++) write(data[i]);
+    return size;
+  }
+
+  void flush() override {
+    if (_length == 0) return;
+    _target.write(_buffer, _length);
+    _length = 0;
+  }
+
+private:
+  Print& _target;
+  uint8_t _buffer[N];
+  size_t _length = 0;
+};
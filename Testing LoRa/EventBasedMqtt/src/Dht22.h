@@ -0,0 +1,151 @@
+#pragma once
+
+// DHT22 (AM2302) frame decoding, last-good cache and error counters.
+//
+// The sensor answers a start pulse with low 80 us, high 80 us, then 40 bits,
+// each a ~50 us low followed by a high of 26-28 us (0) or ~70 us (1):
+// humidity x10 (16 bits), temperature x10 (15 bits, top bit is the sign)
+// and a checksum byte. decodeDht22() works on the captured line as
+// level/duration segments, so it does not care whether they came from the
+// RMT peripheral (Dht22Rmt.h) or a host test.
+//
+// DhtCache keeps the last good reading with the time it was taken, so a
+// failed read leaves the previous value in place; callers decide how old
+// is too old. Times are in whatever clock the caller records with.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DHT22_BITS 40
+#define DHT_PREAMBLE_MIN_US 50    // Response low and high, nominally 80 us each
+#define DHT_PREAMBLE_MAX_US 120
+#define DHT_BIT_LOW_MIN_US 30     // Nominally 50 us
+#define DHT_BIT_LOW_MAX_US 90
+#define DHT_BIT_HIGH_MAX_US 100   // Longest valid one
+#define DHT_BIT_THRESHOLD_US 48   // Highs longer than this are ones
+
+enum DhtStatus : uint8_t {
+  DHT_OK = 0,
+  DHT_PENDING,          // Read still in progress
+  DHT_BUSY,             // A read is in progress, or the last one was too recent
+  DHT_LATE_START,       // Start pulse held past its limit, read abandoned
+  DHT_NO_RESPONSE,      // No preamble: sensor missing, unpowered or timed out
+  DHT_TIMING,           // A bit outside the protocol's timing
+  DHT_TRUNCATED,        // Fewer than 40 bits
+  DHT_CHECKSUM,
+  DHT_RANGE,            // Decoded, but outside the sensor's range
+  DHT_STATUS_COUNT
+};
+
+inline const char* dhtStatusName(DhtStatus status) {
+  switch (status) {
+    case DHT_OK: return "ok";
+    case DHT_PENDING: return "pending";
+    case DHT_BUSY: return "busy";
+    case DHT_LATE_START: return "late start";
+    case DHT_NO_RESPONSE: return "no response";
+    case DHT_TIMING: return "timing";
+    case DHT_TRUNCATED: return "truncated";
+    case DHT_CHECKSUM: return "checksum";
+    case DHT_RANGE: return "range";
+    default: return "?";
+  }
+}
+
+struct DhtSegment {
+  uint8_t level;     // 0 low, 1 high
+  uint16_t micros;
+};
+
+struct DhtReading {
+  float temperature;  // °C
+  float humidity;     // %
+};
+
+inline DhtStatus decodeDht22(const DhtSegment* segments, size_t count, DhtReading& reading) {
+  // Skip the host's start pulse and release up to the response preamble
+  size_t i = 0;
+  while (i + 1 < count) {
+    if (segments[i].level == 0 && segments[i + 1].level == 1 &&
+        segments[i].micros >= DHT_PREAMBLE_MIN_US && segments[i].micros <= DHT_PREAMBLE_MAX_US &&
+        segments[i + 1].micros >= DHT_PREAMBLE_MIN_US && segments[i + 1].micros <= DHT_PREAMBLE_MAX_US) {
+      break;
+    }
+    i++;
+  }
+  if (i + 1 >= count) return DHT_NO_RESPONSE;
+  i += 2;
+
+  uint8_t data[DHT22_BITS / 8] = {};
+  for (size_t bit = 0; bit < DHT22_BITS; bit++, i += 2) {
+    if (i + 1 >= count) return DHT_TRUNCATED;
+    const DhtSegment& low = segments[i];
+    const DhtSegment& high = segments[i + 1];
+    if (low.level != 0 || high.level != 1 || low.micros < DHT_BIT_LOW_MIN_US ||
+        low.micros > DHT_BIT_LOW_MAX_US || high.micros > DHT_BIT_HIGH_MAX_US) {
+      return DHT_TIMING;
+    }
+    if (high.micros > DHT_BIT_THRESHOLD_US) data[bit / 8] |= (uint8_t)(0x80 >> (bit % 8));
+  }
+
+  if ((uint8_t)(data[0] + data[1] + data[2] + data[3]) != data[4]) return DHT_CHECKSUM;
+
+  int rawHumidity = data[0] << 8 | data[1];
+  int rawTemperature = (data[2] & 0x7F) << 8 | data[3];
+  if (data[2] & 0x80) rawTemperature = -rawTemperature;
+  if (rawHumidity > 1000 || rawTemperature < -400 || rawTemperature > 800) return DHT_RANGE;
+
+  reading.humidity = rawHumidity / 10.0f;
+  reading.temperature = rawTemperature / 10.0f;
+  return DHT_OK;
+}
+
+class DhtCache {
+public:
+  struct Stats {
+    unsigned long reads = 0;
+    unsigned long errors[DHT_STATUS_COUNT] = {};  // Indexed by DhtStatus
+    unsigned long consecutiveFailures = 0;
+    unsigned long maxConsecutiveFailures = 0;
+  };
+
+  void record(DhtStatus status, const DhtReading& reading, unsigned long now) {
+    _stats.reads++;
+    _lastStatus = status;
+    if (status != DHT_OK) {
+      _stats.errors[status]++;
+      if (++_stats.consecutiveFailures > _stats.maxConsecutiveFailures) {
+        _stats.maxConsecutiveFailures = _stats.consecutiveFailures;
+      }
+      return;
+    }
+    _stats.consecutiveFailures = 0;
+    _reading = reading;
+    _takenAt = now;
+    _valid = true;
+  }
+
+  // The last good reading; false if there never was one
+  bool latest(DhtReading& reading) const {
+    if (_valid) reading = _reading;
+    return _valid;
+  }
+
+  bool valid() const { return _valid; }
+  unsigned long takenAt() const { return _takenAt; }
+  DhtStatus lastStatus() const { return _lastStatus; }
+  const Stats& stats() const { return _stats; }
+
+  unsigned long failures() const {
+    unsigned long total = 0;
+    for (size_t i = 0; i < DHT_STATUS_COUNT; i++) total += _stats.errors[i];
+    return total;
+  }
+
+private:
+  DhtReading _reading = {};
+  unsigned long _takenAt = 0;
+  bool _valid = false;
+  DhtStatus _lastStatus = DHT_PENDING;
+  Stats _stats;
+};
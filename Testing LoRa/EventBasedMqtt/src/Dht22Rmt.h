@@ -0,0 +1,149 @@
+#pragma once
+
+// Non-blocking DHT22 reads on the ESP32 RMT peripheral.
+//
+// The blocking library read bit-banged the whole 5 ms frame with interrupts
+// off. Here a read is a small state machine driven from the scheduler:
+// start() pulls the line low through an open-drain GPIO and returns; the
+// first poll() at least DHT_START_LOW_US later arms RMT receive and releases
+// the line, and later polls pick the captured frame out of the RMT ring
+// buffer without waiting. The sensor accepts a start pulse of 0.8-20 ms,
+// so polling on the 10 ms scheduler tick is fine as long as no other task
+// holds the scheduler for long; a poll that comes after DHT_START_MAX_US
+// releases the line and gives up with DHT_LATE_START rather than capture
+// the answer to an out-of-spec pulse.
+//
+// Every finished read, good or bad, goes into a DhtCache, which keeps the
+// last good value (stamped with micros() at start) and the error counters.
+
+#include <driver/gpio.h>
+#include <driver/rmt.h>
+#include <freertos/ringbuf.h>
+#include "Dht22.h"
+
+#ifndef DHT_RMT_CHANNEL
+#define DHT_RMT_CHANNEL RMT_CHANNEL_0
+#endif
+#define DHT_START_LOW_US 1100        // Host start pulse, 1 ms minimum
+#define DHT_START_MAX_US 20000       // and 20 ms maximum
+#define DHT_READ_TIMEOUT_US 50000    // Release to frame, the frame itself takes ~5 ms
+#define DHT_MIN_INTERVAL_US 1900000  // DHT22 needs ~2 s between reads, less tick jitter
+#define DHT_RMT_IDLE_US 500          // Line high this long ends the capture
+#define DHT_RMT_FILTER_TICKS 100     // Ignore glitches under 1.25 us (APB ticks)
+#define DHT_RMT_BUFFER_SIZE 512      // Ring buffer bytes, one frame is ~43 items
+
+class Dht22Rmt {
+public:
+  enum State : uint8_t { IDLE, STARTING, READING };
+
+  Dht22Rmt(gpio_num_t pin, rmt_channel_t channel = DHT_RMT_CHANNEL) : _pin(pin), _channel(channel) {}
+
+  bool begin() {
+    rmt_config_t config = RMT_DEFAULT_CONFIG_RX(_pin, _channel);
+    config.clk_div = 80;  // 1 us ticks from the 80 MHz APB clock
+    config.rx_config.filter_en = true;
+    config.rx_config.filter_ticks_thresh = DHT_RMT_FILTER_TICKS;
+    config.rx_config.idle_threshold = DHT_RMT_IDLE_US;
+    if (rmt_config(&config) != ESP_OK) return false;
+    if (rmt_driver_install(_channel, DHT_RMT_BUFFER_SIZE, 0) != ESP_OK) return false;
+    if (rmt_get_ringbuf_handle(_channel, &_ringbuf) != ESP_OK) return false;
+
+    // Open drain keeps the input (and the RMT routing) live while driving
+    gpio_set_pull_mode(_pin, GPIO_PULLUP_ONLY);
+    gpio_set_direction(_pin, GPIO_MODE_INPUT_OUTPUT_OD);
+    gpio_set_level(_pin, 1);
+    _ready = true;
+    return true;
+  }
+
+  // Starts a read; false (and nothing recorded) while one is in progress
+  // or too soon after the last
+  bool start(unsigned long now) {
+    if (!_ready || _state != IDLE) return false;
+    if (_started && now - _startedAt < DHT_MIN_INTERVAL_US) return false;
+    gpio_set_level(_pin, 0);
+    _startedAt = now;
+    _started = true;
+    _state = STARTING;
+    return true;
+  }
+
+  // Advances the read; returns DHT_PENDING until it finishes, then the
+  // result, which is also recorded in the cache
+  DhtStatus poll(unsigned long now) {
+    switch (_state) {
+      case IDLE:
+        return DHT_BUSY;
+
+      case STARTING:
+        if (now - _startedAt < DHT_START_LOW_US) return DHT_PENDING;
+        if (now - _startedAt > DHT_START_MAX_US) {
+          gpio_set_level(_pin, 1);
+          return finish(DHT_LATE_START);
+        }
+        drain();
+        rmt_rx_start(_channel, true);
+        gpio_set_level(_pin, 1);
+        _releasedAt = now;
+        _state = READING;
+        return DHT_PENDING;
+
+      case READING: {
+        size_t size = 0;
+        rmt_item32_t* items = (rmt_item32_t*)xRingbufferReceive(_ringbuf, &size, 0);
+        if (!items) {
+          if (now - _releasedAt < DHT_READ_TIMEOUT_US) return DHT_PENDING;
+          return finish(DHT_NO_RESPONSE);
+        }
+        DhtStatus status = decode(items, size / sizeof(rmt_item32_t));
+        vRingbufferReturnItem(_ringbuf, items);
+        return finish(status);
+      }
+    }
+    return DHT_BUSY;
+  }
+
+  State state() const { return _state; }
+  const DhtCache& cache() const { return _cache; }
+
+private:
+  DhtStatus decode(const rmt_item32_t* items, size_t count) {
+    DhtSegment segments[2 * (DHT22_BITS + 4)];
+    size_t n = 0;
+    for (size_t i = 0; i < count && n + 2 <= sizeof(segments) / sizeof(segments[0]); i++) {
+      // A zero duration marks the end of the capture
+      if (items[i].duration0 == 0) break;
+      segments[n++] = {(uint8_t)items[i].level0, (uint16_t)items[i].duration0};
+      if (items[i].duration1 == 0) break;
+      segments[n++] = {(uint8_t)items[i].level1, (uint16_t)items[i].duration1};
+    }
+    return decodeDht22(segments, n, _reading);
+  }
+
+  DhtStatus finish(DhtStatus status) {
+    rmt_rx_stop(_channel);
+    _cache.record(status, _reading, _startedAt);
+    _state = IDLE;
+    return status;
+  }
+
+  // Drops anything left over from a read that timed out
+  void drain() {
+    size_t size = 0;
+    void* item;
+    while ((item = xRingbufferReceive(_ringbuf, &size, 0)) != nullptr) {
+      vRingbufferReturnItem(_ringbuf, item);
+    }
+  }
+
+  gpio_num_t _pin;
+  rmt_channel_t _channel;
+  RingbufHandle_t _ringbuf = nullptr;
+  bool _ready = false;
+  bool _started = false;
+  State _state = IDLE;
+  unsigned long _startedAt = 0;   // us
+  unsigned long _releasedAt = 0;  // us
+  DhtReading _reading = {};
+  DhtCache _cache;
+};
@@ -4,16 +4,34 @@
 #include <axp20x.h>
 #include <WiFi.h>
 #include <PubSubClient.h>
-#include <DHT.h>
-#include <Adafruit_Sensor.h>
+#include "BufferedPrint.h"
+#include "PayloadFormat.h"
+#include "Scheduler.h"
+#include "ChangeDetector.h"
+#include "SensorFilter.h"
+#include "Dht22Rmt.h"
+#include "Log.h"
 
 // Pin Definitions
-#define DHTPIN 25     // Pin where the DHT sensor is connected
-#define DHTTYPE DHT22 // DHT22 (AM2302) sensor type
+#define DHTPIN GPIO_NUM_25  // DHT22 (AM2302) data pin
 
 // Constants
 const int LAHAN_ID = 1;
-const float PROXIMITY_THRESHOLD = 0.8;
+
+// Logging, see Log.h. Tasks only queue records; logTask() formats and
+// prints them at low priority on core 0
+#define LOG_DRAIN_MS 20
+Logger<LOG_QUEUE_SIZE> logger(millis);
+
+// Change detection, see ChangeDetector.h
+enum { FIELD_TEMPERATURE, FIELD_HUMIDITY, FIELD_COUNT };
+const DeadbandConfig DEADBANDS[FIELD_COUNT] = {
+    // absolute, relative, rate (per s), hysteresis. A rate has to exceed one
+    // DHT22 step (0.1) per SAMPLE_INTERVAL, or every flicker fires it
+    {0.8, 0.0, 0.10, 0.25},  // Temperature (°C)
+    {2.0, 0.0, 0.10, 0.25},  // Humidity (%), DHT22 accuracy is ±2%
+};
+const unsigned long MAX_SILENT_INTERVAL = 900000;  // Heartbeat after 15 minutes
 
 // WiFi settings
 const char* SSID = "MAKER 2024";
@@ -26,10 +44,48 @@ const char* MQTT_PASSWORD = "public";
 const int MQTT_PORT = 1883;
 const char* MQTT_TOPIC = "EventBasedMqtt";
 
+// Payload format per topic; non-JSON formats get a content-type suffix
+// (see PayloadFormat.h). Override with -D MQTT_PAYLOAD_FORMAT=PAYLOAD_MSGPACK
+#ifndef MQTT_PAYLOAD_FORMAT
+#define MQTT_PAYLOAD_FORMAT PAYLOAD_JSON
+#endif
+PublishTarget publishTargets[] = {
+    {MQTT_TOPIC, MQTT_PAYLOAD_FORMAT},
+};
+const size_t PUBLISH_TARGET_COUNT = sizeof(publishTargets) / sizeof(publishTargets[0]);
+char publishTopics[PUBLISH_TARGET_COUNT][64];
+
+// Task periods (ms)
+const unsigned long SAMPLE_INTERVAL = 2000;        // DHT22 minimum sampling period
+const unsigned long DHT_POLL_INTERVAL = 10;        // Read in progress, see Dht22Rmt.h
+const unsigned long MQTT_SERVICE_INTERVAL = 50;
+const unsigned long MQTT_BACKOFF_MIN = 1000;        // Reconnect backoff, doubled per failure
+const unsigned long MQTT_BACKOFF_MAX = 60000;
+const int32_t MQTT_CONNECT_TIMEOUT = 1000;          // TCP connect to the broker
+const uint16_t MQTT_SOCKET_TIMEOUT = 1;             // s, waiting for the broker's reply
+const unsigned long WIFI_CHECK_INTERVAL = 10000;
+const unsigned long STATS_INTERVAL = 300000;
+
+// Sample filtering, see SensorFilter.h. The DHT22 reads every
+// SAMPLE_INTERVAL; a median of 3 drops one-off glitches and the average
+// settles its ±0.1 jitter, while a jump past the snap goes straight through
+const FilterConfig FILTERS[FIELD_COUNT] = {
+    // interval (ms), scale, median window, smoothing, snap
+    {SAMPLE_INTERVAL, 100, 3, 2, 0.4},  // Temperature (°C)
+    {SAMPLE_INTERVAL, 100, 3, 2, 1.0},  // Humidity (%)
+};
+
 // Global variables
-DHT dht(DHTPIN, DHTTYPE);
-bool hasValidPreviousData = false;
-float previousTemp = 0.0;
+Scheduler scheduler(millis, micros);
+int detectTaskId = -1;
+int dhtTaskId = -1;
+unsigned long nextMqttAttempt = 0;
+unsigned long mqttBackoff = MQTT_BACKOFF_MIN;
+IPAddress brokerIp;
+bool brokerResolved = false;  // Cleared whenever WiFi drops
+Dht22Rmt dht(DHTPIN);
+ChangeDetector<FIELD_COUNT> changeDetector(DEADBANDS, MAX_SILENT_INTERVAL);
+SensorPipeline<FIELD_COUNT> sensorFilters(FILTERS);
 float temp;
 float humidity;
 
@@ -45,51 +101,152 @@ PubSubClient client(espClient);
 void connectToWiFi();
 void parseAndSendData();
 void initPowerMonitor();
+bool resolveBroker();
 void reconnectMQTT();
 void callback(char* topic, byte* payload, unsigned int length);
+bool publishAll(const JsonDocument& doc);
+bool publishDocument(const char* publishTopic, PayloadFormat format, const JsonDocument& doc);
 void getBatteryStats(float &vbat, float &batCurrent, float &batPower, int &batChargeCurrent, int &batLevel);
 float randomFloat(float min, float max);
-bool significantChange(float currentValue);
 void logSensorData(float vbat, float batCurrent, float batPower, int batChargeCurrent, int batLevel);
+void sampleTask();
+void dhtTask();
+void detectTask();
+void mqttTask();
+void wifiTask();
+void printTaskStats();
+void logTask(void* parameter);
 
 void setup() {
     Serial.begin(115200);
-    dht.begin();
+    xTaskCreatePinnedToCore(logTask, "log", 4096, nullptr, 1, nullptr, 0);
+    if (!dht.begin()) {
+        LOG_ERROR("DHT22 RMT setup failed");
+    }
     initPowerMonitor();
     connectToWiFi();
     
     // Setup MQTT
-    client.setServer(MQTT_BROKER, MQTT_PORT);
+    // The server address is set once the broker is resolved, see
+    // reconnectMQTT()
     client.setCallback(callback);
+    client.setSocketTimeout(MQTT_SOCKET_TIMEOUT);
+    for (size_t i = 0; i < PUBLISH_TARGET_COUNT; i++) {
+        buildTopic(publishTopics[i], sizeof(publishTopics[i]), publishTargets[i].topic, publishTargets[i].format);
+        LOG_INFO("Publishing %s to %s", payloadFormatName(publishTargets[i].format), publishTopics[i]);
+    }
+
+    // Sampling starts a DHT22 read, which triggers change detection as soon
+    // as it is in
+    detectTaskId = scheduler.event("detect", detectTask);
+    dhtTaskId = scheduler.event("dht", dhtTask);
+    scheduler.every("sample", SAMPLE_INTERVAL, sampleTask);
+    scheduler.every("mqtt", MQTT_SERVICE_INTERVAL, mqttTask);
+    scheduler.every("wifi", WIFI_CHECK_INTERVAL, wifiTask, WIFI_CHECK_INTERVAL);
+    scheduler.every("stats", STATS_INTERVAL, printTaskStats, STATS_INTERVAL);
     
-    Serial.println("Event-based MQTT Transmitter Started!");
+    LOG_INFO("Event-based MQTT Transmitter Started!");
 }
 
 void loop() {
-    if (!client.connected()) {
-        reconnectMQTT();
+    scheduler.run();
+}
+
+void sampleTask() {
+    if (dht.start(micros())) {
+        scheduler.trigger(dhtTaskId, DHT_POLL_INTERVAL);
     }
-    client.loop();
-    
-    temp = dht.readTemperature();
-    humidity = dht.readHumidity();
+}
 
-    if (isnan(temp) || isnan(humidity)) {
-        Serial.println("Failed to read from DHT sensor!");
+void dhtTask() {
+    DhtStatus status = dht.poll(micros());
+    if (status == DHT_PENDING) {
+        scheduler.trigger(dhtTaskId, DHT_POLL_INTERVAL);
+        return;
+    }
+    if (status != DHT_OK) {
+        // The last good reading stays in place
+        LOG_ERROR("Failed to read from DHT sensor: %s", dhtStatusName(status));
         return;
     }
 
+    // Change detection sees the filtered values
+    DhtReading reading;
+    dht.cache().latest(reading);
+    unsigned long now = millis();
+    sensorFilters.add(FIELD_TEMPERATURE, reading.temperature, now);
+    sensorFilters.add(FIELD_HUMIDITY, reading.humidity, now);
+    temp = sensorFilters.value(FIELD_TEMPERATURE);
+    humidity = sensorFilters.value(FIELD_HUMIDITY);
+    scheduler.trigger(detectTaskId);
+}
+
+void detectTask() {
     parseAndSendData();
-    delay(10000);
+}
+
+void mqttTask() {
+    if (WiFi.status() != WL_CONNECTED) {
+        // The next association may come with a different DNS server
+        brokerResolved = false;
+        return;
+    }
+    if (client.connected()) {
+        client.loop();
+    } else if ((long)(millis() - nextMqttAttempt) >= 0) {
+        reconnectMQTT();
+    }
+}
+
+void wifiTask() {
+    if (WiFi.status() != WL_CONNECTED) {
+        LOG_WARN("WiFi connection lost. Reconnecting...");
+        WiFi.reconnect();
+    }
+}
+
+void printTaskStats() {
+    LOG_INFO("Task Statistics:");
+    for (size_t id = 0; id < scheduler.capacity(); id++) {
+        const SchedulerTask &task = scheduler.task(id);
+        if (!task.active) continue;
+        LOG_INFO("%-8s runs: %lu, avg: %lu us, max: %lu us, max late: %lu ms",
+                 task.name, task.runs, task.runs ? task.totalMicros / task.runs : 0,
+                 task.maxMicros, task.maxLateness);
+    }
+
+    const ChangeDetector<FIELD_COUNT>::Stats &stats = changeDetector.stats();
+    LOG_INFO("Change detection: %lu samples, %lu sent, %.1f%% suppressed "
+             "(deadband %lu, rate %lu, heartbeat %lu)",
+             stats.samples, stats.sends, changeDetector.suppressionRatio() * 100,
+             stats.deadbandTriggers, stats.rateTriggers, stats.heartbeats);
+
+    SensorFilter::Stats filterStats = sensorFilters.stats();
+    LOG_INFO("Filters: %lu samples, %lu rejected, %lu snaps",
+             filterStats.samples, filterStats.rejected, filterStats.snaps);
+
+    const DhtCache &dhtCache = dht.cache();
+    const DhtCache::Stats &dhtStats = dhtCache.stats();
+    LOG_INFO("DHT22: %lu reads, %lu failed, max %lu in a row",
+             dhtStats.reads, dhtCache.failures(), dhtStats.maxConsecutiveFailures);
+    LOG_INFO("DHT22 failures: no response %lu, late start %lu, timing %lu, truncated %lu, "
+             "checksum %lu, range %lu",
+             dhtStats.errors[DHT_NO_RESPONSE], dhtStats.errors[DHT_LATE_START],
+             dhtStats.errors[DHT_TIMING], dhtStats.errors[DHT_TRUNCATED],
+             dhtStats.errors[DHT_CHECKSUM], dhtStats.errors[DHT_RANGE]);
+}
+
+void logTask(void* parameter) {
+    for (;;) {
+        logger.drain([](const char* line, size_t len) { Serial.write((const uint8_t*)line, len); });
+        vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_MS));
+    }
 }
 
 void connectToWiFi() {
+    // Connection completes in the background; mqttTask waits for it
+    LOG_INFO("Connecting to WiFi...");
     WiFi.begin(SSID, PASSWORD);
-    while (WiFi.status() != WL_CONNECTED) {
-        delay(500);
-        Serial.println("Connecting to WiFi...");
-    }
-    Serial.println("Connected to WiFi");
 }
 
 void parseAndSendData() {
@@ -108,7 +265,11 @@ void parseAndSendData() {
     // Log sensor data
     logSensorData(vbat, batCurrent, batPower, batChargeCurrent, batLevel);
 
-    if (!hasValidPreviousData || significantChange(temp)) {
+    float values[FIELD_COUNT] = {temp, humidity};
+    unsigned long now = millis();
+    uint8_t reasons = changeDetector.evaluate(values, now);
+
+    if (reasons != CHANGE_NONE) {
         // Create JSON document
         StaticJsonDocument<512> doc;
         doc["lahanID"] = LAHAN_ID;
@@ -125,57 +286,110 @@ void parseAndSendData() {
         doc["batteryChargeCurrent"] = batChargeCurrent;
         doc["batteryLevel"] = batLevel;
 
-        // Serialize JSON to string
-        String jsonString;
-        serializeJson(doc, jsonString);
-
         // Publish to MQTT
-        if (client.publish(MQTT_TOPIC, jsonString.c_str())) {
-            Serial.println("Data published successfully");
-            previousTemp = temp;
-            hasValidPreviousData = true;
+        if (publishAll(doc)) {
+            LOG_INFO("Data published successfully (%s)", changeReasonName(reasons));
+            changeDetector.commit(values, now);
         } else {
-            Serial.println("Failed to publish data");
+            LOG_ERROR("Failed to publish data");
         }
     } else {
-        Serial.printf("No significant change (diff: %.2f). Previous: %.2f, Current: %.2f\n", 
-                     abs(temp - previousTemp), previousTemp, temp);
+        LOG_DEBUG("No significant change. Previous: %.2f°C %.2f%%, Current: %.2f°C %.2f%%",
+                  changeDetector.reference(FIELD_TEMPERATURE), changeDetector.reference(FIELD_HUMIDITY),
+                  temp, humidity);
     }
 }
 
-void reconnectMQTT() {
-    while (!client.connected()) {
-        String clientId = "esp32-client-";
-        clientId += String(WiFi.macAddress());
-        
-        Serial.printf("Attempting MQTT connection as %s...\n", clientId.c_str());
-        
-        if (client.connect(clientId.c_str(), MQTT_USERNAME, MQTT_PASSWORD)) {
-            Serial.println("Connected to MQTT broker");
-            client.subscribe(MQTT_TOPIC);
+bool publishAll(const JsonDocument& doc) {
+    bool ok = true;
+    for (size_t i = 0; i < PUBLISH_TARGET_COUNT; i++) {
+        ok = publishDocument(publishTopics[i], publishTargets[i].format, doc) && ok;
+    }
+    return ok;
+}
+
+bool publishDocument(const char* publishTopic, PayloadFormat format, const JsonDocument& doc) {
+    if (format == PAYLOAD_BINARY) {
+        uint8_t frame[SENSOR_FRAME_SIZE];
+        size_t length = encodePayload(doc, format, frame, sizeof(frame));
+        return length > 0 && client.publish(publishTopic, frame, length);
+    }
+
+    // Stream the serialization straight into the MQTT packet: the length is
+    // known up front, so no intermediate String or PubSubClient buffer copy
+    // is needed and payloads may exceed the client's buffer size
+    size_t length = measurePayload(doc, format);
+    if (!client.beginPublish(publishTopic, length, false)) {
+        return false;
+    }
+    {
+        BufferedPrint<64> out(client);
+        if (format == PAYLOAD_MSGPACK) {
+            serializeMsgPack(doc, out);
         } else {
-            Serial.print("Failed to connect to MQTT broker, rc=");
-            Serial.print(client.state());
-            Serial.println(" Retrying in 2 seconds");
-            delay(2000);
+            serializeJson(doc, out);
         }
     }
+    return client.endPublish() == 1;
 }
 
-void callback(char* topic, byte* payload, unsigned int length) {
-    Serial.print("Message received on topic: ");
-    Serial.println(topic);
-    Serial.print("Message: ");
-    for (int i = 0; i < length; i++) {
-        Serial.print((char)payload[i]);
+// A literal address needs no lookup; a name is looked up once per WiFi
+// association, since DNS can hold the scheduler for seconds
+bool resolveBroker() {
+    if (brokerResolved) return true;
+    if (!brokerIp.fromString(MQTT_BROKER) && WiFi.hostByName(MQTT_BROKER, brokerIp) != 1) {
+        LOG_WARN("Cannot resolve MQTT broker %s", MQTT_BROKER);
+        return false;
+    }
+    LOG_INFO("MQTT broker %s is %u.%u.%u.%u", MQTT_BROKER, brokerIp[0], brokerIp[1], brokerIp[2], brokerIp[3]);
+    client.setServer(brokerIp, MQTT_PORT);
+    brokerResolved = true;
+    return true;
+}
+
+// Runs inside the scheduler, so every step is bounded: the cached address
+// skips DNS, the TCP connect is capped at MQTT_CONNECT_TIMEOUT (PubSubClient
+// has no timeout of its own and, finding the socket open, goes straight to
+// CONNECT), and the reply at MQTT_SOCKET_TIMEOUT. Failures back off
+// exponentially.
+void reconnectMQTT() {
+    static char clientId[32];  // Static: the log record keeps a pointer to it
+    snprintf(clientId, sizeof(clientId), "esp32-client-%s", WiFi.macAddress().c_str());
+    
+    LOG_INFO("Attempting MQTT connection as %s...", clientId);
+    
+    bool connected = resolveBroker();
+    if (connected) {
+        espClient.stop();
+        connected = espClient.connect(brokerIp, MQTT_PORT, MQTT_CONNECT_TIMEOUT) == 1 &&
+                    client.connect(clientId, MQTT_USERNAME, MQTT_PASSWORD);
     }
-    Serial.println();
+    if (connected) {
+        LOG_INFO("Connected to MQTT broker");
+        client.subscribe(MQTT_TOPIC);
+        mqttBackoff = MQTT_BACKOFF_MIN;
+        return;
+    }
+
+    // Full jitter in [backoff/2, backoff] so nodes that lost the same
+    // broker do not retry in lock-step
+    unsigned long wait = mqttBackoff / 2 + random(mqttBackoff / 2 + 1);
+    LOG_WARN("Failed to connect to MQTT broker, rc=%d. Retrying in %lu ms", client.state(), wait);
+    nextMqttAttempt = millis() + wait;
+    mqttBackoff = mqttBackoff * 2 > MQTT_BACKOFF_MAX ? MQTT_BACKOFF_MAX : mqttBackoff * 2;
+}
+
+void callback(char* topic, byte* payload, unsigned int length) {
+    // topic and payload live in the client's buffer, which the next message
+    // overwrites, so only the size is logged (MQTT_TOPIC is the only
+    // subscription)
+    LOG_INFO("Message received on topic %s (%u bytes)", MQTT_TOPIC, length);
 }
 
 void initPowerMonitor() {
     Wire.begin(21, 22);
     if (!axp.begin(Wire, AXP192_SLAVE_ADDRESS)) {
-        Serial.println("AXP PASS!");
+        LOG_INFO("AXP PASS!");
         isPowerMonitorFound = true;
 
         axp.setPowerOutPut(AXP192_LDO2, AXP202_ON);
@@ -185,7 +399,7 @@ void initPowerMonitor() {
         axp.setPowerOutPut(AXP192_DCDC1, AXP202_ON);
         axp.setChgLEDMode(AXP20X_LED_LOW_LEVEL);
     } else {
-        Serial.println("AXP192 Power monitor not found!");
+        LOG_WARN("AXP192 Power monitor not found!");
         isPowerMonitorFound = false;
     }
 }
@@ -205,18 +419,13 @@ void getBatteryStats(float &vbat, float &batCurrent, float &batPower, int &batCh
 }
 
 void logSensorData(float vbat, float batCurrent, float batPower, int batChargeCurrent, int batLevel) {
-    Serial.printf("Temperature: %.2f°C, Humidity: %.2f%%\n", temp, humidity);
+    LOG_DEBUG("Temperature: %.2f°C, Humidity: %.2f%%", temp, humidity);
     if (isPowerMonitorFound) {
-        Serial.println("Battery Status:");
-        Serial.printf("Voltage: %.2fV\nCurrent: %.2fmA\nPower: %.2fmW\nCharge Current: %dmA\nBattery Level: %d%%\n",
-                     vbat, batCurrent, batPower, batChargeCurrent, batLevel);
+        LOG_DEBUG("Battery: %.2fV, %.2fmA, %.2fmW, charge %dmA, level %d%%",
+                  vbat, batCurrent, batPower, batChargeCurrent, batLevel);
     }
 }
 
 float randomFloat(float min, float max) {
     return (float)random(min * 100, max * 100) / 100;
 }
-
-bool significantChange(float currentValue) {
-    return abs(currentValue - previousTemp) > PROXIMITY_THRESHOLD;
-}
\ No newline at end of file
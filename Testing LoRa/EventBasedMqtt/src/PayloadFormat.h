@@ -0,0 +1,87 @@
+#pragma once
+
+// Payload encodings for the MQTT transmitters.
+//
+// The format is advertised through a suffix on the topic so a subscriber
+// can pick the decoder without inspecting the payload. Plain JSON keeps the
+// bare topic, which is what the existing loggers subscribe to.
+
+#include <ArduinoJson.h>
+#include <string.h>
+#include "SensorFrame.h"
+
+enum PayloadFormat {
+  PAYLOAD_JSON,
+  PAYLOAD_MSGPACK,
+  PAYLOAD_BINARY
+};
+
+struct PublishTarget {
+  const char* topic;
+  PayloadFormat format;
+};
+
+inline const char* payloadFormatSuffix(PayloadFormat format) {
+  switch (format) {
+    case PAYLOAD_MSGPACK: return "/msgpack";
+    case PAYLOAD_BINARY: return "/bin";
+    default: return "";
+  }
+}
+
+inline const char* payloadFormatName(PayloadFormat format) {
+  switch (format) {
+    case PAYLOAD_MSGPACK: return "msgpack";
+    case PAYLOAD_BINARY: return "binary";
+    default: return "json";
+  }
+}
+
+// Writes "<base><suffix>" into out. Returns false if it does not fit.
+inline bool buildTopic(char* out, size_t capacity, const char* base, PayloadFormat format) {
+  const char* suffix = payloadFormatSuffix(format);
+  size_t baseLen = strlen(base);
+  size_t suffixLen = strlen(suffix);
+  if (baseLen + suffixLen + 1 > capacity) return false;
+  memcpy(out, base, baseLen);
+  memcpy(out + baseLen, suffix, suffixLen + 1);
+  return true;
+}
+
+// Maps the flat MQTT document (see sendSensorData()) onto the fixed binary
+// layout. batteryPower has no slot in the frame and is dropped.
+inline SensorReading readingFromMqttDocument(const JsonDocument& doc) {
+  SensorReading reading;
+  reading.lahanID = doc["lahanID"].as<uint16_t>();
+  reading.humidity = doc["humidity"].as<float>();
+  reading.temperature = doc["temperature"].as<float>();
+  reading.ec = doc["ec"].as<float>();
+  reading.ph = doc["ph"].as<float>();
+  reading.nitrogen = doc["nitrogen"].as<float>();
+  reading.phosphorus = doc["phosphorus"].as<float>();
+  reading.potassium = doc["potassium"].as<float>();
+  reading.batteryVoltage = doc["batteryVoltage"].as<float>() * 1000.0f;
+  reading.batteryPercentage = doc["batteryLevel"].as<float>();
+  reading.chargeCurrent = doc["batteryChargeCurrent"].as<float>();
+  reading.dischargeCurrent = doc["batteryCurrent"].as<float>();
+  return reading;
+}
+
+inline size_t measurePayload(const JsonDocument& doc, PayloadFormat format) {
+  switch (format) {
+    case PAYLOAD_MSGPACK: return measureMsgPack(doc);
+    case PAYLOAD_BINARY: return SENSOR_FRAME_SIZE;
+    default: return measureJson(doc);
+  }
+}
+
+// Encodes doc into out. Returns the payload length, or 0 if it does not fit.
+inline size_t encodePayload(const JsonDocument& doc, PayloadFormat format, uint8_t* out, size_t capacity) {
+  size_t needed = measurePayload(doc, format);
+  if (needed > capacity) return 0;
+  switch (format) {
+    case PAYLOAD_MSGPACK: return serializeMsgPack(doc, out, capacity);
+    case PAYLOAD_BINARY: return encodeSensorFrame(readingFromMqttDocument(doc), out, capacity);
+    default: return serializeJson(doc, out, capacity);
+  }
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+// Cooperative scheduler for periodic and one-shot tasks, built on a hashed
+// timer wheel: each task sits in the slot of the tick it is due on, with a
+// round counter for delays longer than one revolution, so advancing a tick
+// only touches the tasks in that slot.
+//
+// Besides periodic (every) and throwaway one-shot (after) tasks, an event
+// task can be registered once and armed on demand with trigger(); it keeps its
+// statistics across runs, which suits event-driven work.
+//
+// run() must be called from loop(). Tasks run to completion and should not
+// block; a task that is late by more than its period runs once and is
+// rescheduled from the current tick instead of running back-to-back.
+//
+// Clocks are passed in (millis/micros on the board) so the scheduler has no
+// Arduino dependency.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SCHEDULER_MAX_TASKS 8
+#define SCHEDULER_WHEEL_SLOTS 32
+#define SCHEDULER_TICK_MS 10
+
+struct SchedulerTask {
+  const char* name;
+  void (*fn)();
+  unsigned long period;  // ms, 0 for one-shot
+  unsigned long dueTick;
+  uint16_t rounds;
+  int8_t next;           // next task in the same wheel slot, -1 for none
+  bool active;           // registered
+  bool scheduled;        // in the wheel
+  bool keep;             // one-shot that stays registered after it runs
+
+  // Run-time statistics
+  unsigned long runs;
+  unsigned long totalMicros;
+  unsigned long maxMicros;
+  unsigned long maxLateness;  // ms between due time and start
+};
+
+class Scheduler {
+public:
+  typedef void (*TaskFn)();
+  typedef unsigned long (*ClockFn)();
+
+  Scheduler(ClockFn millisFn, ClockFn microsFn) : _millis(millisFn), _micros(microsFn) {
+    for (size_t i = 0; i < SCHEDULER_WHEEL_SLOTS; i++) _slots[i] = -1;
+    for (size_t i = 0; i < SCHEDULER_MAX_TASKS; i++) _tasks[i].active = false;
+  }
+
+  // Returns the task id, or -1 if the task table is full.
+  int every(const char* name, unsigned long period, TaskFn fn, unsigned long delay = 0) {
+    int id = add(name, period, fn, false);
+    if (id >= 0) insert(id, delay);
+    return id;
+  }
+
+  int after(const char* name, unsigned long delay, TaskFn fn) {
+    int id = add(name, 0, fn, false);
+    if (id >= 0) insert(id, delay);
+    return id;
+  }
+
+  // Registers a one-shot task without scheduling it; see trigger().
+  int event(const char* name, TaskFn fn) {
+    return add(name, 0, fn, true);
+  }
+
+  // Arms a registered task. Does nothing if it is already scheduled.
+  void trigger(int id, unsigned long delay = 0) {
+    if (id < 0 || id >= SCHEDULER_MAX_TASKS || !_tasks[id].active || _tasks[id].scheduled) return;
+    insert(id, delay);
+  }
+
+  void cancel(int id) {
+    if (id < 0 || id >= SCHEDULER_MAX_TASKS || !_tasks[id].active) return;
+    if (_tasks[id].scheduled) unlink(id);
+    _tasks[id].scheduled = false;
+    _tasks[id].active = false;
+  }
+
+  void run() {
+    if (!_started) {
+      _nextTickAt = _millis();
+      _started = true;
+    }
+
+    // Collect everything that expired since the last call, then run each
+    // task once so a late loop() does not replay missed periods
+    int8_t ready[SCHEDULER_MAX_TASKS];
+    size_t readyCount = 0;
+    unsigned long now = _millis();
+    while ((long)(now - _nextTickAt) >= 0) {
+      _tick++;
+      _nextTickAt += SCHEDULER_TICK_MS;
+      expireSlot(_tick % SCHEDULER_WHEEL_SLOTS, ready, readyCount);
+    }
+
+    for (size_t i = 0; i < readyCount; i++) {
+      int id = ready[i];
+      SchedulerTask& task = _tasks[id];
+      if (!task.active || task.scheduled) continue;
+
+      unsigned long lateness = (_tick - task.dueTick) * SCHEDULER_TICK_MS;
+      if (lateness > task.maxLateness) task.maxLateness = lateness;
+
+      if (task.period > 0) {
+        insert(id, task.period);
+      } else if (!task.keep) {
+        task.active = false;
+      }
+
+      unsigned long start = _micros();
+      task.fn();
+      unsigned long elapsed = _micros() - start;
+      task.runs++;
+      task.totalMicros += elapsed;
+      if (elapsed > task.maxMicros) task.maxMicros = elapsed;
+    }
+  }
+
+  size_t capacity() const { return SCHEDULER_MAX_TASKS; }
+  const SchedulerTask& task(int id) const { return _tasks[id]; }
+
+private:
+  int add(const char* name, unsigned long period, TaskFn fn, bool keep) {
+    for (int id = 0; id < SCHEDULER_MAX_TASKS; id++) {
+      SchedulerTask& task = _tasks[id];
+      if (task.active) continue;
+      task.name = name;
+      task.fn = fn;
+      task.period = period;
+      task.active = true;
+      task.scheduled = false;
+      task.keep = keep;
+      task.runs = task.totalMicros = task.maxMicros = task.maxLateness = 0;
+      return id;
+    }
+    return -1;
+  }
+
+  void insert(int id, unsigned long delay) {
+    unsigned long ticks = (delay + SCHEDULER_TICK_MS - 1) / SCHEDULER_TICK_MS;
+    if (ticks == 0) ticks = 1;
+
+    SchedulerTask& task = _tasks[id];
+    task.scheduled = true;
+    task.dueTick = _tick + ticks;
+    task.rounds = (uint16_t)((ticks - 1) / SCHEDULER_WHEEL_SLOTS);
+    size_t slot = task.dueTick % SCHEDULER_WHEEL_SLOTS;
+    task.next = _slots[slot];
+    _slots[slot] = (int8_t)id;
+  }
+
+  void unlink(int id) {
+    size_t slot = _tasks[id].dueTick % SCHEDULER_WHEEL_SLOTS;
+    int8_t* link = &_slots[slot];
+    while (*link != -1) {
+      if (*link == id) {
+        *link = _tasks[id].next;
+        return;
+      }
+      link = &_tasks[*link].next;
+    }
+  }
+
+  void expireSlot(size_t slot, int8_t* ready, size_t& readyCount) {
+    int8_t* link = &_slots[slot];
+    while (*link != -1) {
+      SchedulerTask& task = _tasks[*link];
+      if (task.rounds > 0) {
+        task.rounds--;
+        link = &task.next;
+      } else {
+        task.scheduled = false;
+        ready[readyCount++] = *link;
+        *link = task.next;
+      }
+    }
+  }
+
+  ClockFn _millis;
+  ClockFn _micros;
+  SchedulerTask _tasks[SCHEDULER_MAX_TASKS];
+  int8_t _slots[SCHEDULER_WHEEL_SLOTS];
+  unsigned long _tick = 0;
+  unsigned long _nextTickAt = 0;
+  bool _started = false;
+};
@@ -0,0 +1,156 @@
+#pragma once
+
+// Adaptive data rate, after the LoRaWAN network-server algorithm.
+//
+// For each node the gateway keeps the SNR of its last ADR_HISTORY uplinks.
+// Once the history is full, the margin is
+//   max SNR - SNR required by the node's SF - installation margin
+// Every ADR_STEP_DB of margin first lowers the SF, then lowers TX power.
+// A negative margin raises TX power. After a change the history restarts,
+// since earlier SNR values were measured with the old settings.
+//
+// A command is repeated every refreshUplinks uplinks even when it has not
+// changed. A node that stops hearing the gateway can then fall back to
+// full power on its own.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include "LoRaProtocol.h"
+
+#define ADR_MAX_NODES 32
+#define ADR_HISTORY 8
+#define ADR_STEP_DB 3
+
+struct AdrConfig {
+  uint8_t minSpreadingFactor;
+  uint8_t maxSpreadingFactor;
+  int8_t minTxPower;      // dBm
+  int8_t maxTxPower;      // dBm
+  int8_t txPowerStep;     // dB
+  float installationMargin;  // dB
+  uint8_t refreshUplinks;
+};
+
+// Demodulation floor of the SX1276 for SF6..SF12
+inline float adrRequiredSnr(uint8_t spreadingFactor) {
+  return -5.0f - 2.5f * (spreadingFactor - 6);
+}
+
+class AdrController {
+public:
+  struct Node {
+    uint16_t lahanID;
+    bool used;
+    uint8_t count;         // SNR samples since the last change
+    uint8_t next;
+    float snr[ADR_HISTORY];
+    int16_t lastRssi;
+    float lastSnr;
+    uint32_t uplinks;
+    uint8_t sinceDownlink;
+    AdrCommand current;    // last command sent, or the node's defaults
+  };
+
+  AdrController(const AdrConfig& config, uint8_t defaultSpreadingFactor)
+      : _config(config), _defaultSpreadingFactor(defaultSpreadingFactor) {
+    for (size_t i = 0; i < ADR_MAX_NODES; i++) _nodes[i].used = false;
+  }
+
+  // Records an uplink. Returns true if a downlink with command should be
+  // sent to the node now.
+  bool onUplink(uint16_t lahanID, int rssi, float snr, AdrCommand& command) {
+    Node* node = find(lahanID);
+    if (node == nullptr) return false;
+
+    node->uplinks++;
+    node->lastRssi = (int16_t)rssi;
+    node->lastSnr = snr;
+    node->snr[node->next] = snr;
+    node->next = (node->next + 1) % ADR_HISTORY;
+    if (node->count < ADR_HISTORY) node->count++;
+    node->sinceDownlink++;
+
+    command = node->current;
+    if (node->count == ADR_HISTORY) {
+      command = recommend(*node);
+    }
+
+    bool changed = command.spreadingFactor != node->current.spreadingFactor ||
+                   command.txPower != node->current.txPower;
+    if (!changed && node->sinceDownlink < _config.refreshUplinks) return false;
+
+    if (changed) {
+      node->count = 0;
+      node->next = 0;
+      _changes++;
+    }
+    node->current = command;
+    node->sinceDownlink = 0;
+    return true;
+  }
+
+  size_t nodeCount() const {
+    size_t n = 0;
+    for (size_t i = 0; i < ADR_MAX_NODES; i++) n += _nodes[i].used;
+    return n;
+  }
+
+  const Node& node(size_t index) const { return _nodes[index]; }
+  unsigned long changes() const { return _changes; }
+
+private:
+  AdrCommand recommend(const Node& node) const {
+    float maxSnr = node.snr[0];
+    for (size_t i = 1; i < ADR_HISTORY; i++) {
+      if (node.snr[i] > maxSnr) maxSnr = node.snr[i];
+    }
+
+    AdrCommand command = node.current;
+    float margin = maxSnr - adrRequiredSnr(command.spreadingFactor) - _config.installationMargin;
+    int steps = (int)floorf(margin / ADR_STEP_DB);
+
+    while (steps > 0 && command.spreadingFactor > _config.minSpreadingFactor) {
+      command.spreadingFactor--;
+      steps--;
+    }
+    while (steps > 0 && command.txPower - _config.txPowerStep >= _config.minTxPower) {
+      command.txPower -= _config.txPowerStep;
+      steps--;
+    }
+    while (steps < 0 && command.txPower < _config.maxTxPower) {
+      command.txPower += _config.txPowerStep;
+      if (command.txPower > _config.maxTxPower) command.txPower = _config.maxTxPower;
+      steps++;
+    }
+    while (steps < 0 && command.spreadingFactor < _config.maxSpreadingFactor) {
+      command.spreadingFactor++;
+      steps++;
+    }
+    return command;
+  }
+
+  Node* find(uint16_t lahanID) {
+    Node* freeSlot = nullptr;
+    for (size_t i = 0; i < ADR_MAX_NODES; i++) {
+      if (_nodes[i].used && _nodes[i].lahanID == lahanID) return &_nodes[i];
+      if (!_nodes[i].used && freeSlot == nullptr) freeSlot = &_nodes[i];
+    }
+    if (freeSlot == nullptr) return nullptr;
+
+    Node& node = *freeSlot;
+    node.used = true;
+    node.lahanID = lahanID;
+    node.count = node.next = 0;
+    node.uplinks = 0;
+    node.sinceDownlink = 0;
+    node.current.spreadingFactor = _defaultSpreadingFactor;
+    node.current.txPower = _config.maxTxPower;
+    return &node;
+  }
+
+  AdrConfig _config;
+  uint8_t _defaultSpreadingFactor;
+  Node _nodes[ADR_MAX_NODES];
+  unsigned long _changes = 0;
+};
@@ -1,10 +1,19 @@
 #include <Arduino.h>
+#include <esp_timer.h>
 #include <WiFi.h>
 #include <LoRa.h>
 #include <HTTPClient.h>
 #include <ArduinoJson.h>
 #include <Wire.h>
 #include <axp20x.h>
+#include "SensorFrame.h"
+#include "LoRaProtocol.h"
+#include "AdrController.h"
+#include "NodeTable.h"
+#include "ReedSolomon.h"
+#include "JsonCompressor.h"
+#include "StageTrace.h"
+#include "GpsTime.h"
 
 AXP20X_Class axp;
 
@@ -14,16 +23,161 @@ const char* password = "Makerdotindo24";
 
 // Google Sheet configuration
 String GOOGLE_SCRIPT_ID = "AKfycbx8IIsDeHu9XjGmfTL1yWaWqkSl28-4nY11GByRAMe-zrF0nje-RX9wd2QwpMJRew8a";
+#define HTTP_TIMEOUT_MS 5000  // Connect and read, per request
 
 // LoRa pins configuration
 #define SS 18
 #define RST 14
 #define DIO0 26
 
+// Packet decoding
+#define LORA_MAX_PACKET 255
+#define DECODE_STATS_INTERVAL 20  // Print decode stats every N packets
+
+uint8_t rxBuffer[LORA_MAX_PACKET + 1];
+
+// Dictionary-compressed JSON (transmitters built with LORA_JSON_COMPRESSION)
+// is expanded here before parsing, see JsonCompressor.h
+#define JSON_MAX_DOCUMENT 512
+char jsonBuffer[JSON_MAX_DOCUMENT];
+
+// Adaptive data rate, see AdrController.h. A single SX1276 only demodulates
+// the SF it is set to, so the SF range is pinned to it and ADR works on TX
+// power; widen the range when the gateway can receive several SFs.
+#define GATEWAY_SPREADING_FACTOR 7
+const AdrConfig ADR_CONFIG = {
+  GATEWAY_SPREADING_FACTOR, GATEWAY_SPREADING_FACTOR,  // SF range
+  2, 17, 3,                                            // TX power min, max, step (dBm)
+  10.0,                                                // Installation margin (dB)
+  16                                                   // Repeat the command every N uplinks
+};
+AdrController adr(ADR_CONFIG, GATEWAY_SPREADING_FACTOR);
+
+// Per-node link state and ARQ windows, see NodeTable.h. Uplinks sent with
+// ARQ (transmitters built with LORA_ARQ) are acknowledged and duplicates are
+// dropped before the upload; plain uplinks are handled as before.
+#define STATUS_INTERVAL 300000  // Node status dump every 5 minutes
+NodeTable nodes;
+unsigned long lastStatusTime = 0;
+
+#ifdef LORA_TDMA
+// Time-slotted uplinks: a beacon opens every superframe and each node sends
+// in the slot given by its lahanID. A slot has to cover the uplink, the
+// receive window and the blocking sheet upload that follows it, otherwise
+// the next node transmits while this gateway is busy with HTTP.
+#define BEACON_PERIOD_MS 120000
+#define TDMA_SLOT_MS 2500
+#define TDMA_FIRST_SLOT_MS 1000  // Leaves nodes time to switch from beacon RX to TX
+#define TDMA_SLOT_COUNT ((BEACON_PERIOD_MS - TDMA_FIRST_SLOT_MS) / TDMA_SLOT_MS)
+
+uint16_t beaconSequence = 0;
+unsigned long lastBeaconTime = 0;  // Grid time of the last beacon, see sendBeacon()
+bool beaconAnchored = false;
+unsigned long beaconsSkipped = 0;
+
+// A sheet upload that could still be running when the next beacon is due
+// waits here and goes out once there is time again, so beacons stay on time
+#define UPLOAD_BUDGET_MS (2 * HTTP_TIMEOUT_MS + 2000)  // Apps Script redirects once
+#define DEFERRED_UPLOADS 8
+struct DeferredUpload {
+  SensorReading reading;
+  uint64_t receivedAt;
+};
+DeferredUpload deferredUploads[DEFERRED_UPLOADS];
+size_t deferredHead = 0;
+size_t deferredCount = 0;
+unsigned long uploadsDeferred = 0;
+unsigned long uploadsDropped = 0;
+#endif
+
+// Only the fields forwarded to the sheet are kept when deserializing
+StaticJsonDocument<128> jsonFilter;
+
+struct DecodeStats {
+  uint32_t jsonFrames = 0;
+  uint32_t binaryFrames = 0;
+  uint32_t compressedFrames = 0;  // Also counted in jsonFrames
+  uint32_t failures = 0;
+  uint32_t truncated = 0;
+  uint32_t totalMicros = 0;
+  uint32_t maxMicros = 0;
+} decodeStats;
+
+// Frames sent with FEC (transmitters built with LORA_FEC) are repaired
+// before decoding, see ReedSolomon.h
+struct FecStats {
+  uint32_t frames = 0;
+  uint32_t repaired = 0;        // Frames that needed correction
+  uint32_t correctedBytes = 0;
+  uint32_t failures = 0;        // Too damaged to repair
+  uint32_t badChecks = 0;       // Miscorrected, caught by the frame's CRC
+  uint32_t totalMicros = 0;
+  uint32_t maxMicros = 0;
+} fecStats;
+
+// Stage latency, see StageTrace.h. "packet" spans a whole uplink, from
+// reading it off the radio to the end of the upload; "uplink" runs from
+// the node's capture time to receipt here and needs GPS time on both ends.
+// Send 't' over Serial for the histograms, 'r' to reset them.
+enum { STAGE_RX, STAGE_FEC, STAGE_PARSE, STAGE_DOWNLINK, STAGE_AXP, STAGE_HTTP, STAGE_PACKET, STAGE_UPLINK, STAGE_COUNT };
+const char* const STAGE_NAMES[STAGE_COUNT] = {"rx", "fec", "parse", "downlink", "axp", "http", "packet", "uplink"};
+StageTracer<STAGE_COUNT> tracer(STAGE_NAMES, esp_timer_get_time);
+
+// Transmitters built with TRACE_TELEMETRY_EVERY send their own stage
+// summaries as {"type":"trace",...} JSON; they are printed, not uploaded
+#define TRACE_TELEMETRY_PREFIX "{\"type\":\"trace\""
+uint32_t traceFrames = 0;
+
+#ifdef GPS_TIME
+// GPS time, see GpsTime.h. Uplinks are stamped on receipt and both times
+// go to the sheet with the reading, so each hop's latency can be worked
+// out: node to gateway here, gateway to sheet against the sheet's own
+// timestamp. The GPS is powered from LDO3 and talks NMEA on UART1; its PPS
+// output is not routed to the ESP32 on v1.x boards, so set
+// -D GPS_PPS_PIN=<gpio> only where a wire was added.
+#define GPS_RX 34
+#define GPS_TX 12
+#define GPS_BAUD 9600
+#ifndef GPS_PPS_PIN
+#define GPS_PPS_PIN -1
+#endif
+NmeaParser nmea;
+GpsClock gpsClock;
+volatile int64_t ppsMicros = 0;
+volatile uint32_t ppsCount = 0;
+uint32_t ppsSeen = 0;
+int64_t lastGpsPoll = 0;
+bool gpsEcho = false;
+#endif
+
 void setupLoRa();
+void buildJsonFilter();
 void sendToGoogleSheet(String jsonData);
-void parseAndSendData(String jsonData);
+bool decodePacket(const uint8_t* data, size_t len, SensorReading& reading);
+bool decodeJsonPacket(const uint8_t* data, size_t len, SensorReading& reading);
+void parseAndSendData(const SensorReading& reading, uint64_t receivedAt);
+void printDecodeStats();
+bool repairFecFrame(uint8_t*& frame, size_t& len);
+void handleAdr(uint16_t lahanID, int rssi, float snr);
+void sendDownlink(const uint8_t* data, size_t len);
+bool handleArq(const ArqHeader& header);
+void printNodeStatus();
+void printLinkStats();
+#ifdef LORA_TDMA
+void sendBeacon();
+bool uploadFitsBeforeBeacon();
+void flushDeferredUpload();
+#endif
+void uploadReading(const SensorReading& reading, uint64_t receivedAt);
 void getBatteryInfo(JsonObject& battery);
+bool isTraceTelemetry(const uint8_t* data, size_t len);
+void serviceSerialCommands();
+void printTraceStats();
+#ifdef GPS_TIME
+void setupGps();
+void serviceGps();
+void printGpsStats();
+#endif
 
 void setup() {
   Serial.begin(115200);
@@ -45,10 +199,18 @@ void setup() {
 
   // Setup LoRa
   setupLoRa();
+  buildJsonFilter();
+#ifdef GPS_TIME
+  setupGps();
+#endif
   Serial.println("LoRa Receiver Ready!");
+#ifdef LORA_TDMA
+  sendBeacon();
+#endif
 }
 
 void getBatteryInfo(JsonObject& battery) {
+  int64_t axpStart = tracer.now();
   // Get battery voltage in mV
   float batteryVoltage = axp.getBattVoltage();
   
@@ -60,6 +222,7 @@ void getBatteryInfo(JsonObject& battery) {
   // Get charge and discharge current in mA
   float chargeCurrent = axp.getBattChargeCurrent();
   float dischargeCurrent = axp.getBattDischargeCurrent();
+  tracer.recordSince(STAGE_AXP, axpStart);
 
   // Store battery information in JSON
   battery["voltage"] = batteryVoltage;
@@ -76,18 +239,110 @@ void getBatteryInfo(JsonObject& battery) {
 }
 
 void loop() {
+#ifdef LORA_TDMA
+  if (millis() - lastBeaconTime >= BEACON_PERIOD_MS) {
+    sendBeacon();
+  }
+  flushDeferredUpload();
+#endif
+
+  if (millis() - lastStatusTime >= STATUS_INTERVAL) {
+    printNodeStatus();
+    lastStatusTime = millis();
+  }
+#ifdef GPS_TIME
+  serviceGps();
+#endif
+  serviceSerialCommands();
+
   int packetSize = LoRa.parsePacket();
   if (packetSize) {
-    // Read received LoRa packet
-    String receivedData = "";
+    TRACE_SCOPE(tracer, STAGE_PACKET);
+    int64_t rxStart = tracer.now();
+    int rssi = LoRa.packetRssi();
+    float snr = LoRa.packetSnr();
+
+    // Read received LoRa packet into the static buffer
+    size_t len = 0;
     while (LoRa.available()) {
-      receivedData += (char)LoRa.read();
+      int b = LoRa.read();
+      if (len < LORA_MAX_PACKET) {
+        rxBuffer[len++] = (uint8_t)b;
+      }
+    }
+    if ((size_t)packetSize > LORA_MAX_PACKET) {
+      decodeStats.truncated++;
+    }
+    tracer.recordSince(STAGE_RX, rxStart);
+#ifdef GPS_TIME
+    // Taken when the packet was picked up, which trails the end of
+    // reception by however long loop() was busy
+    uint64_t receivedAt = gpsClock.unixMillis(rxStart);
+#else
+    uint64_t receivedAt = 0;
+#endif
+
+    uint8_t* frame = rxBuffer;
+    if (isFecFrame(rxBuffer, len) && !repairFecFrame(frame, len)) {
+      decodeStats.failures++;
+      return;
+    }
+
+    // Strip the ARQ envelope, if any
+    ArqHeader arqHeader;
+    bool arqFramed = decodeArqHeader(frame, len, arqHeader);
+    uint8_t* payload = arqFramed ? frame + ARQ_HEADER_SIZE : frame;
+    size_t payloadLen = arqFramed ? len - ARQ_HEADER_SIZE : len;
+
+    if (isTraceTelemetry(payload, payloadLen)) {
+      traceFrames++;
+      payload[payloadLen] = '\0';
+      Serial.printf("Trace telemetry: %s\n", (const char*)payload);
+      if (arqFramed) {
+        handleArq(arqHeader);
+      }
+      return;
+    }
+
+    if (isSensorFrame(payload, payloadLen)) {
+      Serial.printf("Received LoRa binary frame (%u bytes)\n", (unsigned)payloadLen);
+    } else if (isCompressedJson(payload, payloadLen)) {
+      Serial.printf("Received LoRa compressed JSON (%u bytes)\n", (unsigned)payloadLen);
+    } else {
+      payload[payloadLen] = '\0';
+      Serial.printf("Received LoRa data: %s\n", (const char*)payload);
+    }
+
+    // Decode and send to Google Sheet
+    SensorReading reading;
+    if (decodePacket(payload, payloadLen, reading)) {
+      // Answer inside the transmitter's receive window, before the upload.
+      // The ACK goes last: the node stops listening once it has it.
+      nodes.onUplink(reading.lahanID, rssi, snr, millis());
+      handleAdr(reading.lahanID, rssi, snr);
+      bool fresh = !arqFramed || handleArq(arqHeader);
+      if (reading.capturedAt != 0 && receivedAt >= reading.capturedAt) {
+        uint64_t latency = receivedAt - reading.capturedAt;
+        tracer.record(STAGE_UPLINK, (uint32_t)(latency * 1000));
+        Serial.printf("Uplink latency: %llu ms\n", (unsigned long long)latency);
+      }
+      if (fresh) {
+        uploadReading(reading, receivedAt);
+      } else {
+        Serial.printf("Duplicate uplink %u from lahan %u, not forwarded\n",
+                      arqHeader.sequence, arqHeader.lahanID);
+      }
+    }
+
+    uint32_t packets = decodeStats.jsonFrames + decodeStats.binaryFrames + decodeStats.failures;
+    if (packets % DECODE_STATS_INTERVAL == 0) {
+      printDecodeStats();
+      printLinkStats();
+      printTraceStats();
+#ifdef GPS_TIME
+      printGpsStats();
+#endif
     }
-    
-    Serial.println("Received LoRa data: " + receivedData);
-    
-    // Parse and send to Google Sheet
-    parseAndSendData(receivedData);
   }
 }
 
@@ -97,30 +352,361 @@ void setupLoRa() {
     Serial.println("Starting LoRa failed!");
     while (1);
   }
+  LoRa.setSpreadingFactor(GATEWAY_SPREADING_FACTOR);
   Serial.println("LoRa initialized successfully");
 }
 
-void parseAndSendData(String jsonData) {
-  StaticJsonDocument<300> doc;
-  StaticJsonDocument<200> batteryDoc;
-  
-  DeserializationError error = deserializeJson(doc, jsonData);
-  
+void buildJsonFilter() {
+  jsonFilter["lahanID"] = true;
+  JsonObject sensor = jsonFilter.createNestedObject("sensor");
+  sensor["Humidity"] = true;
+  sensor["Temperature"] = true;
+  sensor["Ec"] = true;
+  sensor["Ph"] = true;
+  sensor["Nitrogen"] = true;
+  sensor["Phosporus"] = true;
+  sensor["Kalium"] = true;
+  jsonFilter["ts"] = true;
+}
+
+// Corrects a FEC frame in place; on success frame and len describe the
+// payload inside it
+bool repairFecFrame(uint8_t*& frame, size_t& len) {
+  uint32_t start = micros();
+  int corrected = decodeFecFrame(frame, len, frame, len);
+  uint32_t elapsed = micros() - start;
+  tracer.record(STAGE_FEC, elapsed);
+  fecStats.totalMicros += elapsed;
+  if (elapsed > fecStats.maxMicros) fecStats.maxMicros = elapsed;
+
+  fecStats.frames++;
+  if (corrected == FEC_BAD_CHECK) {
+    fecStats.badChecks++;
+    Serial.println("FEC: CRC mismatch after decoding, packet dropped");
+    return false;
+  }
+  if (corrected < 0) {
+    fecStats.failures++;
+    Serial.println("FEC: too many errors, packet dropped");
+    return false;
+  }
+  if (corrected > 0) {
+    fecStats.repaired++;
+    fecStats.correctedBytes += corrected;
+    Serial.printf("FEC: corrected %d bytes\n", corrected);
+  }
+  return true;
+}
+
+bool decodePacket(const uint8_t* data, size_t len, SensorReading& reading) {
+  uint32_t start = micros();
+  bool ok;
+
+  if (isSensorFrame(data, len)) {
+    ok = decodeSensorFrame(data, len, reading);
+    if (ok) decodeStats.binaryFrames++;
+  } else if (isCompressedJson(data, len)) {
+    size_t jsonLen = decompressJson(data, len, jsonBuffer, sizeof(jsonBuffer));
+    ok = jsonLen > 0 && decodeJsonPacket((const uint8_t*)jsonBuffer, jsonLen, reading);
+    if (ok) {
+      decodeStats.jsonFrames++;
+      decodeStats.compressedFrames++;
+    }
+  } else {
+    ok = decodeJsonPacket(data, len, reading);
+    if (ok) decodeStats.jsonFrames++;
+  }
+
+  uint32_t elapsed = micros() - start;
+  tracer.record(STAGE_PARSE, elapsed);
+  decodeStats.totalMicros += elapsed;
+  if (elapsed > decodeStats.maxMicros) decodeStats.maxMicros = elapsed;
+
+  if (!ok) {
+    decodeStats.failures++;
+    Serial.println("Failed to decode packet");
+  }
+  return ok;
+}
+
+bool decodeJsonPacket(const uint8_t* data, size_t len, SensorReading& reading) {
+  StaticJsonDocument<192> doc;
+
+  DeserializationError error = deserializeJson(doc, (const char*)data, len,
+                                               DeserializationOption::Filter(jsonFilter));
   if (error) {
-    Serial.println("Failed to parse JSON");
-    return;
+    Serial.printf("Failed to parse JSON: %s\n", error.c_str());
+    return false;
   }
 
   // Extract sensor values
-  int lahanID = doc["lahanID"];
   JsonObject sensor = doc["sensor"];
-  float humidity = sensor["Humidity"];
-  float temperature = sensor["Temperature"];
-  float ec = sensor["Ec"];
-  float ph = sensor["Ph"];
-  float nitrogen = sensor["Nitrogen"];
-  float phosphorus = sensor["Phosporus"];
-  float potassium = sensor["Kalium"];
+  if (sensor.isNull()) {
+    return false;
+  }
+  reading.lahanID = doc["lahanID"];
+  reading.humidity = sensor["Humidity"];
+  reading.temperature = sensor["Temperature"];
+  reading.ec = sensor["Ec"];
+  reading.ph = sensor["Ph"];
+  reading.nitrogen = sensor["Nitrogen"];
+  reading.phosphorus = sensor["Phosporus"];
+  reading.potassium = sensor["Kalium"];
+  reading.capturedAt = doc["ts"].as<uint64_t>();
+  return true;
+}
+
+void printDecodeStats() {
+  uint32_t decoded = decodeStats.jsonFrames + decodeStats.binaryFrames + decodeStats.failures;
+  Serial.println("Decode Statistics:");
+  Serial.printf("JSON: %lu (%lu compressed), Binary: %lu, Failed: %lu, Truncated: %lu\n",
+                (unsigned long)decodeStats.jsonFrames, (unsigned long)decodeStats.compressedFrames,
+                (unsigned long)decodeStats.binaryFrames,
+                (unsigned long)decodeStats.failures, (unsigned long)decodeStats.truncated);
+  Serial.printf("Decode time: avg %lu us, max %lu us\n",
+                (unsigned long)(decoded ? decodeStats.totalMicros / decoded : 0),
+                (unsigned long)decodeStats.maxMicros);
+  if (fecStats.frames > 0) {
+    Serial.printf("FEC: %lu frames, %lu repaired (%lu bytes), %lu unrepairable, %lu bad CRC, avg %lu us, max %lu us\n",
+                  (unsigned long)fecStats.frames, (unsigned long)fecStats.repaired,
+                  (unsigned long)fecStats.correctedBytes, (unsigned long)fecStats.failures,
+                  (unsigned long)fecStats.badChecks,
+                  (unsigned long)(fecStats.totalMicros / fecStats.frames), (unsigned long)fecStats.maxMicros);
+  }
+}
+
+bool isTraceTelemetry(const uint8_t* data, size_t len) {
+  size_t prefixLen = sizeof(TRACE_TELEMETRY_PREFIX) - 1;
+  return len > prefixLen && memcmp(data, TRACE_TELEMETRY_PREFIX, prefixLen) == 0;
+}
+
+// 't' prints the stage histograms, 'r' resets them. With GPS_TIME, 'g'
+// prints the clock state and 'n' toggles raw NMEA output for gps_replay.
+void serviceSerialCommands() {
+  while (Serial.available() > 0) {
+    int command = Serial.read();
+    if (command == 't') {
+      printTraceStats();
+    } else if (command == 'r') {
+      tracer.reset();
+      Serial.println("Stage histograms reset");
+#ifdef GPS_TIME
+    } else if (command == 'g') {
+      printGpsStats();
+    } else if (command == 'n') {
+      gpsEcho = !gpsEcho;
+#endif
+    }
+  }
+}
+
+void printTraceStats() {
+  Serial.printf("Stage Latency (us, %lu node trace packets):\n", (unsigned long)traceFrames);
+  for (size_t i = 0; i < tracer.size(); i++) {
+    const StageHistogram& h = tracer.histogram(i);
+    if (h.count == 0) continue;
+    Serial.printf("%-9s n=%lu avg %lu, p50 %lu, p90 %lu, p99 %lu, max %lu\n", tracer.name(i),
+                  (unsigned long)h.count, (unsigned long)traceAverage(h), (unsigned long)tracePercentile(h, 0.5f),
+                  (unsigned long)tracePercentile(h, 0.9f), (unsigned long)tracePercentile(h, 0.99f),
+                  (unsigned long)h.maxMicros);
+  }
+}
+
+#ifdef GPS_TIME
+void IRAM_ATTR onPps() {
+  ppsMicros = esp_timer_get_time();
+  ppsCount++;
+}
+
+void setupGps() {
+  axp.setPowerOutPut(AXP192_LDO3, AXP202_ON);
+  Serial1.begin(GPS_BAUD, SERIAL_8N1, GPS_RX, GPS_TX);
+#if GPS_PPS_PIN >= 0
+  pinMode(GPS_PPS_PIN, INPUT);
+  attachInterrupt(digitalPinToInterrupt(GPS_PPS_PIN), onPps, RISING);
+#endif
+  lastGpsPoll = esp_timer_get_time();
+}
+
+// A sentence is timed by the window between this poll and the previous
+// one; polls separated by an upload are too far apart to pair with a pulse
+// and only feed the fallback filter.
+void serviceGps() {
+  uint32_t count;
+  int64_t edge;
+  do {
+    count = ppsCount;
+    edge = ppsMicros;
+  } while (count != ppsCount);  // The interrupt fired mid-read
+  if (count != ppsSeen) {
+    ppsSeen = count;
+    gpsClock.onPulse(edge);
+    if (gpsEcho) {
+      Serial.printf("%lld PPS\n", (long long)edge);
+    }
+  }
+
+  while (Serial1.available() > 0) {
+    NmeaEvent event = nmea.feed((char)Serial1.read());
+    if (event == NMEA_NONE) continue;
+    int64_t now = esp_timer_get_time();
+    if (event == NMEA_TIME) {
+      gpsClock.onNmeaTime(nmea.unixMicros(), lastGpsPoll, now);
+    }
+    if (gpsEcho) {
+      Serial.printf("%lld $%s\n", (long long)now, nmea.sentence());  // The format gps_replay reads
+    }
+  }
+  lastGpsPoll = esp_timer_get_time();
+}
+
+void printGpsStats() {
+  int64_t now = esp_timer_get_time();
+  const NmeaParser::Stats& parser = nmea.stats();
+  const GpsClock::Stats& clock = gpsClock.stats();
+  Serial.printf("GPS time: %s, Unix %llu ms, drift %.2f ppm\n", gpsTimeSourceName(gpsClock.source(now)),
+                (unsigned long long)gpsClock.unixMillis(now), gpsClock.driftPpb() / 1000.0);
+  Serial.printf("NMEA: %lu sentences, %lu checksum errors, %lu times, %lu without fix\n",
+                parser.sentences, parser.checksumErrors, parser.times, parser.noFix);
+  Serial.printf("PPS: %lu pulses, %lu rejected, %lu locks, %lu mismatches, residual %ld us (max %lu)\n",
+                clock.pulses, clock.rejected, clock.locks, clock.mismatches,
+                (long)clock.lastResidual, (unsigned long)clock.maxResidual);
+}
+#endif
+
+void handleAdr(uint16_t lahanID, int rssi, float snr) {
+  AdrCommand command;
+  if (!adr.onUplink(lahanID, rssi, snr, command)) {
+    return;
+  }
+  uint8_t downlink[DOWNLINK_ADR_SIZE];
+  size_t len = encodeAdrDownlink(lahanID, command, downlink, sizeof(downlink));
+  sendDownlink(downlink, len);
+  Serial.printf("ADR downlink to lahan %u: SF%u, %d dBm (RSSI %d, SNR %.1f)\n",
+                lahanID, command.spreadingFactor, command.txPower, rssi, snr);
+}
+
+// Acknowledges an ARQ uplink. Returns false for a duplicate, which is
+// acknowledged again (the previous ACK was lost) but not forwarded.
+bool handleArq(const ArqHeader& header) {
+  ArqAck ack = {header.sequence, 0};
+  bool fresh = true;
+  NodeState* node = nodes.find(header.lahanID);
+  if (node != nullptr) {
+    fresh = NodeTable::onSequence(*node, header.sequence, ack);
+  }
+  uint8_t downlink[DOWNLINK_ACK_SIZE];
+  size_t len = encodeAckDownlink(header.lahanID, ack, downlink, sizeof(downlink));
+  sendDownlink(downlink, len);
+  return fresh;
+}
+
+// Downlinks use inverted IQ, see LoRaProtocol.h. parsePacket() puts the
+// radio back into receive mode afterwards.
+void sendDownlink(const uint8_t* data, size_t len) {
+  TRACE_SCOPE(tracer, STAGE_DOWNLINK);
+  LoRa.idle();
+  LoRa.enableInvertIQ();
+  LoRa.beginPacket();
+  LoRa.write(data, len);
+  LoRa.endPacket();
+  LoRa.disableInvertIQ();
+}
+
+#ifdef LORA_TDMA
+void sendBeacon() {
+  BeaconInfo beacon = {
+    beaconSequence++, BEACON_PERIOD_MS, TDMA_SLOT_MS, TDMA_SLOT_COUNT, TDMA_FIRST_SLOT_MS
+  };
+  uint8_t downlink[DOWNLINK_BEACON_SIZE];
+  size_t len = encodeBeaconDownlink(beacon, downlink, sizeof(downlink));
+  unsigned long now = millis();
+  sendDownlink(downlink, len);
+
+  // Nodes time their slots from the end of the beacon and expect the next
+  // one a period later, so beacons start on the grid set by the first: a
+  // late one does not push the rest back. A period missed outright is
+  // skipped rather than sent twice.
+  if (!beaconAnchored) {
+    lastBeaconTime = now;
+    beaconAnchored = true;
+  } else {
+    lastBeaconTime += BEACON_PERIOD_MS;
+    while (now - lastBeaconTime >= BEACON_PERIOD_MS) {
+      lastBeaconTime += BEACON_PERIOD_MS;
+      beaconsSkipped++;
+    }
+  }
+  Serial.printf("Beacon %u: %u slots of %u ms, %lu ms late (%lu skipped, %lu uploads deferred, %lu dropped)\n",
+                beacon.sequence, beacon.slotCount, beacon.slotLength, now - lastBeaconTime,
+                beaconsSkipped, uploadsDeferred, uploadsDropped);
+}
+
+bool uploadFitsBeforeBeacon() {
+  return millis() - lastBeaconTime + UPLOAD_BUDGET_MS < BEACON_PERIOD_MS;
+}
+
+// Uploads the oldest deferred reading if it can finish before the beacon
+void flushDeferredUpload() {
+  if (deferredCount == 0 || !uploadFitsBeforeBeacon()) {
+    return;
+  }
+  DeferredUpload& upload = deferredUploads[deferredHead];
+  deferredHead = (deferredHead + 1) % DEFERRED_UPLOADS;
+  deferredCount--;
+  parseAndSendData(upload.reading, upload.receivedAt);
+}
+#endif
+
+void uploadReading(const SensorReading& reading, uint64_t receivedAt) {
+#ifdef LORA_TDMA
+  if (deferredCount > 0 || !uploadFitsBeforeBeacon()) {
+    if (deferredCount == DEFERRED_UPLOADS) {
+      // Full: the oldest reading makes room
+      deferredHead = (deferredHead + 1) % DEFERRED_UPLOADS;
+      deferredCount--;
+      uploadsDropped++;
+    }
+    deferredUploads[(deferredHead + deferredCount) % DEFERRED_UPLOADS] = {reading, receivedAt};
+    deferredCount++;
+    uploadsDeferred++;
+    return;
+  }
+#endif
+  parseAndSendData(reading, receivedAt);
+}
+
+void printLinkStats() {
+  Serial.printf("Link Statistics (%u nodes, %lu ADR changes):\n", (unsigned)adr.nodeCount(), adr.changes());
+  for (size_t i = 0; i < ADR_MAX_NODES; i++) {
+    const AdrController::Node& node = adr.node(i);
+    if (!node.used) continue;
+    Serial.printf("Lahan %u: %lu uplinks, RSSI %d, SNR %.1f, SF%u, %d dBm\n",
+                  node.lahanID, (unsigned long)node.uplinks, node.lastRssi, node.lastSnr,
+                  node.current.spreadingFactor, node.current.txPower);
+  }
+}
+
+void printNodeStatus() {
+  unsigned long now = millis();
+  Serial.printf("Node Status (%u nodes, max probe %u):\n", (unsigned)nodes.count(), (unsigned)nodes.maxProbes());
+  for (size_t i = 0; i < NODE_TABLE_SIZE; i++) {
+    const NodeState& node = nodes.slot(i);
+    if (!node.used) continue;
+    Serial.printf("Lahan %u: seen %lu s ago, %lu uplinks, RSSI avg %.1f, SNR avg %.1f\n",
+                  node.lahanID, (now - node.lastSeen) / 1000, (unsigned long)node.uplinks,
+                  node.rssiAverage, node.snrAverage);
+    if (node.sequenced) {
+      Serial.printf("  seq %u, %lu received, %lu duplicates, %lu missed, %lu recovered, %lu restarts, loss %.1f%%\n",
+                    node.highest, (unsigned long)node.received, (unsigned long)node.duplicates,
+                    (unsigned long)node.missed, (unsigned long)node.recovered, (unsigned long)node.restarts,
+                    NodeTable::lossRate(node) * 100);
+    }
+  }
+}
+
+void parseAndSendData(const SensorReading& reading, uint64_t receivedAt) {
+  StaticJsonDocument<200> batteryDoc;
 
   // Get receiver's battery information
   JsonObject battery = batteryDoc.createNestedObject("battery");
@@ -128,24 +714,37 @@ void parseAndSendData(String jsonData) {
 
   // Create URL for Google Sheet with added battery parameters
   String url = "https://script.google.com/macros/s/" + GOOGLE_SCRIPT_ID + 
-              "/exec?lahanID=" + String(lahanID) +
-              "&humidity=" + String(humidity) +
-              "&temperature=" + String(temperature) +
-              "&ec=" + String(ec) +
-              "&ph=" + String(ph) +
-              "&nitrogen=" + String(nitrogen) +
-              "&phosphorus=" + String(phosphorus) +
-              "&potassium=" + String(potassium) +
+              "/exec?lahanID=" + String(reading.lahanID) +
+              "&humidity=" + String(reading.humidity) +
+              "&temperature=" + String(reading.temperature) +
+              "&ec=" + String(reading.ec) +
+              "&ph=" + String(reading.ph) +
+              "&nitrogen=" + String(reading.nitrogen) +
+              "&phosphorus=" + String(reading.phosphorus) +
+              "&potassium=" + String(reading.potassium) +
               "&batteryVoltage=" + String(battery["voltage"].as<float>()) +
               "&batteryPercentage=" + String(battery["percentage"].as<float>()) +
               "&batteryChargeCurrent=" + String(battery["chargeCurrent"].as<float>()) +
               "&batteryDischargeCurrent=" + String(battery["dischargeCurrent"].as<float>());
+  // GPS times in Unix ms, when known
+  char timestamp[24];
+  if (reading.capturedAt != 0) {
+    snprintf(timestamp, sizeof(timestamp), "%llu", (unsigned long long)reading.capturedAt);
+    url += String("&capturedAt=") + timestamp;
+  }
+  if (receivedAt != 0) {
+    snprintf(timestamp, sizeof(timestamp), "%llu", (unsigned long long)receivedAt);
+    url += String("&receivedAt=") + timestamp;
+  }
 
   sendToGoogleSheet(url);
 }
 
 void sendToGoogleSheet(String url) {
+  TRACE_SCOPE(tracer, STAGE_HTTP);
   HTTPClient http;
+  http.setConnectTimeout(HTTP_TIMEOUT_MS);
+  http.setTimeout(HTTP_TIMEOUT_MS);
   http.begin(url);
   http.setFollowRedirects(HTTPC_STRICT_FOLLOW_REDIRECTS);
   
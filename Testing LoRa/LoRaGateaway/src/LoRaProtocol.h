@@ -0,0 +1,181 @@
+#pragma once
+
+// Downlinks from the gateway to the transmitters.
+//
+// Downlinks go out with inverted IQ and transmitters only listen with
+// inverted IQ, so a node never mistakes another node's uplink for a
+// downlink. Multi-byte fields are little endian, as in SensorFrame.h.
+//
+//  off  size  field
+//    0     1  LORA_DOWNLINK_MAGIC
+//    1     1  type (DownlinkType)
+//    2     2  lahanID of the target node, LORA_BROADCAST for all
+//    4     -  body
+//
+// DOWNLINK_ADR body:
+//    4     1  spreading factor
+//    5     1  TX power (dBm)
+//
+// DOWNLINK_BEACON body, broadcast once per superframe. Times are relative
+// to the end of the beacon:
+//    4     2  sequence
+//    6     4  superframe period (ms)
+//   10     2  slot length (ms)
+//   12     2  slot count
+//   14     2  start of the first slot (ms)
+//
+// DOWNLINK_ACK body, acknowledging ARQ uplinks:
+//    4     2  highest sequence received
+//    6     4  bitmap, bit i set if sequence - 1 - i was received too
+//
+// With ARQ enabled, uplinks are wrapped in a short envelope in front of the
+// JSON or SensorFrame payload:
+//    0     1  LORA_ARQ_MAGIC
+//    1     2  lahanID
+//    3     2  sequence
+//    5     -  payload
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "SensorFrame.h"
+
+#define LORA_DOWNLINK_MAGIC 0xD1
+#define DOWNLINK_HEADER_SIZE 4
+#define DOWNLINK_ADR_SIZE (DOWNLINK_HEADER_SIZE + 2)
+#define DOWNLINK_BEACON_SIZE (DOWNLINK_HEADER_SIZE + 12)
+#define DOWNLINK_ACK_SIZE (DOWNLINK_HEADER_SIZE + 6)
+#define LORA_BROADCAST 0xFFFF
+
+#define LORA_ARQ_MAGIC 0xA1
+#define ARQ_HEADER_SIZE 5
+#define ARQ_ACK_BITS 32
+
+enum DownlinkType : uint8_t {
+  DOWNLINK_ADR = 1,
+  DOWNLINK_BEACON = 2,
+  DOWNLINK_ACK = 3
+};
+
+struct AdrCommand {
+  uint8_t spreadingFactor;
+  int8_t txPower;  // dBm
+};
+
+struct BeaconInfo {
+  uint16_t sequence;
+  uint32_t period;           // ms
+  uint16_t slotLength;       // ms
+  uint16_t slotCount;
+  uint16_t firstSlotOffset;  // ms
+};
+
+struct ArqAck {
+  uint16_t sequence;  // highest received
+  uint32_t bitmap;    // bit i: sequence - 1 - i received
+};
+
+struct ArqHeader {
+  uint16_t lahanID;
+  uint16_t sequence;
+};
+
+inline size_t encodeDownlinkHeader(DownlinkType type, uint16_t lahanID, uint8_t* out, size_t capacity) {
+  if (capacity < DOWNLINK_HEADER_SIZE) return 0;
+  out[0] = LORA_DOWNLINK_MAGIC;
+  out[1] = type;
+  sensor_frame::putU16(out + 2, lahanID);
+  return DOWNLINK_HEADER_SIZE;
+}
+
+// Returns false unless data is a downlink; fills type and target otherwise.
+inline bool decodeDownlinkHeader(const uint8_t* data, size_t len, uint8_t& type, uint16_t& lahanID) {
+  if (len < DOWNLINK_HEADER_SIZE || data[0] != LORA_DOWNLINK_MAGIC) return false;
+  type = data[1];
+  lahanID = sensor_frame::getU16(data + 2);
+  return true;
+}
+
+inline size_t encodeAdrDownlink(uint16_t lahanID, const AdrCommand& command, uint8_t* out, size_t capacity) {
+  if (capacity < DOWNLINK_ADR_SIZE) return 0;
+  encodeDownlinkHeader(DOWNLINK_ADR, lahanID, out, capacity);
+  out[4] = command.spreadingFactor;
+  out[5] = (uint8_t)command.txPower;
+  return DOWNLINK_ADR_SIZE;
+}
+
+inline bool decodeAdrDownlink(const uint8_t* data, size_t len, AdrCommand& command) {
+  if (len < DOWNLINK_ADR_SIZE || data[0] != LORA_DOWNLINK_MAGIC || data[1] != DOWNLINK_ADR) return false;
+  command.spreadingFactor = data[4];
+  command.txPower = (int8_t)data[5];
+  return command.spreadingFactor >= 6 && command.spreadingFactor <= 12;
+}
+
+inline size_t encodeBeaconDownlink(const BeaconInfo& beacon, uint8_t* out, size_t capacity) {
+  using namespace sensor_frame;
+  if (capacity < DOWNLINK_BEACON_SIZE) return 0;
+  encodeDownlinkHeader(DOWNLINK_BEACON, LORA_BROADCAST, out, capacity);
+  putU16(out + 4, beacon.sequence);
+  putU16(out + 6, (uint16_t)(beacon.period & 0xFFFF));
+  putU16(out + 8, (uint16_t)(beacon.period >> 16));
+  putU16(out + 10, beacon.slotLength);
+  putU16(out + 12, beacon.slotCount);
+  putU16(out + 14, beacon.firstSlotOffset);
+  return DOWNLINK_BEACON_SIZE;
+}
+
+inline bool decodeBeaconDownlink(const uint8_t* data, size_t len, BeaconInfo& beacon) {
+  using namespace sensor_frame;
+  if (len < DOWNLINK_BEACON_SIZE || data[0] != LORA_DOWNLINK_MAGIC || data[1] != DOWNLINK_BEACON) return false;
+  beacon.sequence = getU16(data + 4);
+  beacon.period = getU16(data + 6) | ((uint32_t)getU16(data + 8) << 16);
+  beacon.slotLength = getU16(data + 10);
+  beacon.slotCount = getU16(data + 12);
+  beacon.firstSlotOffset = getU16(data + 14);
+  return beacon.slotCount > 0 && beacon.slotLength > 0;
+}
+
+inline size_t encodeAckDownlink(uint16_t lahanID, const ArqAck& ack, uint8_t* out, size_t capacity) {
+  using namespace sensor_frame;
+  if (capacity < DOWNLINK_ACK_SIZE) return 0;
+  encodeDownlinkHeader(DOWNLINK_ACK, lahanID, out, capacity);
+  putU16(out + 4, ack.sequence);
+  putU16(out + 6, (uint16_t)(ack.bitmap & 0xFFFF));
+  putU16(out + 8, (uint16_t)(ack.bitmap >> 16));
+  return DOWNLINK_ACK_SIZE;
+}
+
+inline bool decodeAckDownlink(const uint8_t* data, size_t len, ArqAck& ack) {
+  using namespace sensor_frame;
+  if (len < DOWNLINK_ACK_SIZE || data[0] != LORA_DOWNLINK_MAGIC || data[1] != DOWNLINK_ACK) return false;
+  ack.sequence = getU16(data + 4);
+  ack.bitmap = getU16(data + 6) | ((uint32_t)getU16(data + 8) << 16);
+  return true;
+}
+
+// True if ack covers sequence, directly or through the bitmap
+inline bool arqAcknowledges(const ArqAck& ack, uint16_t sequence) {
+  int16_t behind = (int16_t)(ack.sequence - sequence);
+  if (behind == 0) return true;
+  return behind > 0 && behind <= ARQ_ACK_BITS && (ack.bitmap >> (behind - 1)) & 1;
+}
+
+// Writes the envelope and payload to out; returns 0 if it does not fit.
+inline size_t encodeArqUplink(const ArqHeader& header, const uint8_t* payload, size_t len,
+                              uint8_t* out, size_t capacity) {
+  using namespace sensor_frame;
+  if (capacity < ARQ_HEADER_SIZE + len) return 0;
+  out[0] = LORA_ARQ_MAGIC;
+  putU16(out + 1, header.lahanID);
+  putU16(out + 3, header.sequence);
+  memcpy(out + ARQ_HEADER_SIZE, payload, len);
+  return ARQ_HEADER_SIZE + len;
+}
+
+inline bool decodeArqHeader(const uint8_t* data, size_t len, ArqHeader& header) {
+  using namespace sensor_frame;
+  if (len < ARQ_HEADER_SIZE || data[0] != LORA_ARQ_MAGIC) return false;
+  header.lahanID = getU16(data + 1);
+  header.sequence = getU16(data + 3);
+  return true;
+}
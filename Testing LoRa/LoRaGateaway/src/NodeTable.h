@@ -0,0 +1,146 @@
+#pragma once
+
+// Per-node state on the gateway, in an open-addressing hash table keyed by
+// lahanID (linear probing over a power-of-two table kept at most 3/4 full).
+//
+// Besides link quality (moving averages of RSSI and SNR, last seen) each
+// entry holds the node's ARQ sliding window: the highest sequence received
+// and a bitmap of the ARQ_ACK_BITS sequences before it. Looking up
+// (lahanID, sequence) is therefore one short probe plus a bit test, and
+// the window slides by shifting the bitmap, so nothing has to be expired.
+// The same window is what goes back in the ACK.
+//
+// A gap in the sequence counts as missed; a missed sequence that arrives
+// later (a retransmission) counts as recovered; one already in the window
+// is a duplicate. A sequence further back than the window, or more than
+// NODE_RESTART_GAP ahead, means the node restarted its numbering (it starts
+// from a random sequence), and its window starts over.
+
+#include <stdint.h>
+#include <stddef.h>
+#include "LoRaProtocol.h"
+
+#define NODE_TABLE_BITS 6
+#define NODE_TABLE_SIZE (1 << NODE_TABLE_BITS)
+#define NODE_TABLE_MAX_LOAD (NODE_TABLE_SIZE * 3 / 4)
+#define NODE_RESTART_GAP 1024
+#define NODE_LINK_SMOOTHING 0.125f  // Weight of the newest RSSI/SNR sample
+
+struct NodeState {
+  uint16_t lahanID;
+  bool used;
+  unsigned long lastSeen;  // ms
+  uint32_t uplinks;
+  float rssiAverage;
+  float snrAverage;
+
+  // ARQ window, valid once sequenced
+  bool sequenced;
+  uint16_t highest;
+  uint32_t window;       // bit i: highest - 1 - i received
+  uint32_t received;     // Unique sequences
+  uint32_t duplicates;
+  uint32_t missed;       // Sequences skipped over
+  uint32_t recovered;    // Skipped sequences that arrived later
+  uint32_t restarts;
+};
+
+class NodeTable {
+public:
+  NodeTable() {
+    for (size_t i = 0; i < NODE_TABLE_SIZE; i++) _slots[i].used = false;
+  }
+
+  // The node's entry, added if it is new. nullptr when the table is full.
+  NodeState* find(uint16_t lahanID) {
+    size_t i = home(lahanID);
+    size_t probes = 1;
+    while (_slots[i].used) {
+      if (_slots[i].lahanID == lahanID) return &_slots[i];
+      i = (i + 1) & (NODE_TABLE_SIZE - 1);
+      probes++;
+    }
+    if (_count >= NODE_TABLE_MAX_LOAD) return nullptr;
+
+    if (probes > _maxProbes) _maxProbes = probes;
+    _count++;
+    _slots[i] = NodeState();
+    _slots[i].lahanID = lahanID;
+    _slots[i].used = true;
+    return &_slots[i];
+  }
+
+  // Records link quality for any uplink from the node.
+  NodeState* onUplink(uint16_t lahanID, int rssi, float snr, unsigned long now) {
+    NodeState* node = find(lahanID);
+    if (node == nullptr) return nullptr;
+    if (node->uplinks == 0) {
+      node->rssiAverage = rssi;
+      node->snrAverage = snr;
+    } else {
+      node->rssiAverage += NODE_LINK_SMOOTHING * (rssi - node->rssiAverage);
+      node->snrAverage += NODE_LINK_SMOOTHING * (snr - node->snrAverage);
+    }
+    node->uplinks++;
+    node->lastSeen = now;
+    return node;
+  }
+
+  // Slides the node's window to sequence and fills the ACK to send back.
+  // Returns false if the sequence was already received.
+  static bool onSequence(NodeState& node, uint16_t sequence, ArqAck& ack) {
+    bool fresh = true;
+    int16_t ahead = (int16_t)(sequence - node.highest);
+    if (!node.sequenced || ahead < -ARQ_ACK_BITS || ahead > NODE_RESTART_GAP) {
+      if (node.sequenced) node.restarts++;
+      node.sequenced = true;
+      node.highest = sequence;
+      node.window = 0;
+    } else if (ahead > 0) {
+      node.missed += ahead - 1;
+      node.window = ahead >= ARQ_ACK_BITS ? 0 : node.window << ahead;
+      if (ahead <= ARQ_ACK_BITS) node.window |= 1UL << (ahead - 1);
+      node.highest = sequence;
+    } else if (ahead == 0) {
+      fresh = false;
+    } else {
+      uint32_t bit = 1UL << (-ahead - 1);
+      if (node.window & bit) {
+        fresh = false;
+      } else {
+        node.window |= bit;
+        node.recovered++;
+      }
+    }
+
+    if (fresh) {
+      node.received++;
+    } else {
+      node.duplicates++;
+    }
+    ack.sequence = node.highest;
+    ack.bitmap = node.window;
+    return fresh;
+  }
+
+  // Share of sequences that were skipped and never recovered
+  static float lossRate(const NodeState& node) {
+    uint32_t lost = node.missed > node.recovered ? node.missed - node.recovered : 0;
+    uint32_t expected = node.received + lost;
+    return expected ? (float)lost / expected : 0.0f;
+  }
+
+  size_t count() const { return _count; }
+  size_t maxProbes() const { return _maxProbes; }
+  const NodeState& slot(size_t i) const { return _slots[i]; }
+
+private:
+  // Fibonacci hashing spreads consecutive lahanIDs over the table
+  static size_t home(uint16_t lahanID) {
+    return (uint16_t)(lahanID * 40503u) >> (16 - NODE_TABLE_BITS);
+  }
+
+  NodeState _slots[NODE_TABLE_SIZE];
+  size_t _count = 0;
+  size_t _maxProbes = 0;
+};
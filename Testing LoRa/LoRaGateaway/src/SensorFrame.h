@@ -0,0 +1,141 @@
+#pragma once
+
+// Fixed binary layout for LoRa sensor uplinks.
+//
+// A JSON uplink always starts with '{', so the first byte is enough to tell
+// the two formats apart on the gateway. All multi-byte fields are little
+// endian; sensor values are fixed point with two decimals, which matches the
+// resolution randomFloat() and the DHT22 produce.
+//
+//  off  size  field
+//    0     1  SENSOR_FRAME_MAGIC
+//    1     1  SENSOR_FRAME_VERSION
+//    2     2  lahanID
+//    4    14  humidity, temperature, ec, ph, nitrogen, phosphorus, potassium (int16 x100)
+//   18     2  battery voltage (mV)
+//   20     1  battery percentage
+//   21     2  battery charge current (mA)
+//   23     2  battery discharge current (mA)
+//   25     6  capture time, Unix ms (optional)
+//
+// The capture time is only sent by nodes that have GPS time; decoders that
+// predate it read the first 25 bytes and ignore the rest.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SENSOR_FRAME_MAGIC 0xB1
+#define SENSOR_FRAME_VERSION 1
+#define SENSOR_FRAME_SIZE 25
+#define SENSOR_FRAME_TIMESTAMP_SIZE 6
+#define SENSOR_FRAME_MAX_SIZE (SENSOR_FRAME_SIZE + SENSOR_FRAME_TIMESTAMP_SIZE)
+
+struct SensorReading {
+  uint16_t lahanID;
+  float humidity;
+  float temperature;
+  float ec;
+  float ph;
+  float nitrogen;
+  float phosphorus;
+  float potassium;
+  float batteryVoltage;      // mV
+  float batteryPercentage;   // 0..100
+  float chargeCurrent;       // mA
+  float dischargeCurrent;    // mA
+  uint64_t capturedAt = 0;   // Unix ms, 0 if unknown
+};
+
+namespace sensor_frame {
+
+inline void putU16(uint8_t* p, uint16_t v) {
+  p[0] = (uint8_t)(v & 0xFF);
+  p[1] = (uint8_t)(v >> 8);
+}
+
+inline uint16_t getU16(const uint8_t* p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+inline int16_t toFixed(float v) {
+  float scaled = v * 100.0f + (v < 0 ? -0.5f : 0.5f);
+  if (scaled > 32767.0f) return 32767;
+  if (scaled < -32768.0f) return -32768;
+  return (int16_t)scaled;
+}
+
+inline uint16_t toU16(float v) {
+  if (v <= 0) return 0;
+  if (v >= 65535.0f) return 65535;
+  return (uint16_t)(v + 0.5f);
+}
+
+inline float fromFixed(const uint8_t* p) {
+  return (int16_t)getU16(p) / 100.0f;
+}
+
+inline void putU48(uint8_t* p, uint64_t v) {
+  for (size_t i = 0; i < 6; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+inline uint64_t getU48(const uint8_t* p) {
+  uint64_t v = 0;
+  for (size_t i = 0; i < 6; i++) v |= (uint64_t)p[i] << (8 * i);
+  return v;
+}
+
+}  // namespace sensor_frame
+
+inline bool isSensorFrame(const uint8_t* data, size_t len) {
+  return len > 0 && data[0] == SENSOR_FRAME_MAGIC;
+}
+
+// Returns the number of bytes written, or 0 if the buffer is too small.
+// The capture time is left out when it is unknown or does not fit.
+inline size_t encodeSensorFrame(const SensorReading& r, uint8_t* out, size_t capacity) {
+  using namespace sensor_frame;
+  if (capacity < SENSOR_FRAME_SIZE) return 0;
+
+  out[0] = SENSOR_FRAME_MAGIC;
+  out[1] = SENSOR_FRAME_VERSION;
+  putU16(out + 2, r.lahanID);
+  putU16(out + 4, (uint16_t)toFixed(r.humidity));
+  putU16(out + 6, (uint16_t)toFixed(r.temperature));
+  putU16(out + 8, (uint16_t)toFixed(r.ec));
+  putU16(out + 10, (uint16_t)toFixed(r.ph));
+  putU16(out + 12, (uint16_t)toFixed(r.nitrogen));
+  putU16(out + 14, (uint16_t)toFixed(r.phosphorus));
+  putU16(out + 16, (uint16_t)toFixed(r.potassium));
+  putU16(out + 18, toU16(r.batteryVoltage));
+  float pct = r.batteryPercentage < 0 ? 0 : (r.batteryPercentage > 100 ? 100 : r.batteryPercentage);
+  out[20] = (uint8_t)(pct + 0.5f);
+  putU16(out + 21, toU16(r.chargeCurrent));
+  putU16(out + 23, toU16(r.dischargeCurrent));
+  if (r.capturedAt != 0 && capacity >= SENSOR_FRAME_MAX_SIZE) {
+    putU48(out + SENSOR_FRAME_SIZE, r.capturedAt);
+    return SENSOR_FRAME_MAX_SIZE;
+  }
+  return SENSOR_FRAME_SIZE;
+}
+
+inline bool decodeSensorFrame(const uint8_t* data, size_t len, SensorReading& r) {
+  using namespace sensor_frame;
+  if (len < SENSOR_FRAME_SIZE || data[0] != SENSOR_FRAME_MAGIC || data[1] != SENSOR_FRAME_VERSION) {
+    return false;
+  }
+
+  r.lahanID = getU16(data + 2);
+  r.humidity = fromFixed(data + 4);
+  r.temperature = fromFixed(data + 6);
+  r.ec = fromFixed(data + 8);
+  r.ph = fromFixed(data + 10);
+  r.nitrogen = fromFixed(data + 12);
+  r.phosphorus = fromFixed(data + 14);
+  r.potassium = fromFixed(data + 16);
+  r.batteryVoltage = getU16(data + 18);
+  r.batteryPercentage = data[20];
+  r.chargeCurrent = getU16(data + 21);
+  r.dischargeCurrent = getU16(data + 23);
+  r.capturedAt = len >= SENSOR_FRAME_MAX_SIZE ? getU48(data + SENSOR_FRAME_SIZE) : 0;
+  return true;
+}
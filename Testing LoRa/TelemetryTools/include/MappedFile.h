@@ -0,0 +1,43 @@
+#pragma once
+
+// Read-only memory mapping of a whole file (POSIX), so large logs can be
+// scanned as one string_view without copying into line buffers.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <string_view>
+
+class MappedFile {
+public:
+  explicit MappedFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        _data = static_cast<const char*>(data);
+        _size = (size_t)st.st_size;
+        madvise(data, _size, MADV_SEQUENTIAL);
+      }
+    }
+    close(fd);
+  }
+
+  ~MappedFile() {
+    if (_data) munmap(const_cast<char*>(_data), _size);
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool isOpen() const { return _data != nullptr; }
+  std::string_view view() const { return std::string_view(_data, _size); }
+
+private:
+  const char* _data = nullptr;
+  size_t _size = 0;
+};
@@ -0,0 +1,518 @@
+#pragma once
+
+// Columnar archive for broker logs.
+//
+// Rows are stored in blocks of up to ARCHIVE_BLOCK_ROWS. Inside a block
+// every field is its own stream, so a query only decodes the columns it
+// asks for:
+//   id, run      delta, zigzag varint
+//   time         microseconds, delta-of-delta, zigzag varint
+//   topic        index into the file's topic dictionary, varint
+//   sensors      fixed point (see ARCHIVE_COLUMNS), delta, zigzag varint
+// A sensor column missing from some rows of a block is preceded by a
+// presence bitmap; one missing from all rows takes no space.
+//
+// The footer holds the topic dictionary and one index entry per block with
+// its time and lahanID range, so range scans skip blocks without touching
+// them. Layout:
+//   "TLA1" | block... | footer | u64 footer offset | "TLA1"
+//
+// The sensor columns follow the document built by sendSensorData() in the
+// MQTT transmitters. Other keys are counted and dropped.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "MappedFile.h"
+#include "TelemetryCsv.h"
+
+#define ARCHIVE_MAGIC "TLA1"
+#define ARCHIVE_BLOCK_ROWS 4096
+
+struct ArchiveColumn {
+  const char* key;
+  double scale;  // stored as round(value * scale)
+};
+
+enum {
+  COLUMN_LAHAN_ID,
+  COLUMN_HUMIDITY,
+  COLUMN_TEMPERATURE,
+  COLUMN_EC,
+  COLUMN_PH,
+  COLUMN_NITROGEN,
+  COLUMN_PHOSPHORUS,
+  COLUMN_POTASSIUM,
+  COLUMN_BATTERY_VOLTAGE,
+  COLUMN_BATTERY_CURRENT,
+  COLUMN_BATTERY_POWER,
+  COLUMN_BATTERY_CHARGE_CURRENT,
+  COLUMN_BATTERY_LEVEL,
+  COLUMN_AGE_MS,
+  ARCHIVE_COLUMN_COUNT
+};
+
+static const ArchiveColumn ARCHIVE_COLUMNS[ARCHIVE_COLUMN_COUNT] = {
+  {"lahanID", 1},
+  {"humidity", 100},
+  {"temperature", 100},
+  {"ec", 100},
+  {"ph", 100},
+  {"nitrogen", 100},
+  {"phosphorus", 100},
+  {"potassium", 100},
+  {"batteryVoltage", 10000},  // AXP192 steps are 1.1 mV
+  {"batteryCurrent", 100},
+  {"batteryPower", 100},
+  {"batteryChargeCurrent", 1},
+  {"batteryLevel", 1},
+  {"ageMs", 1},
+};
+
+#define ARCHIVE_ALL_COLUMNS ((1u << ARCHIVE_COLUMN_COUNT) - 1)
+
+struct ArchiveRecord {
+  uint64_t id;
+  uint32_t runId;
+  double unixTime;
+  std::string_view topic;
+  uint32_t present;  // bit per column
+  double values[ARCHIVE_COLUMN_COUNT];
+
+  bool has(size_t column) const { return present & (1u << column); }
+};
+
+struct ArchiveQuery {
+  double from = -INFINITY;  // unix time, inclusive
+  double to = INFINITY;     // exclusive
+  int64_t lahanID = -1;     // -1 for any
+  uint32_t columns = ARCHIVE_ALL_COLUMNS;  // columns to decode
+};
+
+namespace telemetry_archive {
+
+inline uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+inline int64_t unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+inline void putVarint(std::vector<uint8_t>& out, uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back((uint8_t)(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back((uint8_t)v);
+}
+
+inline void putFixed(std::vector<uint8_t>& out, uint64_t v, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) out.push_back((uint8_t)(v >> (8 * i)));
+}
+
+// Bounds-checked reader over a byte range; sets ok to false on overrun
+struct Cursor {
+  const uint8_t* p;
+  const uint8_t* end;
+  bool ok = true;
+
+  Cursor(const uint8_t* begin, const uint8_t* finish) : p(begin), end(finish) {}
+
+  uint64_t varint() {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (p >= end) break;
+      uint8_t b = *p++;
+      v |= (uint64_t)(b & 0x7F) << shift;
+      if (!(b & 0x80)) return v;
+    }
+    ok = false;
+    return 0;
+  }
+
+  uint64_t fixed(size_t bytes) {
+    if ((size_t)(end - p) < bytes) {
+      ok = false;
+      p = end;
+      return 0;
+    }
+    uint64_t v = 0;
+    for (size_t i = 0; i < bytes; i++) v |= (uint64_t)p[i] << (8 * i);
+    p += bytes;
+    return v;
+  }
+};
+
+// Streams per block: id, run, time, topic, then one per column
+enum { STREAM_ID, STREAM_RUN, STREAM_TIME, STREAM_TOPIC, STREAM_COLUMNS, STREAM_COUNT = STREAM_COLUMNS + ARCHIVE_COLUMN_COUNT };
+
+struct BlockIndex {
+  uint64_t offset;
+  uint32_t size;
+  uint32_t rows;
+  int64_t minTime, maxTime;  // us
+  int64_t minLahan, maxLahan;
+};
+
+}  // namespace telemetry_archive
+
+class TelemetryArchiveWriter {
+public:
+  explicit TelemetryArchiveWriter(const std::string& path) : _file(fopen(path.c_str(), "wb")) {
+    if (_file) write((const uint8_t*)ARCHIVE_MAGIC, 4);
+  }
+
+  ~TelemetryArchiveWriter() { close(); }
+
+  TelemetryArchiveWriter(const TelemetryArchiveWriter&) = delete;
+  TelemetryArchiveWriter& operator=(const TelemetryArchiveWriter&) = delete;
+
+  bool isOpen() const { return _file != nullptr; }
+
+  void add(const TelemetryRow& row) {
+    _ids.push_back((int64_t)row.id);
+    _runs.push_back(row.runId);
+    _times.push_back(llround(row.unixTime * 1e6));
+    _topics.push_back(topicIndex(row.topic));
+
+    uint32_t present = 0;
+    for (size_t c = 0; c < ARCHIVE_COLUMN_COUNT; c++) {
+      double value;
+      if (!jsonNumber(row.message, ARCHIVE_COLUMNS[c].key, value)) continue;
+      present |= 1u << c;
+      _values[c].push_back(llround(value * ARCHIVE_COLUMNS[c].scale));
+    }
+    _present.push_back(present);
+    _fieldsDropped += countFields(row.message) - __builtin_popcount(present);
+    rows++;
+
+    if (_ids.size() == ARCHIVE_BLOCK_ROWS) flushBlock();
+  }
+
+  // Writes the footer. Returns false if any write failed.
+  bool close() {
+    if (!_file) return _ok;
+    flushBlock();
+
+    using namespace telemetry_archive;
+    std::vector<uint8_t> footer;
+    putVarint(footer, _dictionary.size());
+    for (const std::string& topic : _dictionary) {
+      putVarint(footer, topic.size());
+      footer.insert(footer.end(), topic.begin(), topic.end());
+    }
+    putVarint(footer, _index.size());
+    for (const BlockIndex& b : _index) {
+      putFixed(footer, b.offset, 8);
+      putFixed(footer, b.size, 4);
+      putFixed(footer, b.rows, 4);
+      putFixed(footer, (uint64_t)b.minTime, 8);
+      putFixed(footer, (uint64_t)b.maxTime, 8);
+      putFixed(footer, (uint64_t)b.minLahan, 8);
+      putFixed(footer, (uint64_t)b.maxLahan, 8);
+    }
+    uint64_t footerOffset = _offset;
+    putFixed(footer, footerOffset, 8);
+    footer.insert(footer.end(), ARCHIVE_MAGIC, ARCHIVE_MAGIC + 4);
+    write(footer.data(), footer.size());
+
+    if (fclose(_file) != 0) _ok = false;
+    _file = nullptr;
+    return _ok;
+  }
+
+  uint64_t bytesWritten() const { return _offset; }
+  uint64_t fieldsDropped() const { return _fieldsDropped; }
+
+  uint64_t rows = 0;
+
+private:
+  uint32_t topicIndex(std::string_view topic) {
+    for (size_t i = 0; i < _dictionary.size(); i++) {
+      if (_dictionary[i] == topic) return (uint32_t)i;
+    }
+    _dictionary.emplace_back(topic);
+    return (uint32_t)(_dictionary.size() - 1);
+  }
+
+  // Number of top-level keys in a flat JSON object
+  static int countFields(std::string_view json) {
+    int fields = 0;
+    bool inString = false;
+    for (size_t i = 0; i < json.size(); i++) {
+      if (json[i] == '"') {
+        inString = !inString;
+      } else if (!inString && json[i] == ':') {
+        fields++;
+      }
+    }
+    return fields;
+  }
+
+  void flushBlock() {
+    using namespace telemetry_archive;
+    size_t count = _ids.size();
+    if (count == 0) return;
+
+    BlockIndex index = {};
+    index.offset = _offset;
+    index.rows = (uint32_t)count;
+    index.minTime = index.maxTime = _times[0];
+    index.minLahan = INT64_MAX;
+    index.maxLahan = INT64_MIN;
+
+    std::vector<uint8_t> streams[STREAM_COUNT];
+    int64_t previousTime = 0, previousDelta = 0;
+    for (size_t i = 0; i < count; i++) {
+      putVarint(streams[STREAM_ID], zigzag(_ids[i] - (i ? _ids[i - 1] : 0)));
+      putVarint(streams[STREAM_RUN], zigzag(_runs[i] - (i ? _runs[i - 1] : 0)));
+      int64_t delta = _times[i] - previousTime;
+      putVarint(streams[STREAM_TIME], zigzag(i < 2 ? delta : delta - previousDelta));
+      previousDelta = i ? delta : 0;
+      previousTime = _times[i];
+      putVarint(streams[STREAM_TOPIC], _topics[i]);
+      if (_times[i] < index.minTime) index.minTime = _times[i];
+      if (_times[i] > index.maxTime) index.maxTime = _times[i];
+    }
+
+    for (size_t c = 0; c < ARCHIVE_COLUMN_COUNT; c++) {
+      std::vector<uint8_t>& out = streams[STREAM_COLUMNS + c];
+      const std::vector<int64_t>& values = _values[c];
+      if (values.empty()) continue;
+
+      bool complete = values.size() == count;
+      out.push_back(complete ? 1 : 0);
+      if (!complete) {
+        size_t start = out.size();
+        out.resize(start + (count + 7) / 8);
+        for (size_t i = 0; i < count; i++) {
+          if (_present[i] & (1u << c)) out[start + i / 8] |= (uint8_t)(1 << (i % 8));
+        }
+      }
+      int64_t previous = 0;
+      for (int64_t v : values) {
+        putVarint(out, zigzag(v - previous));
+        previous = v;
+      }
+      if (c == COLUMN_LAHAN_ID) {
+        for (int64_t v : values) {
+          if (v < index.minLahan) index.minLahan = v;
+          if (v > index.maxLahan) index.maxLahan = v;
+        }
+      }
+    }
+
+    std::vector<uint8_t> block;
+    putFixed(block, count, 4);
+    for (size_t s = 0; s < STREAM_COUNT; s++) putFixed(block, streams[s].size(), 4);
+    for (size_t s = 0; s < STREAM_COUNT; s++) block.insert(block.end(), streams[s].begin(), streams[s].end());
+    index.size = (uint32_t)block.size();
+    write(block.data(), block.size());
+    _index.push_back(index);
+
+    _ids.clear();
+    _runs.clear();
+    _times.clear();
+    _topics.clear();
+    _present.clear();
+    for (size_t c = 0; c < ARCHIVE_COLUMN_COUNT; c++) _values[c].clear();
+  }
+
+  void write(const uint8_t* data, size_t len) {
+    if (fwrite(data, 1, len, _file) != len) _ok = false;
+    _offset += len;
+  }
+
+  FILE* _file;
+  bool _ok = true;
+  uint64_t _offset = 0;
+  uint64_t _fieldsDropped = 0;
+  std::vector<std::string> _dictionary;
+  std::vector<telemetry_archive::BlockIndex> _index;
+
+  std::vector<int64_t> _ids, _runs, _times;
+  std::vector<uint32_t> _topics, _present;
+  std::vector<int64_t> _values[ARCHIVE_COLUMN_COUNT];
+};
+
+class TelemetryArchiveReader {
+public:
+  explicit TelemetryArchiveReader(const std::string& path) : _file(path) {
+    if (_file.isOpen()) _valid = readFooter();
+  }
+
+  bool isOpen() const { return _valid; }
+  size_t blockCount() const { return _index.size(); }
+
+  uint64_t rowCount() const {
+    uint64_t n = 0;
+    for (const auto& b : _index) n += b.rows;
+    return n;
+  }
+
+  // Calls fn(const ArchiveRecord&) for every row in the query range, in file
+  // order. Returns the number of matching rows, or -1 on a corrupt block.
+  // Values of columns outside query.columns are left unset.
+  template <typename Fn>
+  int64_t scan(const ArchiveQuery& query, Fn fn) {
+    int64_t from = isinf(query.from) ? INT64_MIN : llround(query.from * 1e6);
+    int64_t to = isinf(query.to) ? INT64_MAX : llround(query.to * 1e6);
+    int64_t matched = 0;
+    blocksRead = 0;
+
+    for (const auto& b : _index) {
+      if (b.maxTime < from || b.minTime >= to) continue;
+      if (query.lahanID >= 0 && (query.lahanID < b.minLahan || query.lahanID > b.maxLahan)) continue;
+      int64_t n = scanBlock(b, from, to, query, fn);
+      if (n < 0) return -1;
+      matched += n;
+      blocksRead++;
+    }
+    return matched;
+  }
+
+  size_t blocksRead = 0;  // by the last scan
+
+private:
+  bool readFooter() {
+    using namespace telemetry_archive;
+    std::string_view data = _file.view();
+    if (data.size() < 16 || data.substr(0, 4) != ARCHIVE_MAGIC || data.substr(data.size() - 4) != ARCHIVE_MAGIC) {
+      return false;
+    }
+    const uint8_t* base = (const uint8_t*)data.data();
+    Cursor tail(base + data.size() - 12, base + data.size() - 4);
+    uint64_t footerOffset = tail.fixed(8);
+    if (footerOffset < 4 || footerOffset > data.size() - 12) return false;
+
+    Cursor c(base + footerOffset, base + data.size() - 12);
+    uint64_t topics = c.varint();
+    for (uint64_t i = 0; i < topics && c.ok; i++) {
+      uint64_t len = c.varint();
+      if (len > (uint64_t)(c.end - c.p)) return false;
+      _dictionary.emplace_back((const char*)c.p, len);
+      c.p += len;
+    }
+    uint64_t blocks = c.varint();
+    for (uint64_t i = 0; i < blocks && c.ok; i++) {
+      BlockIndex b;
+      b.offset = c.fixed(8);
+      b.size = (uint32_t)c.fixed(4);
+      b.rows = (uint32_t)c.fixed(4);
+      b.minTime = (int64_t)c.fixed(8);
+      b.maxTime = (int64_t)c.fixed(8);
+      b.minLahan = (int64_t)c.fixed(8);
+      b.maxLahan = (int64_t)c.fixed(8);
+      if (b.offset < 4 || b.offset + b.size > footerOffset) return false;
+      _index.push_back(b);
+    }
+    return c.ok;
+  }
+
+  template <typename Fn>
+  int64_t scanBlock(const telemetry_archive::BlockIndex& b, int64_t from, int64_t to, const ArchiveQuery& query,
+                    Fn fn) {
+    using namespace telemetry_archive;
+    const uint8_t* base = (const uint8_t*)_file.view().data() + b.offset;
+    Cursor header(base, base + b.size);
+    size_t count = (size_t)header.fixed(4);
+    if (count != b.rows || count > ARCHIVE_BLOCK_ROWS) return -1;
+
+    const uint8_t* start[STREAM_COUNT];
+    const uint8_t* p = base + 4 + 4 * STREAM_COUNT;
+    for (size_t s = 0; s < STREAM_COUNT; s++) {
+      start[s] = p;
+      p += header.fixed(4);
+    }
+    if (!header.ok || p > base + b.size) return -1;
+    auto stream = [&](size_t s) { return Cursor(start[s], s + 1 < STREAM_COUNT ? start[s + 1] : p); };
+
+    // Time and lahanID decide which rows match; everything else is only
+    // decoded for blocks that have at least one
+    _times.resize(count);
+    Cursor times = stream(STREAM_TIME);
+    int64_t previousTime = 0, previousDelta = 0;
+    for (size_t i = 0; i < count; i++) {
+      int64_t v = unzigzag(times.varint());
+      int64_t delta = i < 2 ? v : previousDelta + v;
+      _times[i] = previousTime + delta;
+      previousDelta = i ? delta : 0;
+      previousTime = _times[i];
+    }
+    uint32_t columns = query.columns;
+    if (query.lahanID >= 0) columns |= 1u << COLUMN_LAHAN_ID;
+    for (size_t c = 0; c < ARCHIVE_COLUMN_COUNT; c++) {
+      _present[c].assign(count, false);
+      if (!(columns & (1u << c))) continue;
+      if (!decodeColumn(stream(STREAM_COLUMNS + c), count, c)) return -1;
+    }
+
+    _match.assign(count, false);
+    size_t matches = 0;
+    for (size_t i = 0; i < count; i++) {
+      if (_times[i] < from || _times[i] >= to) continue;
+      if (query.lahanID >= 0 && (!_present[COLUMN_LAHAN_ID][i] || _values[COLUMN_LAHAN_ID][i] != query.lahanID)) {
+        continue;
+      }
+      _match[i] = true;
+      matches++;
+    }
+    if (matches == 0) return 0;
+
+    Cursor ids = stream(STREAM_ID), runs = stream(STREAM_RUN), topics = stream(STREAM_TOPIC);
+    int64_t id = 0, run = 0;
+    ArchiveRecord record;
+    for (size_t i = 0; i < count; i++) {
+      id += unzigzag(ids.varint());
+      run += unzigzag(runs.varint());
+      uint64_t topic = topics.varint();
+      if (!_match[i]) continue;
+
+      record.id = (uint64_t)id;
+      record.runId = (uint32_t)run;
+      record.unixTime = _times[i] / 1e6;
+      record.topic = topic < _dictionary.size() ? std::string_view(_dictionary[topic]) : std::string_view();
+      record.present = 0;
+      for (size_t c = 0; c < ARCHIVE_COLUMN_COUNT; c++) {
+        if (!_present[c][i]) continue;
+        record.present |= 1u << c;
+        record.values[c] = _values[c][i] / ARCHIVE_COLUMNS[c].scale;
+      }
+      fn(record);
+    }
+    if (!ids.ok || !runs.ok || !topics.ok) return -1;
+    return (int64_t)matches;
+  }
+
+  bool decodeColumn(telemetry_archive::Cursor in, size_t count, size_t column) {
+    using namespace telemetry_archive;
+    _values[column].resize(count);
+    if (in.p == in.end) return true;  // not present in this block
+
+    bool complete = in.fixed(1) == 1;
+    const uint8_t* bitmap = in.p;
+    if (!complete) {
+      if ((size_t)(in.end - in.p) < (count + 7) / 8) return false;
+      in.p += (count + 7) / 8;
+    }
+    int64_t value = 0;
+    for (size_t i = 0; i < count; i++) {
+      if (!complete && !(bitmap[i / 8] & (1 << (i % 8)))) continue;
+      value += unzigzag(in.varint());
+      _values[column][i] = value;
+      _present[column][i] = true;
+    }
+    return in.ok;
+  }
+
+  MappedFile _file;
+  bool _valid = false;
+  std::vector<std::string> _dictionary;
+  std::vector<telemetry_archive::BlockIndex> _index;
+
+  // Per-block decode buffers, reused across blocks
+  std::vector<int64_t> _times;
+  std::vector<int64_t> _values[ARCHIVE_COLUMN_COUNT];
+  std::vector<bool> _present[ARCHIVE_COLUMN_COUNT];
+  std::vector<bool> _match;
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+// Reader for the broker logs (ID,RUN_ID,UNIX_TIME,TOPIC,MESSAGE), where
+// MESSAGE is a JSON document quoted CSV-style with doubled quotes.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+struct TelemetryRow {
+  uint64_t id = 0;
+  uint32_t runId = 0;
+  double unixTime = 0;
+  std::string_view topic;
+  std::string_view message;  // unescaped JSON, valid until the next parse
+};
+
+namespace telemetry_csv {
+
+// Returns the next comma-separated field and advances pos past the comma.
+inline std::string_view nextField(std::string_view line, size_t& pos) {
+  size_t end = line.find(',', pos);
+  if (end == std::string_view::npos) end = line.size();
+  std::string_view field = line.substr(pos, end - pos);
+  pos = end < line.size() ? end + 1 : end;
+  return field;
+}
+
+inline bool parseNumber(std::string_view field, double& out) {
+  char buf[32];
+  if (field.empty() || field.size() >= sizeof(buf)) return false;
+  field.copy(buf, field.size());
+  buf[field.size()] = '\0';
+  char* end;
+  out = strtod(buf, &end);
+  return end == buf + field.size();
+}
+
+}  // namespace telemetry_csv
+
+// Parses one data line. Unescaping the quoted MESSAGE needs a buffer; it is
+// written to scratch, which callers should reuse between rows so parsing
+// stays allocation-free once the buffer has grown to the longest message.
+inline bool parseTelemetryRow(std::string_view line, TelemetryRow& row, std::string& scratch) {
+  using namespace telemetry_csv;
+  if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+
+  size_t pos = 0;
+  double id, runId;
+  if (!parseNumber(nextField(line, pos), id)) return false;
+  if (!parseNumber(nextField(line, pos), runId)) return false;
+  if (!parseNumber(nextField(line, pos), row.unixTime)) return false;
+  row.id = (uint64_t)id;
+  row.runId = (uint32_t)runId;
+  row.topic = nextField(line, pos);
+
+  std::string_view rest = line.substr(pos);
+  if (rest.size() >= 2 && rest.front() == '"' && rest.back() == '"') {
+    rest = rest.substr(1, rest.size() - 2);
+    scratch.clear();
+    for (size_t i = 0; i < rest.size(); i++) {
+      scratch.push_back(rest[i]);
+      if (rest[i] == '"' && i + 1 < rest.size() && rest[i + 1] == '"') i++;
+    }
+    row.message = scratch;
+  } else {
+    row.message = rest;
+  }
+  return true;
+}
+
+// Looks up a top-level number in a flat JSON object such as the MQTT
+// payloads, without building a document. Returns false if the key is
+// missing or its value is not a number.
+inline bool jsonNumber(std::string_view json, std::string_view key, double& out) {
+  size_t pos = 0;
+  while ((pos = json.find(key, pos)) != std::string_view::npos) {
+    size_t end = pos + key.size();
+    bool quoted = pos > 0 && json[pos - 1] == '"' && end < json.size() && json[end] == '"';
+    pos = end;
+    if (!quoted) continue;
+
+    size_t colon = end + 1;
+    while (colon < json.size() && json[colon] == ' ') colon++;
+    if (colon >= json.size() || json[colon] != ':') continue;
+    size_t start = colon + 1;
+    while (start < json.size() && json[start] == ' ') start++;
+    size_t stop = start;
+    while (stop < json.size() && json[stop] != ',' && json[stop] != '}' && json[stop] != ' ') stop++;
+    return telemetry_csv::parseNumber(json.substr(start, stop - start), out);
+  }
+  return false;
+}
+
+class TelemetryCsvReader {
+public:
+  explicit TelemetryCsvReader(const std::string& path) : _in(path) {
+    std::getline(_in, _line);  // header
+  }
+
+  bool isOpen() const { return _in.is_open(); }
+
+  // Skips lines that do not parse.
+  bool next(TelemetryRow& row) {
+    while (std::getline(_in, _line)) {
+      if (parseTelemetryRow(_line, row, _scratch)) return true;
+    }
+    return false;
+  }
+
+private:
+  std::ifstream _in;
+  std::string _line;
+  std::string _scratch;
+};
@@ -0,0 +1,216 @@
+// Converts broker logs to the columnar archive (TelemetryArchive.h), runs
+// range queries on it, and benchmarks a query against re-parsing the CSV.
+//
+// usage: archive_tool convert log.csv out.tla
+//        archive_tool query archive.tla [-from unixTime] [-to unixTime] [-lahan id]
+//        archive_tool bench log.csv [iterations]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "TelemetryArchive.h"
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool convert(const char* csvPath, const char* archivePath) {
+  TelemetryCsvReader reader(csvPath);
+  if (!reader.isOpen()) {
+    fprintf(stderr, "Cannot open %s\n", csvPath);
+    return false;
+  }
+  TelemetryArchiveWriter writer(archivePath);
+  if (!writer.isOpen()) {
+    fprintf(stderr, "Cannot create %s\n", archivePath);
+    return false;
+  }
+
+  TelemetryRow row;
+  while (reader.next(row)) writer.add(row);
+  if (!writer.close()) {
+    fprintf(stderr, "Write to %s failed\n", archivePath);
+    return false;
+  }
+  printf("%llu rows -> %s, %llu bytes", (unsigned long long)writer.rows, archivePath,
+         (unsigned long long)writer.bytesWritten());
+  if (writer.fieldsDropped()) printf(", %llu fields outside the schema dropped", (unsigned long long)writer.fieldsDropped());
+  printf("\n");
+  return true;
+}
+
+static bool query(int argc, char** argv) {
+  ArchiveQuery q;
+  const char* path = nullptr;
+  for (int i = 0; i < argc; i++) {
+    if (strcmp(argv[i], "-from") == 0 && i + 1 < argc) {
+      q.from = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-to") == 0 && i + 1 < argc) {
+      q.to = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-lahan") == 0 && i + 1 < argc) {
+      q.lahanID = atoll(argv[++i]);
+    } else {
+      path = argv[i];
+    }
+  }
+  if (path == nullptr) return false;
+
+  TelemetryArchiveReader archive(path);
+  if (!archive.isOpen()) {
+    fprintf(stderr, "%s is not a telemetry archive\n", path);
+    return false;
+  }
+
+  printf("ID,RUN_ID,UNIX_TIME,TOPIC");
+  for (size_t c = 0; c < ARCHIVE_COLUMN_COUNT; c++) printf(",%s", ARCHIVE_COLUMNS[c].key);
+  printf("\n");
+  int64_t rows = archive.scan(q, [](const ArchiveRecord& r) {
+    printf("%llu,%u,%.6f,%.*s", (unsigned long long)r.id, r.runId, r.unixTime, (int)r.topic.size(), r.topic.data());
+    for (size_t c = 0; c < ARCHIVE_COLUMN_COUNT; c++) {
+      if (r.has(c)) {
+        printf(",%.*f", ARCHIVE_COLUMNS[c].scale >= 10000 ? 4 : ARCHIVE_COLUMNS[c].scale >= 100 ? 2 : 0, r.values[c]);
+      } else {
+        printf(",");
+      }
+    }
+    printf("\n");
+  });
+  if (rows < 0) {
+    fprintf(stderr, "%s is corrupt\n", path);
+    return false;
+  }
+  fprintf(stderr, "%lld rows from %zu of %zu blocks\n", (long long)rows, archive.blocksRead, archive.blockCount());
+  return true;
+}
+
+struct QueryResult {
+  uint64_t rows = 0;
+  double temperatureSum = 0;
+};
+
+// The benchmark query: mean temperature of one field over the middle half
+// of the log, done both ways
+static QueryResult csvQuery(const char* path, double from, double to, int64_t lahanID) {
+  QueryResult result;
+  TelemetryCsvReader reader(path);
+  TelemetryRow row;
+  while (reader.next(row)) {
+    if (row.unixTime < from || row.unixTime >= to) continue;
+    double lahan, temperature;
+    if (!jsonNumber(row.message, "lahanID", lahan) || (int64_t)lahan != lahanID) continue;
+    if (!jsonNumber(row.message, "temperature", temperature)) continue;
+    result.rows++;
+    result.temperatureSum += temperature;
+  }
+  return result;
+}
+
+static QueryResult archiveQuery(TelemetryArchiveReader& archive, double from, double to, int64_t lahanID) {
+  QueryResult result;
+  ArchiveQuery q;
+  q.from = from;
+  q.to = to;
+  q.lahanID = lahanID;
+  q.columns = 1u << COLUMN_TEMPERATURE;
+  archive.scan(q, [&](const ArchiveRecord& r) {
+    if (!r.has(COLUMN_TEMPERATURE)) return;
+    result.rows++;
+    result.temperatureSum += r.values[COLUMN_TEMPERATURE];
+  });
+  return result;
+}
+
+// Largest difference between the CSV and the archive over all columns
+static double roundTripError(const char* csvPath, TelemetryArchiveReader& archive, uint64_t& mismatches) {
+  std::vector<ArchiveRecord> records;
+  archive.scan(ArchiveQuery(), [&](const ArchiveRecord& r) { records.push_back(r); });
+
+  TelemetryCsvReader reader(csvPath);
+  TelemetryRow row;
+  size_t i = 0;
+  double maxError = 0;
+  mismatches = 0;
+  while (reader.next(row)) {
+    if (i >= records.size()) {
+      mismatches++;
+      continue;
+    }
+    const ArchiveRecord& r = records[i++];
+    if (r.id != row.id || r.runId != row.runId || r.topic != row.topic || fabs(r.unixTime - row.unixTime) > 1e-6) {
+      mismatches++;
+    }
+    for (size_t c = 0; c < ARCHIVE_COLUMN_COUNT; c++) {
+      double value;
+      bool inCsv = jsonNumber(row.message, ARCHIVE_COLUMNS[c].key, value);
+      if (inCsv != r.has(c)) {
+        mismatches++;
+      } else if (inCsv && fabs(value - r.values[c]) > maxError) {
+        maxError = fabs(value - r.values[c]);
+      }
+    }
+  }
+  mismatches += records.size() - i;
+  return maxError;
+}
+
+static bool bench(const char* csvPath, int iterations) {
+  std::string archivePath = std::string(csvPath) + ".tla";
+  if (!convert(csvPath, archivePath.c_str())) return false;
+  TelemetryArchiveReader archive(archivePath);
+  if (!archive.isOpen()) return false;
+
+  uint64_t mismatches;
+  double maxError = roundTripError(csvPath, archive, mismatches);
+  printf("round trip: %llu mismatches, max value error %g\n", (unsigned long long)mismatches, maxError);
+
+  // Query the middle half of the log for the first lahanID
+  double first = INFINITY, last = -INFINITY;
+  int64_t lahanID = -1;
+  archive.scan(ArchiveQuery(), [&](const ArchiveRecord& r) {
+    first = fmin(first, r.unixTime);
+    last = fmax(last, r.unixTime);
+    if (lahanID < 0 && r.has(COLUMN_LAHAN_ID)) lahanID = (int64_t)r.values[COLUMN_LAHAN_ID];
+  });
+  double from = first + (last - first) / 4, to = last - (last - first) / 4;
+
+  QueryResult csv, columnar;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) csv = csvQuery(csvPath, from, to, lahanID);
+  double csvSeconds = secondsSince(start) / iterations;
+
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) columnar = archiveQuery(archive, from, to, lahanID);
+  double archiveSeconds = secondsSince(start) / iterations;
+
+  MappedFile csvFile(csvPath);
+  MappedFile archiveFile(archivePath);
+  printf("size: csv %zu bytes, archive %zu bytes (%.1fx smaller)\n", csvFile.view().size(), archiveFile.view().size(),
+         (double)csvFile.view().size() / archiveFile.view().size());
+  printf("query lahanID %lld, middle half, mean temperature:\n", (long long)lahanID);
+  printf("  csv     %6llu rows  mean %.3f  %9.1f us\n", (unsigned long long)csv.rows,
+         csv.rows ? csv.temperatureSum / csv.rows : 0, csvSeconds * 1e6);
+  printf("  archive %6llu rows  mean %.3f  %9.1f us  (%.0fx faster)\n", (unsigned long long)columnar.rows,
+         columnar.rows ? columnar.temperatureSum / columnar.rows : 0, archiveSeconds * 1e6,
+         archiveSeconds > 0 ? csvSeconds / archiveSeconds : 0);
+  return mismatches == 0 && csv.rows == columnar.rows;
+}
+
+static int usage() {
+  fprintf(stderr,
+          "usage: archive_tool convert log.csv out.tla\n"
+          "       archive_tool query archive.tla [-from unixTime] [-to unixTime] [-lahan id]\n"
+          "       archive_tool bench log.csv [iterations]\n");
+  return 2;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) return usage();
+  if (strcmp(argv[1], "convert") == 0 && argc == 4) return convert(argv[2], argv[3]) ? 0 : 1;
+  if (strcmp(argv[1], "query") == 0) return query(argc - 2, argv + 2) ? 0 : 1;
+  if (strcmp(argv[1], "bench") == 0) return bench(argv[2], argc > 3 ? atoi(argv[3]) : 20) ? 0 : 1;
+  return usage();
+}
@@ -0,0 +1,116 @@
+// Drives BatchPublisher against a simulated broker (a stand-in for a local
+// Mosquitto) with configurable loss, round-trip time and an outage, and
+// compares batch sizes by messages sent, retries and acknowledgement latency.
+//
+// usage: batch_sim [loss 0..1] [rtt ms] [hours]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <deque>
+#include <random>
+#include <utility>
+#include <vector>
+#include "BatchPublisher.h"
+
+struct Sample {
+  unsigned long takenAt;
+};
+
+struct SimConfig {
+  double loss;                   // probability a publish or its echo is lost
+  unsigned long rtt;             // ms
+  unsigned long duration;        // ms
+  unsigned long sampleInterval;  // ms, same as TimeBasedMqtt sendInterval
+  unsigned long outageStart;     // broker unreachable in [start, end)
+  unsigned long outageEnd;
+};
+
+// Echo-based acknowledgement, as in TimeBasedMqtt batch mode
+class SimBroker {
+public:
+  SimBroker(const SimConfig& config) : _config(config), _rng(42) {}
+
+  bool reachable(unsigned long now) const {
+    return now < _config.outageStart || now >= _config.outageEnd;
+  }
+
+  bool publish(uint16_t id, unsigned long now) {
+    if (!reachable(now)) return false;
+    publishes++;
+    if (_uniform(_rng) < _config.loss) return true;  // lost on the way
+    unsigned long jitter = (unsigned long)(_uniform(_rng) * _config.rtt / 2);
+    _echoes.push_back({now + _config.rtt + jitter, id});
+    return true;
+  }
+
+  template <typename AckFn>
+  void deliver(unsigned long now, AckFn ack) {
+    for (size_t i = 0; i < _echoes.size();) {
+      if (_echoes[i].first <= now) {
+        ack(_echoes[i].second);
+        _echoes[i] = _echoes.back();
+        _echoes.pop_back();
+      } else {
+        i++;
+      }
+    }
+  }
+
+  unsigned long publishes = 0;
+
+private:
+  const SimConfig& _config;
+  std::mt19937 _rng;
+  std::uniform_real_distribution<double> _uniform{0.0, 1.0};
+  std::vector<std::pair<unsigned long, uint16_t>> _echoes;
+};
+
+template <size_t BATCH, size_t WINDOW>
+void run(const SimConfig& config) {
+  const unsigned long STEP = 100;
+  BatchPublisher<Sample, BATCH, WINDOW> batcher(BATCH == 1 ? 0 : 600000, 15000, 5);
+  SimBroker broker(config);
+  std::deque<Sample> backlog;
+  unsigned long backlogMax = 0;
+
+  for (unsigned long now = 0; now < config.duration; now += STEP) {
+    if (now % config.sampleInterval == 0) backlog.push_back({now});
+    while (!backlog.empty() && batcher.add(backlog.front(), now)) backlog.pop_front();
+    if (backlog.size() > backlogMax) backlogMax = backlog.size();
+
+    if (broker.reachable(now)) {
+      batcher.service(now, [&](const typename decltype(batcher)::Batch& b) {
+        return broker.publish(b.id, now);
+      });
+    }
+    broker.deliver(now, [&](uint16_t id) { batcher.acknowledge(id, now); });
+  }
+
+  const auto& s = batcher.stats();
+  double hours = config.duration / 3600000.0;
+  printf("%5zu %6zu %9lu %9lu %8lu %8lu %9lu %10lu %10lu %9lu %8.1f\n",
+         BATCH, WINDOW, s.readingsQueued, s.readingsAcked, broker.publishes, s.retries,
+         s.batchesDropped, batcher.averageAckLatency(), s.maxAckLatency, backlogMax,
+         s.readingsAcked / hours);
+}
+
+int main(int argc, char** argv) {
+  SimConfig config;
+  config.loss = argc > 1 ? atof(argv[1]) : 0.05;
+  config.rtt = argc > 2 ? strtoul(argv[2], nullptr, 10) : 150;
+  config.duration = (unsigned long)((argc > 3 ? atof(argv[3]) : 24.0) * 3600000.0);
+  config.sampleInterval = 120000;
+  config.outageStart = config.duration / 3;
+  config.outageEnd = config.outageStart + 30 * 60000;
+
+  printf("loss %.2f, rtt %lu ms, %.1f h, 30 min broker outage\n\n",
+         config.loss, config.rtt, config.duration / 3600000.0);
+  printf("%5s %6s %9s %9s %8s %8s %9s %10s %10s %9s %8s\n", "batch", "window", "queued",
+         "acked", "msgs", "retries", "dropped", "avg ack ms", "max ack ms", "backlog", "rdg/h");
+  run<1, 4>(config);
+  run<4, 4>(config);
+  run<8, 4>(config);
+  run<8, 1>(config);
+  run<16, 2>(config);
+  return 0;
+}
@@ -0,0 +1,285 @@
+// Discrete-event model of many LoRa transmitters sharing one LoRaGateaway,
+// swept over node count, spreading factor, payload and schedule.
+//
+// Transmitters follow the firmware schedules: TimeBasedLora sends every
+// SEND_INTERVAL, EventBasedLora samples every sendInterval and sends when the
+// change detector fires (modelled as a probability) or the heartbeat is due.
+// Each node has a random phase and crystal drift, so fixed-period nodes do
+// not all collide forever, and a random distance that sets its RSSI.
+//
+// The gateway is a single SX1276 on one SF, as in EventBasedReceiver.cpp:
+// - it locks onto the first packet above sensitivity while idle
+// - a packet that overlaps the locked one corrupts it unless the locked one
+//   is CAPTURE_DB stronger (pure ALOHA with -nocapture: any overlap does)
+// - packets arriving while it is locked or forwarding are lost
+// - after each delivered packet it is deaf for -busy ms (the blocking HTTP
+//   upload in parseAndSendData())
+//
+// usage: capacity_sim [-hours h] [-runs n] [-j threads] [-busy ms] [-radius m]
+//                     [-event p] [-nocapture]
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <queue>
+#include <random>
+#include <thread>
+#include <vector>
+#include "LoRaAirtime.h"
+#include "SensorFrame.h"
+
+#define TIME_BASED_INTERVAL 120.0   // s, SEND_INTERVAL in TimeBasedLora
+#define EVENT_SAMPLE_INTERVAL 18.0  // s, sendInterval in EventBasedLora
+#define EVENT_HEARTBEAT 900.0       // s, MAX_SILENT_INTERVAL in EventBasedLora
+#define JSON_PAYLOAD 190            // bytes, typical JSON uplink
+#define CAPTURE_DB 6.0
+#define TX_POWER_DBM 17.0           // LoRa.begin() default
+#define DRIFT_PPM 20.0
+#define LOOP_JITTER 0.02            // s
+
+enum Schedule { SCHEDULE_TIME, SCHEDULE_EVENT };
+
+struct SimConfig {
+  Schedule schedule;
+  uint8_t spreadingFactor;
+  size_t payload;
+  size_t nodes;
+  double duration;        // s
+  double radius;          // m
+  double eventProbability;
+  double gatewayBusy;     // s
+  bool capture;
+  unsigned seed;
+};
+
+struct SimResult {
+  uint64_t sent = 0;
+  uint64_t delivered = 0;
+  uint64_t lostCollision = 0;
+  uint64_t lostSensitivity = 0;
+  uint64_t lostBusy = 0;    // gateway locked on another packet or forwarding
+  double airtime = 0;       // s, sum over all packets
+  double gatewayLocked = 0; // s, time spent receiving
+
+  void merge(const SimResult& o) {
+    sent += o.sent;
+    delivered += o.delivered;
+    lostCollision += o.lostCollision;
+    lostSensitivity += o.lostSensitivity;
+    lostBusy += o.lostBusy;
+    airtime += o.airtime;
+    gatewayLocked += o.gatewayLocked;
+  }
+};
+
+// SX1276 sensitivity at 125 kHz (datasheet table 13), SF7..SF12
+static double sensitivityDbm(uint8_t sf) {
+  static const double TABLE[] = {-123, -126, -129, -132, -133, -136};
+  return sf >= 7 && sf <= 12 ? TABLE[sf - 7] : -123;
+}
+
+// Log-distance path loss at 915 MHz: free space to 1 m, exponent 2.7 beyond
+static double pathLossDb(double meters) {
+  return 31.7 + 27.0 * log10(meters < 1 ? 1 : meters);
+}
+
+struct Node {
+  double rssi;
+  double period;      // s, with drift applied
+  double lastSent;
+  double nextSample;
+};
+
+struct Event {
+  double time;
+  int kind;           // 0 packet end, 1 node wakes up; ends sort first
+  uint32_t id;        // packet or node
+
+  bool operator>(const Event& o) const { return time != o.time ? time > o.time : kind > o.kind; }
+};
+
+struct Packet {
+  uint32_t node;
+  double end;
+  double rssi;
+  bool corrupted;
+};
+
+static SimResult simulate(const SimConfig& config) {
+  std::mt19937_64 rng(config.seed);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  std::normal_distribution<double> shadowing(0.0, 4.0);
+
+  LoRaModulation modulation = LORA_DEFAULT_MODULATION;
+  modulation.spreadingFactor = config.spreadingFactor;
+  double airtime = loraAirtimeMicros(modulation, config.payload) / 1e6;
+  double sensitivity = sensitivityDbm(config.spreadingFactor);
+  double basePeriod = config.schedule == SCHEDULE_TIME ? TIME_BASED_INTERVAL : EVENT_SAMPLE_INTERVAL;
+
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+  std::vector<Node> nodes(config.nodes);
+  for (uint32_t i = 0; i < config.nodes; i++) {
+    Node& n = nodes[i];
+    double distance = config.radius * sqrt(uniform(rng));  // uniform over the disc
+    n.rssi = TX_POWER_DBM - pathLossDb(distance) + shadowing(rng);
+    n.period = basePeriod * (1.0 + (uniform(rng) * 2 - 1) * DRIFT_PPM * 1e-6);
+    n.lastSent = -INFINITY;
+    n.nextSample = uniform(rng) * basePeriod;
+    events.push({n.nextSample, 1, i});
+  }
+
+  SimResult result;
+  std::vector<Packet> packets;
+  std::vector<uint32_t> onAir;  // packets currently transmitting
+  int64_t locked = -1;
+  double deafUntil = 0;
+
+  while (!events.empty()) {
+    Event e = events.top();
+    events.pop();
+    if (e.time >= config.duration) break;
+
+    if (e.kind == 0) {
+      Packet& p = packets[e.id];
+      onAir.erase(std::find(onAir.begin(), onAir.end(), e.id));
+      if ((int64_t)e.id != locked) continue;
+      locked = -1;
+      if (p.corrupted) {
+        result.lostCollision++;
+      } else {
+        result.delivered++;
+        deafUntil = e.time + config.gatewayBusy;
+      }
+      continue;
+    }
+
+    // A node wakes up: sample, maybe transmit, and schedule the next sample
+    Node& n = nodes[e.id];
+    double now = e.time;
+    n.nextSample += n.period;
+    events.push({n.nextSample + uniform(rng) * LOOP_JITTER, 1, e.id});
+
+    bool send = config.schedule == SCHEDULE_TIME || uniform(rng) < config.eventProbability ||
+                now - n.lastSent >= EVENT_HEARTBEAT;
+    if (!send) continue;
+    n.lastSent = now;
+
+    uint32_t id = (uint32_t)packets.size();
+    packets.push_back({e.id, now + airtime, n.rssi, false});
+    Packet& p = packets.back();
+    result.sent++;
+    result.airtime += airtime;
+
+    // Interference with everything already on the air
+    for (uint32_t other : onAir) {
+      Packet& q = packets[other];
+      if (!config.capture || p.rssi > q.rssi - CAPTURE_DB) q.corrupted = true;
+      if (!config.capture || q.rssi > p.rssi - CAPTURE_DB) p.corrupted = true;
+    }
+    onAir.push_back(id);
+    events.push({p.end, 0, id});
+
+    if (p.rssi < sensitivity) {
+      result.lostSensitivity++;
+    } else if (locked >= 0 || now < deafUntil) {
+      result.lostBusy++;
+    } else {
+      locked = id;
+      result.gatewayLocked += airtime;
+    }
+  }
+  return result;
+}
+
+static const char* scheduleName(Schedule s) { return s == SCHEDULE_TIME ? "time" : "event"; }
+
+int main(int argc, char** argv) {
+  double hours = 6;
+  int runs = 4;
+  size_t threads = std::thread::hardware_concurrency();
+  double busyMs = 0, radius = 2000, eventProbability = 0.25;
+  bool capture = true;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-hours") == 0 && i + 1 < argc) hours = atof(argv[++i]);
+    else if (strcmp(argv[i], "-runs") == 0 && i + 1 < argc) runs = std::max(1, atoi(argv[++i]));
+    else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) threads = (size_t)std::max(1, atoi(argv[++i]));
+    else if (strcmp(argv[i], "-busy") == 0 && i + 1 < argc) busyMs = atof(argv[++i]);
+    else if (strcmp(argv[i], "-radius") == 0 && i + 1 < argc) radius = atof(argv[++i]);
+    else if (strcmp(argv[i], "-event") == 0 && i + 1 < argc) eventProbability = atof(argv[++i]);
+    else if (strcmp(argv[i], "-nocapture") == 0) capture = false;
+    else {
+      fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 2;
+    }
+  }
+  if (threads == 0) threads = 1;
+
+  // The sweep: every combination, each repeated runs times with its own seed
+  static const Schedule SCHEDULES[] = {SCHEDULE_TIME, SCHEDULE_EVENT};
+  static const uint8_t SPREADING_FACTORS[] = {7, 10, 12};
+  static const size_t PAYLOADS[] = {JSON_PAYLOAD, SENSOR_FRAME_SIZE};
+  static const size_t NODE_COUNTS[] = {1, 10, 50, 100, 200, 500, 1000};
+
+  std::vector<SimConfig> configs;
+  for (Schedule schedule : SCHEDULES) {
+    for (uint8_t sf : SPREADING_FACTORS) {
+      for (size_t payload : PAYLOADS) {
+        for (size_t count : NODE_COUNTS) {
+          SimConfig c;
+          c.schedule = schedule;
+          c.spreadingFactor = sf;
+          c.payload = payload;
+          c.nodes = count;
+          c.duration = hours * 3600;
+          c.radius = radius;
+          c.eventProbability = eventProbability;
+          c.gatewayBusy = busyMs / 1000;
+          c.capture = capture;
+          configs.push_back(c);
+        }
+      }
+    }
+  }
+
+  std::vector<SimResult> results(configs.size() * runs);
+  std::atomic<size_t> nextJob(0);
+  auto worker = [&]() {
+    for (size_t job; (job = nextJob++) < results.size();) {
+      SimConfig c = configs[job / runs];
+      c.seed = (unsigned)(job * 2654435761u + 1);
+      results[job] = simulate(c);
+    }
+  };
+  std::vector<std::thread> pool;
+  for (size_t i = 1; i < threads; i++) pool.emplace_back(worker);
+  worker();
+  for (std::thread& t : pool) t.join();
+
+  printf("%.1f h x %d runs, radius %.0f m, event send probability %.2f, gateway busy %.0f ms, %s, %zu threads\n\n",
+         hours, runs, radius, eventProbability, busyMs, capture ? "capture 6 dB" : "pure ALOHA", threads);
+  printf("%-6s %3s %5s %6s %10s %8s %10s %9s %9s %8s %8s %9s\n", "sched", "SF", "bytes", "nodes", "sent/h",
+         "load G", "delivered", "collided", "too weak", "gw busy", "gw util", "ALOHA e^-2G");
+
+  for (size_t c = 0; c < configs.size(); c++) {
+    SimResult total;
+    for (int r = 0; r < runs; r++) total.merge(results[c * runs + r]);
+    const SimConfig& config = configs[c];
+    double span = config.duration * runs;
+    double load = total.airtime / span;
+    auto pct = [&](uint64_t n) { return total.sent ? 100.0 * n / total.sent : 0.0; };
+    printf("%-6s %3u %5zu %6zu %10.0f %8.3f %9.1f%% %8.1f%% %8.1f%% %7.1f%% %7.1f%% %10.1f%%\n",
+           scheduleName(config.schedule), config.spreadingFactor, config.payload, config.nodes,
+           total.sent / (hours * runs), load, pct(total.delivered), pct(total.lostCollision),
+           pct(total.lostSensitivity), pct(total.lostBusy), 100.0 * total.gatewayLocked / span,
+           100.0 * exp(-2 * load));
+    if (c % (sizeof(NODE_COUNTS) / sizeof(NODE_COUNTS[0])) == sizeof(NODE_COUNTS) / sizeof(NODE_COUNTS[0]) - 1) {
+      printf("\n");
+    }
+  }
+  return 0;
+}
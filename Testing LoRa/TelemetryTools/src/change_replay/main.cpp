@@ -0,0 +1,117 @@
+// Replays broker logs through SensorFilter and ChangeDetector with the
+// event-based firmware settings and reports how many readings would have
+// been suppressed, and how far the receiver's last value drifts from the
+// logged reading.
+//
+// usage: change_replay [-t tempBand] [-u humidityBand] [-b heartbeatMinutes]
+//                      [-m medianWindow] [-s smoothing] [-p snapFactor] log.csv...
+//
+// -m 1 -s 0 turns the filters off; -p scales both channels' snap.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ChangeDetector.h"
+#include "SensorFilter.h"
+#include "TelemetryCsv.h"
+
+enum { FIELD_TEMPERATURE, FIELD_HUMIDITY, FIELD_COUNT };
+static const char* FIELD_NAMES[FIELD_COUNT] = {"temperature", "humidity"};
+
+// Mirrors DEADBANDS in EventBasedMqtt/EventBasedHttp
+static DeadbandConfig deadbands[FIELD_COUNT] = {
+  {0.8, 0.0, 0.10, 0.25},
+  {2.0, 0.0, 0.10, 0.25},
+};
+static unsigned long maxSilentInterval = 900000;
+
+// Mirrors FILTERS in EventBasedMqtt/EventBasedHttp
+static FilterConfig filters[FIELD_COUNT] = {
+  {2000, 100, 3, 2, 0.4},
+  {2000, 100, 3, 2, 1.0},
+};
+
+static void replay(const char* path) {
+  TelemetryCsvReader reader(path);
+  if (!reader.isOpen()) {
+    fprintf(stderr, "Cannot open %s\n", path);
+    return;
+  }
+
+  ChangeDetector<FIELD_COUNT> detector(deadbands, maxSilentInterval);
+  SensorPipeline<FIELD_COUNT> pipeline(filters);
+  TelemetryRow row;
+  double startTime = -1;
+  double maxError[FIELD_COUNT] = {};
+  double sumError[FIELD_COUNT] = {};
+  unsigned long skipped = 0;
+
+  while (reader.next(row)) {
+    double t, h;
+    if (!jsonNumber(row.message, "temperature", t) || !jsonNumber(row.message, "humidity", h)) {
+      skipped++;
+      continue;
+    }
+    if (startTime < 0) startTime = row.unixTime;
+    unsigned long now = (unsigned long)((row.unixTime - startTime) * 1000.0);
+
+    float raw[FIELD_COUNT] = {(float)t, (float)h};
+    float values[FIELD_COUNT];
+    for (size_t i = 0; i < FIELD_COUNT; i++) pipeline.add(i, raw[i], now);
+    pipeline.values(values);
+    if (detector.evaluate(values, now) != CHANGE_NONE) {
+      detector.commit(values, now);
+    }
+
+    // What the receiver holds now versus the logged reading
+    for (size_t i = 0; i < FIELD_COUNT; i++) {
+      double error = fabs(raw[i] - detector.reference(i));
+      sumError[i] += error;
+      if (error > maxError[i]) maxError[i] = error;
+    }
+  }
+
+  const auto& stats = detector.stats();
+  printf("%s\n", path);
+  printf("  samples %lu, sent %lu, suppressed %.1f%%", stats.samples, stats.sends,
+         detector.suppressionRatio() * 100);
+  if (skipped) printf(", %lu rows without temperature/humidity", skipped);
+  printf("\n  triggers: deadband %lu, rate %lu, heartbeat %lu\n",
+         stats.deadbandTriggers, stats.rateTriggers, stats.heartbeats);
+  printf("  filter snaps %lu\n", pipeline.stats().snaps);
+  for (size_t i = 0; i < FIELD_COUNT; i++) {
+    printf("  %-12s fired %5lu  error avg %.2f max %.2f\n", FIELD_NAMES[i], stats.fieldTriggers[i],
+           stats.samples ? sumError[i] / stats.samples : 0, maxError[i]);
+  }
+}
+
+int main(int argc, char** argv) {
+  int files = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      deadbands[FIELD_TEMPERATURE].absolute = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+      deadbands[FIELD_HUMIDITY].absolute = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+      maxSilentInterval = (unsigned long)(atof(argv[++i]) * 60000.0);
+    } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+      uint8_t window = (uint8_t)atoi(argv[++i]);
+      for (size_t f = 0; f < FIELD_COUNT; f++) filters[f].window = window;
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      uint8_t smoothing = (uint8_t)atoi(argv[++i]);
+      for (size_t f = 0; f < FIELD_COUNT; f++) filters[f].smoothing = smoothing;
+    } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      float factor = atof(argv[++i]);
+      for (size_t f = 0; f < FIELD_COUNT; f++) filters[f].snap *= factor;
+    } else {
+      replay(argv[i]);
+      files++;
+    }
+  }
+  if (files == 0) {
+    replay("../EventBasedMqtt/EventBasedMqtt.csv");
+    replay("../TimeBasedMqtt/TimeBasedMqtt.csv");
+  }
+  return 0;
+}
@@ -0,0 +1,172 @@
+// Cost and benefit of the Reed-Solomon FEC in ReedSolomon.h over a
+// simulated bit-error channel.
+//
+// For each payload size, parity setting and channel error rate the bench
+// encodes random payloads, corrupts the frame on air and decodes it, and
+// reports:
+// - delivery without FEC (a packet survives only with zero bit errors)
+//   and with FEC (decoded back to the original payload)
+// - recovered loss: the share of packets lost without FEC that FEC saved
+// - caught: decodes that landed on the wrong codeword and were rejected
+//   by the CRC inside it
+// - miscorrections: wrong payloads that got past the CRC too, which the
+//   gateway would forward
+// - on-air size and airtime at the given SF, and encode/decode time
+//
+// The channel flips independent bits at the given BER, or with -burst n,
+// runs of n bits starting at that rate, closer to a damaged LoRa symbol
+// (SF bits).
+//
+// usage: fec_bench [-n packets] [-sf sf] [-burst bits] [-seed s]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "LoRaAirtime.h"
+#include "ReedSolomon.h"
+#include "SensorFrame.h"
+
+#define JSON_PAYLOAD 190  // bytes, typical JSON uplink
+
+struct BenchResult {
+  uint64_t packets = 0;
+  uint64_t cleanPackets = 0;    // No bit errors on air
+  uint64_t decoded = 0;         // Decoded back to the original payload
+  uint64_t caught = 0;          // Miscorrected, rejected by the CRC
+  uint64_t miscorrected = 0;
+  uint64_t recovered = 0;       // Damaged on air but decoded correctly
+  double encodeNanos = 0;
+  double decodeNanos = 0;
+};
+
+class Channel {
+public:
+  Channel(double ber, size_t burst, uint64_t seed) : _burst(burst), _rng(seed), _gap(ber) {}
+
+  // Corrupts data in place; returns the number of flipped bits
+  size_t corrupt(uint8_t* data, size_t len) {
+    size_t bits = len * 8;
+    size_t flipped = 0;
+    size_t bit = _gap(_rng);
+    while (bit < bits) {
+      for (size_t i = 0; i < _burst && bit < bits; i++, bit++) {
+        // Inside a burst each bit is random, so about half actually flip
+        if (_burst == 1 || (_rng() & 1)) {
+          data[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+          flipped++;
+        }
+      }
+      bit += _gap(_rng);
+    }
+    return flipped;
+  }
+
+private:
+  size_t _burst;
+  std::mt19937_64 _rng;
+  std::geometric_distribution<size_t> _gap;
+};
+
+static BenchResult run(size_t payloadLen, uint8_t parity, double ber, size_t burst, size_t packets,
+                       uint64_t seed) {
+  BenchResult r;
+  ReedSolomon rs(parity ? parity : 2);
+  Channel channel(ber, burst, seed);
+  std::mt19937_64 rng(seed ^ 0x9e3779b97f4a7c15ULL);
+
+  uint8_t payload[RS_MAX_CODEWORD];
+  uint8_t frame[FEC_HEADER_SIZE + RS_MAX_CODEWORD];
+  for (size_t p = 0; p < packets; p++) {
+    for (size_t i = 0; i < payloadLen; i++) payload[i] = (uint8_t)rng();
+
+    size_t frameLen = payloadLen;
+    auto t0 = std::chrono::steady_clock::now();
+    if (parity) {
+      frameLen = encodeFecFrame(rs, payload, payloadLen, frame, sizeof(frame));
+    } else {
+      memcpy(frame, payload, payloadLen);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    size_t flipped = channel.corrupt(frame, frameLen);
+    r.packets++;
+    if (flipped == 0) r.cleanPackets++;
+
+    bool ok;
+    auto t2 = std::chrono::steady_clock::now();
+    if (parity) {
+      uint8_t* decoded;
+      size_t decodedLen;
+      int corrected = decodeFecFrame(frame, frameLen, decoded, decodedLen);
+      if (corrected == FEC_BAD_CHECK) r.caught++;
+      ok = corrected >= 0;
+      if (ok && (decodedLen != payloadLen || memcmp(decoded, payload, payloadLen) != 0)) {
+        r.miscorrected++;
+        ok = false;
+      }
+    } else {
+      ok = flipped == 0;
+    }
+    auto t3 = std::chrono::steady_clock::now();
+
+    if (ok) r.decoded++;
+    if (ok && flipped > 0) r.recovered++;
+    r.encodeNanos += std::chrono::duration<double, std::nano>(t1 - t0).count();
+    r.decodeNanos += std::chrono::duration<double, std::nano>(t3 - t2).count();
+  }
+  return r;
+}
+
+int main(int argc, char** argv) {
+  size_t packets = 20000;
+  size_t burst = 1;
+  uint8_t spreadingFactor = 7;
+  uint64_t seed = 1;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) packets = (size_t)atol(argv[++i]);
+    else if (strcmp(argv[i], "-sf") == 0 && i + 1 < argc) spreadingFactor = (uint8_t)atoi(argv[++i]);
+    else if (strcmp(argv[i], "-burst") == 0 && i + 1 < argc) burst = (size_t)atoi(argv[++i]);
+    else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) seed = strtoull(argv[++i], nullptr, 10);
+    else {
+      fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 2;
+    }
+  }
+  if (burst == 0) burst = 1;
+
+  static const size_t PAYLOADS[] = {SENSOR_FRAME_SIZE, JSON_PAYLOAD};
+  static const uint8_t PARITIES[] = {0, 8, 16, 32};
+  static const double BERS[] = {1e-4, 3e-4, 1e-3, 3e-3};
+
+  LoRaModulation modulation = {spreadingFactor, 125000, 5, 8, true, false};
+  printf("%zu packets per cell, SF%u, %s\n\n", packets, spreadingFactor,
+         burst == 1 ? "independent bit errors" : "burst errors");
+  printf("%7s %6s %7s %6s %8s %8s %8s %9s %7s %8s %9s %9s\n", "payload", "parity", "ber", "bytes", "airtime",
+         "raw", "fec", "recovered", "caught", "miscorr", "enc_us", "dec_us");
+
+  for (size_t payloadLen : PAYLOADS) {
+    for (uint8_t parity : PARITIES) {
+      if (payloadLen + FEC_CHECK_SIZE + parity > RS_MAX_CODEWORD) continue;
+      size_t onAir = payloadLen + (parity ? FEC_HEADER_SIZE + FEC_CHECK_SIZE + parity : 0);
+      double airtimeMs = loraAirtimeMicros(modulation, onAir) / 1000.0;
+      for (double ber : BERS) {
+        BenchResult r = run(payloadLen, parity, ber, burst, packets, seed);
+        double raw = 100.0 * r.cleanPackets / r.packets;
+        double fec = 100.0 * r.decoded / r.packets;
+        uint64_t lostRaw = r.packets - r.cleanPackets;
+        double recovered = lostRaw ? 100.0 * r.recovered / lostRaw : 0.0;
+        printf("%7zu %6u %7.0e %6zu %6.1fms %7.2f%% %7.2f%% %8.2f%% %7llu %8llu %9.2f %9.2f\n", payloadLen,
+               parity, ber, onAir, airtimeMs, raw, fec, recovered, (unsigned long long)r.caught,
+               (unsigned long long)r.miscorrected,
+               r.encodeNanos / r.packets / 1000.0, r.decodeNanos / r.packets / 1000.0);
+      }
+    }
+    printf("\n");
+  }
+  return 0;
+}
@@ -0,0 +1,329 @@
+// Replays an NMEA stream through GpsTime.h and reports how the clock the
+// firmware stamps readings with would have behaved.
+//
+// Two kinds of input:
+// - recordings made with the 'n' Serial command on a node or the gateway,
+//   one "<local us> $<sentence>" or "<local us> PPS" per line, with or
+//   without the "[<ms> I] " log prefix. The clock sees what the board saw.
+// - plain NMEA logs (u-center, gpsd, a terminal capture). These carry no
+//   local time, so one is simulated: an oscillator off by -drift ppm, PPS
+//   edges late by up to -jitter us of interrupt latency, each second's
+//   sentences starting -delay ms after its edge at -baud, and a loop that
+//   polls the UART every -poll us. The true UTC of every local instant is
+//   then known, so the clock's error is measured directly.
+//
+// Reported: parser counts, how long each time source was in use, PPS
+// residuals (each pulse against the clock's prediction) and drift, the
+// time from pulse to the end of its RMC (what GPS_NMEA_DELAY_US should
+// be), and for simulated input the clock error per source.
+//
+// usage: gps_replay [-nopps] [-drift ppm] [-jitter us] [-delay ms] [-baud b] [-poll us] [-seed s] file
+
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include "GpsTime.h"
+
+#define QUERY_STEP_US 100000  // Clock sampled every 100 ms of local time
+
+struct ReplayEvent {
+  int64_t local;          // Poll that saw it, or the pulse edge
+  int64_t after;          // Previous poll, for sentences
+  bool pulse;
+  std::string sentence;   // Without '$'
+};
+
+struct SimulationSettings {
+  bool pps = true;
+  double driftPpm = 20;
+  double jitterMicros = 20;
+  double delayMillis = 50;
+  double baud = 9600;
+  double pollMicros = 1000;
+  uint64_t seed = 1;
+};
+
+// Local and UTC time of the simulated board; local 0 is UTC start - boot
+class SimulatedClock {
+public:
+  SimulatedClock(int64_t utcStart, double driftPpm) : _utcStart(utcStart), _rate(1.0 + driftPpm * 1e-6) {}
+
+  int64_t local(int64_t utc) const { return BOOT_US + (int64_t)llround((utc - _utcStart) * _rate); }
+  int64_t utc(int64_t local) const { return _utcStart + (int64_t)llround((local - BOOT_US) / _rate); }
+
+private:
+  static const int64_t BOOT_US = 5000000;
+  int64_t _utcStart;
+  double _rate;
+};
+
+struct Summary {
+  size_t n = 0;
+  double mean = 0;
+  int64_t p50 = 0;
+  int64_t p99 = 0;
+  int64_t max = 0;
+};
+
+static Summary summarize(std::vector<int64_t> values, bool absolute) {
+  Summary s;
+  if (values.empty()) return s;
+  double sum = 0;
+  for (int64_t& v : values) {
+    sum += v;
+    if (absolute && v < 0) v = -v;
+  }
+  std::sort(values.begin(), values.end());
+  s.n = values.size();
+  s.mean = sum / values.size();
+  s.p50 = values[values.size() / 2];
+  s.p99 = values[std::min(values.size() - 1, values.size() * 99 / 100)];
+  s.max = values.back();
+  return s;
+}
+
+// Strips the line end and an optional "[<ms> <level>] " log prefix
+static char* trimLine(char* line) {
+  line[strcspn(line, "\r\n")] = '\0';
+  if (line[0] == '[') {
+    char* end = strstr(line, "] ");
+    if (end != nullptr) line = end + 2;
+  }
+  return line;
+}
+
+static bool isRmc(const std::string& sentence) {
+  return sentence.size() > 5 && sentence.compare(2, 3, "RMC") == 0 && sentence[5] == ',';
+}
+
+static NmeaEvent feedSentence(NmeaParser& parser, const std::string& sentence) {
+  parser.feed('$');
+  for (char c : sentence) parser.feed(c);
+  return parser.feed('\n');
+}
+
+// Recorded input: events carry the board's own timestamps
+static bool readRecording(FILE* file, double pollMicros, std::vector<ReplayEvent>& events, size_t& skipped) {
+  char buffer[256];
+  while (fgets(buffer, sizeof(buffer), file) != nullptr) {
+    char* line = trimLine(buffer);
+    char* rest;
+    long long local = strtoll(line, &rest, 10);
+    if (rest == line || *rest != ' ') {
+      if (*line != '\0') skipped++;
+      continue;
+    }
+    rest++;
+    ReplayEvent event;
+    event.local = local;
+    event.after = local - (int64_t)pollMicros;
+    event.pulse = strcmp(rest, "PPS") == 0;
+    if (!event.pulse) {
+      if (*rest != '$') {
+        skipped++;
+        continue;
+      }
+      event.sentence = rest + 1;
+    }
+    events.push_back(event);
+  }
+  return !events.empty();
+}
+
+// Plain NMEA: every RMC opens a second, the sentences up to the next one
+// follow it on the wire
+static bool simulate(FILE* file, const SimulationSettings& settings, std::vector<ReplayEvent>& events,
+                     SimulatedClock*& clock, size_t& skipped) {
+  std::mt19937_64 rng(settings.seed);
+  std::uniform_real_distribution<double> jitter(0.0, settings.jitterMicros);
+  NmeaParser parser;
+
+  char buffer[256];
+  int64_t second = -1;     // UTC of the current burst, us
+  double wireMicros = 0;   // End of the last sentence on the wire, UTC us
+  while (fgets(buffer, sizeof(buffer), file) != nullptr) {
+    char* line = trimLine(buffer);
+    char* dollar = strchr(line, '$');
+    if (dollar == nullptr) {
+      if (*line != '\0') skipped++;
+      continue;
+    }
+    std::string sentence = dollar + 1;
+
+    if (isRmc(sentence)) {
+      NmeaEvent parsed = feedSentence(parser, sentence);
+      if (parsed == NMEA_NONE) continue;  // Damaged, the next RMC says which second it is
+      if (parsed == NMEA_TIME) {
+        second = parser.unixMicros() / 1000000 * 1000000;
+      } else if (second >= 0) {
+        second += 1000000;  // No fix: the receiver still sends one per second
+      }
+      if (second < 0) continue;
+      if (clock == nullptr) clock = new SimulatedClock(second, settings.driftPpm);
+
+      if (settings.pps) {
+        ReplayEvent pulse;
+        pulse.local = clock->local(second) + (int64_t)jitter(rng);
+        pulse.after = pulse.local;
+        pulse.pulse = true;
+        events.push_back(pulse);
+      }
+      wireMicros = second + settings.delayMillis * 1000;
+    }
+    if (second < 0) continue;
+
+    // '$', the sentence and CR LF at 10 bits a character
+    wireMicros += (sentence.size() + 3) * 10 * 1e6 / settings.baud;
+    int64_t arrived = clock->local((int64_t)wireMicros);
+    int64_t poll = (int64_t)settings.pollMicros;
+    ReplayEvent event;
+    event.local = (arrived + poll - 1) / poll * poll;
+    event.after = event.local - poll;
+    event.pulse = false;
+    event.sentence = sentence;
+    events.push_back(event);
+  }
+  std::stable_sort(events.begin(), events.end(),
+                   [](const ReplayEvent& a, const ReplayEvent& b) { return a.local < b.local; });
+  return !events.empty();
+}
+
+int main(int argc, char** argv) {
+  SimulationSettings settings;
+  const char* path = nullptr;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-nopps") == 0) settings.pps = false;
+    else if (strcmp(argv[i], "-drift") == 0 && i + 1 < argc) settings.driftPpm = atof(argv[++i]);
+    else if (strcmp(argv[i], "-jitter") == 0 && i + 1 < argc) settings.jitterMicros = atof(argv[++i]);
+    else if (strcmp(argv[i], "-delay") == 0 && i + 1 < argc) settings.delayMillis = atof(argv[++i]);
+    else if (strcmp(argv[i], "-baud") == 0 && i + 1 < argc) settings.baud = atof(argv[++i]);
+    else if (strcmp(argv[i], "-poll") == 0 && i + 1 < argc) settings.pollMicros = atof(argv[++i]);
+    else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) settings.seed = strtoull(argv[++i], nullptr, 10);
+    else if (argv[i][0] != '-' && path == nullptr) path = argv[i];
+    else {
+      fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 2;
+    }
+  }
+  if (path == nullptr) {
+    fprintf(stderr, "usage: gps_replay [-nopps] [-drift ppm] [-jitter us] [-delay ms] [-baud b] "
+                    "[-poll us] [-seed s] file\n");
+    return 2;
+  }
+  if (settings.baud <= 0) settings.baud = 9600;
+  if (settings.pollMicros < 1) settings.pollMicros = 1;
+
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) {
+    fprintf(stderr, "Cannot open %s\n", path);
+    return 1;
+  }
+
+  // A leading timestamp means the board recorded it
+  char first[256] = "";
+  long start = ftell(file);
+  while (fgets(first, sizeof(first), file) != nullptr && *trimLine(first) == '\0') {}
+  bool recorded = isdigit((unsigned char)*trimLine(first)) != 0;
+  fseek(file, start, SEEK_SET);
+
+  std::vector<ReplayEvent> events;
+  SimulatedClock* truth = nullptr;
+  size_t skipped = 0;
+  bool ok = recorded ? readRecording(file, settings.pollMicros, events, skipped)
+                     : simulate(file, settings, events, truth, skipped);
+  fclose(file);
+  if (!ok) {
+    fprintf(stderr, "No NMEA in %s\n", path);
+    return 1;
+  }
+
+  NmeaParser parser;
+  GpsClock clock;
+  std::vector<int64_t> residuals;
+  std::vector<int64_t> pulseToRmc;
+  std::vector<int64_t> errors[3];
+  double sourceMicros[3] = {};
+  int64_t lastPulse = -1;
+
+  int64_t query = events.front().local;
+  for (const ReplayEvent& event : events) {
+    // Sample the clock up to this event
+    for (; query < event.local; query += QUERY_STEP_US) {
+      GpsTimeSource source = clock.source(query);
+      sourceMicros[source] += QUERY_STEP_US;
+      int64_t unixMicros;
+      if (truth != nullptr && clock.toUnixMicros(query, unixMicros)) {
+        errors[source].push_back(unixMicros - truth->utc(query));
+      }
+    }
+
+    if (event.pulse) {
+      int64_t predicted;
+      if (clock.source(event.local) == GPS_TIME_PPS && clock.toUnixMicros(event.local, predicted)) {
+        residuals.push_back(predicted - (predicted + 500000) / 1000000 * 1000000);
+      }
+      clock.onPulse(event.local);
+      lastPulse = event.local;
+      continue;
+    }
+    if (feedSentence(parser, event.sentence) == NMEA_TIME) {
+      clock.onNmeaTime(parser.unixMicros(), event.after, event.local);
+      if (lastPulse >= 0 && event.local - lastPulse < 1000000) {
+        pulseToRmc.push_back(event.local - lastPulse);
+      }
+    }
+  }
+
+  const NmeaParser::Stats& parsed = parser.stats();
+  const GpsClock::Stats& stats = clock.stats();
+  printf("%s: %s, %zu events, %zu lines skipped\n", path,
+         recorded ? "recorded" : "plain NMEA, simulated timing", events.size(), skipped);
+  if (!recorded) {
+    printf("Simulated: %s, drift %.1f ppm, jitter %.0f us, delay %.0f ms, %.0f baud, poll %.0f us\n",
+           settings.pps ? "PPS" : "no PPS", settings.driftPpm, settings.jitterMicros, settings.delayMillis,
+           settings.baud, settings.pollMicros);
+  }
+  printf("\nNMEA: %lu sentences, %lu checksum errors, %lu overruns, %lu times, %lu without fix\n",
+         parsed.sentences, parsed.checksumErrors, parsed.overruns, parsed.times, parsed.noFix);
+
+  double total = sourceMicros[0] + sourceMicros[1] + sourceMicros[2];
+  if (total > 0) {
+    printf("Time source over %.0f s: pps %.1f%%, nmea %.1f%%, none %.1f%%\n", total / 1e6,
+           100 * sourceMicros[GPS_TIME_PPS] / total, 100 * sourceMicros[GPS_TIME_NMEA] / total,
+           100 * sourceMicros[GPS_TIME_NONE] / total);
+  }
+
+  printf("PPS: %lu pulses, %lu rejected, %lu locks, %lu mismatches, drift %.3f ppm\n", stats.pulses,
+         stats.rejected, stats.locks, stats.mismatches, clock.driftPpb() / 1000.0);
+  Summary r = summarize(residuals, true);
+  if (r.n > 0) {
+    printf("PPS residual (us): n %zu, mean %.1f, |p50| %lld, |p99| %lld, |max| %lld\n", r.n, r.mean,
+           (long long)r.p50, (long long)r.p99, (long long)r.max);
+  }
+  Summary d = summarize(pulseToRmc, false);
+  if (d.n > 0) {
+    printf("Pulse to end of RMC (ms): n %zu, mean %.1f, p50 %.1f, p99 %.1f, max %.1f (GPS_NMEA_DELAY_US %.0f ms)\n",
+           d.n, d.mean / 1000, d.p50 / 1000.0, d.p99 / 1000.0, d.max / 1000.0, GPS_NMEA_DELAY_US / 1000.0);
+  }
+
+  if (truth != nullptr) {
+    printf("\nClock error against simulated UTC (us):\n");
+    printf("%-6s %8s %10s %8s %8s %8s\n", "source", "samples", "mean", "|p50|", "|p99|", "|max|");
+    for (GpsTimeSource source : {GPS_TIME_PPS, GPS_TIME_NMEA}) {
+      Summary e = summarize(errors[source], true);
+      if (e.n == 0) continue;
+      printf("%-6s %8zu %10.1f %8lld %8lld %8lld\n", gpsTimeSourceName(source), e.n, e.mean,
+             (long long)e.p50, (long long)e.p99, (long long)e.max);
+    }
+    delete truth;
+  }
+  return 0;
+}
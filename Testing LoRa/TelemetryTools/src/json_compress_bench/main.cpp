@@ -0,0 +1,178 @@
+// Compression ratio and cost of the static-dictionary JSON compressor in
+// JsonCompressor.h.
+//
+// By default the payloads are the documents generateAndSendData() builds,
+// with values drawn from the same ranges and printed the way ArduinoJson
+// prints floats (shortest form, trailing zeros dropped). With -log, the
+// MESSAGE column of a broker log is used instead, which shows how the
+// dictionary does on documents it was not built for.
+//
+// Every payload is compressed, decompressed and checked against the
+// original. Reported: bytes before and after, ratio, SF7 airtime before and
+// after, and time per packet (plus TSC cycles on x86).
+//
+// usage: json_compress_bench [-n packets] [-log file.csv] [-seed s]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+#include "JsonCompressor.h"
+#include "LoRaAirtime.h"
+#include "SensorFrame.h"
+#include "TelemetryCsv.h"
+
+// Shortest decimal form with at most `decimals` places, like ArduinoJson
+static std::string number(double value, int decimals) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+  std::string s = buf;
+  if (s.find('.') != std::string::npos) {
+    while (s.back() == '0') s.pop_back();
+    if (s.back() == '.') s.pop_back();
+  }
+  return s;
+}
+
+// randomFloat() in the firmware: random(min * 100, max * 100) / 100
+static double randomFloat(std::mt19937& rng, double min, double max) {
+  std::uniform_int_distribution<int> d((int)(min * 100), (int)(max * 100) - 1);
+  return d(rng) / 100.0;
+}
+
+static std::string sensorDocument(std::mt19937& rng, int lahanID) {
+  std::uniform_real_distribution<double> voltage(3600, 4200);
+  std::uniform_real_distribution<double> current(0, 500);
+  double v = voltage(rng);
+  double percentage = (v - 3300) / (4200 - 3300) * 100;
+
+  std::string s = "{\"type\":\"sensor\",\"lahanID\":" + std::to_string(lahanID);
+  s += ",\"sensor\":{\"Humidity\":" + number(randomFloat(rng, 20, 35), 2);
+  s += ",\"Temperature\":" + number(randomFloat(rng, 20, 35), 2);
+  s += ",\"Ec\":" + number(randomFloat(rng, 0, 100), 2);
+  s += ",\"Ph\":" + number(randomFloat(rng, 0, 14), 2);
+  s += ",\"Nitrogen\":" + number(randomFloat(rng, 0, 5), 2);
+  s += ",\"Phosporus\":" + number(randomFloat(rng, 0, 10), 2);
+  s += ",\"Kalium\":" + number(randomFloat(rng, 0, 15), 2);
+  s += "},\"battery\":{\"voltage\":" + number(v, 1);
+  s += ",\"dischargeCurrent\":" + number(current(rng), 1);
+  s += ",\"percentage\":" + number(percentage, 6);
+  s += ",\"chargeCurrent\":" + number(0, 1);
+  s += "}}";
+  return s;
+}
+
+static bool loadLog(const char* path, size_t limit, std::vector<std::string>& payloads) {
+  std::ifstream in(path);
+  if (!in) return false;
+  std::string line, scratch;
+  std::getline(in, line);  // header
+  TelemetryRow row;
+  while (payloads.size() < limit && std::getline(in, line)) {
+    if (parseTelemetryRow(line, row, scratch)) payloads.emplace_back(row.message);
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  size_t packets = 100000;
+  const char* logPath = nullptr;
+  unsigned seed = 1;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) packets = (size_t)atol(argv[++i]);
+    else if (strcmp(argv[i], "-log") == 0 && i + 1 < argc) logPath = argv[++i];
+    else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) seed = (unsigned)atoi(argv[++i]);
+    else {
+      fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 2;
+    }
+  }
+
+  std::vector<std::string> payloads;
+  if (logPath) {
+    if (!loadLog(logPath, packets, payloads)) {
+      fprintf(stderr, "cannot read %s\n", logPath);
+      return 1;
+    }
+  } else {
+    std::mt19937 rng(seed);
+    for (size_t i = 0; i < packets; i++) payloads.push_back(sensorDocument(rng, 1 + (int)(i % 8)));
+  }
+  if (payloads.empty()) {
+    fprintf(stderr, "no payloads\n");
+    return 1;
+  }
+
+  const LoRaModulation sf7 = {7, 125000, 5, 8, true, false};
+  uint64_t rawBytes = 0, packedBytes = 0, tooLarge = 0, mismatches = 0;
+  size_t maxRaw = 0, maxPacked = 0;
+  double rawAirtime = 0, packedAirtime = 0, compressNanos = 0, decompressNanos = 0;
+  uint64_t compressCycles = 0, decompressCycles = 0;
+
+  uint8_t packed[1024];
+  char unpacked[1024];
+  for (const std::string& json : payloads) {
+    auto t0 = std::chrono::steady_clock::now();
+#ifdef HAVE_TSC
+    uint64_t c0 = __rdtsc();
+#endif
+    size_t n = compressJson(json.data(), json.size(), packed, sizeof(packed));
+#ifdef HAVE_TSC
+    uint64_t c1 = __rdtsc();
+#endif
+    auto t1 = std::chrono::steady_clock::now();
+    size_t m = decompressJson(packed, n, unpacked, sizeof(unpacked));
+#ifdef HAVE_TSC
+    uint64_t c2 = __rdtsc();
+    compressCycles += c1 - c0;
+    decompressCycles += c2 - c1;
+#endif
+    auto t2 = std::chrono::steady_clock::now();
+    compressNanos += std::chrono::duration<double, std::nano>(t1 - t0).count();
+    decompressNanos += std::chrono::duration<double, std::nano>(t2 - t1).count();
+
+    if (n == 0) {
+      tooLarge++;
+      continue;
+    }
+    if (m != json.size() || memcmp(unpacked, json.data(), m) != 0) mismatches++;
+    rawBytes += json.size();
+    packedBytes += n;
+    if (json.size() > maxRaw) maxRaw = json.size();
+    if (n > maxPacked) maxPacked = n;
+    rawAirtime += json.size() <= 255 ? loraAirtimeMicros(sf7, json.size()) / 1000.0 : 0;
+    packedAirtime += loraAirtimeMicros(sf7, n) / 1000.0;
+  }
+
+  size_t count = payloads.size();
+  size_t ok = count - tooLarge;
+  printf("payloads:        %zu (%s)\n", count, logPath ? logPath : "generateAndSendData() documents");
+  printf("example:         %s\n", payloads[0].c_str());
+  printf("raw bytes:       avg %.1f, max %zu\n", (double)rawBytes / ok, maxRaw);
+  printf("compressed:      avg %.1f, max %zu (binary SensorFrame: %d)\n", (double)packedBytes / ok, maxPacked,
+         SENSOR_FRAME_SIZE);
+  printf("ratio:           %.2fx\n", (double)rawBytes / packedBytes);
+  printf("SF7 airtime:     %.1f -> %.1f ms per packet\n", rawAirtime / ok, packedAirtime / ok);
+  printf("compress:        %.0f ns per packet", compressNanos / count);
+#ifdef HAVE_TSC
+  printf(", %.0f cycles", (double)compressCycles / count);
+#endif
+  printf("\ndecompress:      %.0f ns per packet", decompressNanos / count);
+#ifdef HAVE_TSC
+  printf(", %.0f cycles", (double)decompressCycles / count);
+#endif
+  printf("\nround-trip errors: %llu, too large: %llu\n", (unsigned long long)mismatches,
+         (unsigned long long)tooLarge);
+  printf("encoder index RAM: %zu bytes\n", sizeof(json_dictionary::Index));
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,380 @@
+// Streaming analyzer for broker logs. The file is memory-mapped and split
+// at line boundaries into one chunk per thread; each thread parses its rows
+// in place and keeps per (RUN_ID, TOPIC) statistics, which are merged in
+// file order afterwards. Per group it reports:
+//  - inter-arrival histogram and jitter (change between consecutive intervals)
+//  - message rate per minute
+//  - gaps longer than the threshold
+//  - battery drain as least-squares slopes of voltage and level over time
+//
+// usage: log_analyzer [-j threads] [-g gapSeconds] log.csv...
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "MappedFile.h"
+#include "TelemetryCsv.h"
+
+#define HISTOGRAM_BINS 32
+#define MAX_GAPS_SHOWN 10
+#define TIMELINE_COLUMNS 60
+#define MIN_CHUNK_BYTES (4u << 20)
+
+// Power-of-two buckets: bin i holds values in [2^(i-1), 2^i), bin 0 holds 0
+struct Log2Histogram {
+  uint64_t bins[HISTOGRAM_BINS] = {};
+
+  void add(uint64_t value) {
+    int bin = value ? 64 - __builtin_clzll(value) : 0;
+    bins[bin < HISTOGRAM_BINS ? bin : HISTOGRAM_BINS - 1]++;
+  }
+
+  void merge(const Log2Histogram& other) {
+    for (int i = 0; i < HISTOGRAM_BINS; i++) bins[i] += other.bins[i];
+  }
+
+  void print(const char* unit) const {
+    uint64_t peak = *std::max_element(bins, bins + HISTOGRAM_BINS);
+    for (int i = 0; i < HISTOGRAM_BINS; i++) {
+      if (bins[i] == 0) continue;
+      uint64_t lo = i ? 1ull << (i - 1) : 0;
+      uint64_t hi = 1ull << i;
+      int bar = (int)(40 * bins[i] / peak);
+      printf("    [%8llu, %8llu) %s %9llu %.*s\n", (unsigned long long)lo, (unsigned long long)hi, unit,
+             (unsigned long long)bins[i], bar ? bar : 1, "########################################");
+    }
+  }
+};
+
+struct Regression {
+  double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+
+  void add(double x, double y) {
+    n++;
+    sx += x;
+    sy += y;
+    sxx += x * x;
+    sxy += x * y;
+  }
+
+  void merge(const Regression& o) {
+    n += o.n;
+    sx += o.sx;
+    sy += o.sy;
+    sxx += o.sxx;
+    sxy += o.sxy;
+  }
+
+  bool valid() const { return n >= 2 && n * sxx - sx * sx > 1e-12; }
+  double slope() const { return (n * sxy - sx * sy) / (n * sxx - sx * sx); }
+};
+
+struct Gap {
+  double start;   // unix time of the last row before the gap
+  double length;  // s
+};
+
+struct GroupKey {
+  uint32_t runId;
+  std::string_view topic;  // points into the mapping
+
+  bool operator==(const GroupKey& o) const { return runId == o.runId && topic == o.topic; }
+  bool operator<(const GroupKey& o) const { return runId != o.runId ? runId < o.runId : topic < o.topic; }
+};
+
+struct GroupKeyHash {
+  size_t operator()(const GroupKey& k) const {
+    return std::hash<std::string_view>()(k.topic) * 31 + k.runId;
+  }
+};
+
+struct AnalyzerConfig {
+  double gapThreshold = 30;  // s
+  double origin = 0;         // unix time of the first row, x origin of the slopes
+};
+
+struct GroupStats {
+  uint64_t rows = 0;
+  uint64_t batteryRows = 0;
+  double first = 0, last = 0;
+  double firstInterval = -1;
+  double previousInterval = -1;
+
+  uint64_t intervals = 0;
+  double intervalSum = 0, intervalMin = 1e300, intervalMax = 0;
+  Log2Histogram intervalHistogram;  // ms
+
+  uint64_t jitters = 0;
+  double jitterSum = 0, jitterMax = 0;
+  Log2Histogram jitterHistogram;    // ms
+
+  std::vector<Gap> gaps;
+  std::unordered_map<int64_t, uint32_t> perMinute;  // unix minute -> rows
+  Regression voltage;               // V over hours since origin
+  Regression level;                 // % over hours since origin
+
+  void addInterval(double interval, const AnalyzerConfig& config) {
+    intervals++;
+    intervalSum += interval;
+    if (interval < intervalMin) intervalMin = interval;
+    if (interval > intervalMax) intervalMax = interval;
+    intervalHistogram.add((uint64_t)(interval * 1000.0 + 0.5));
+    if (interval > config.gapThreshold) gaps.push_back({last, interval});
+  }
+
+  void addJitter(double jitter) {
+    jitters++;
+    jitterSum += jitter;
+    if (jitter > jitterMax) jitterMax = jitter;
+    jitterHistogram.add((uint64_t)(jitter * 1000.0 + 0.5));
+  }
+
+  void add(const TelemetryRow& row, const AnalyzerConfig& config) {
+    double t = row.unixTime;
+    if (rows == 0) {
+      first = t;
+    } else {
+      double interval = t - last;
+      addInterval(interval, config);
+      if (previousInterval >= 0) addJitter(fabs(interval - previousInterval));
+      if (firstInterval < 0) firstInterval = interval;
+      previousInterval = interval;
+    }
+    last = t;
+    rows++;
+    perMinute[(int64_t)(t / 60)]++;
+
+    double hours = (t - config.origin) / 3600.0;
+    double value;
+    bool hasBattery = false;
+    if (jsonNumber(row.message, "batteryVoltage", value)) {
+      voltage.add(hours, value);
+      hasBattery = true;
+    }
+    if (jsonNumber(row.message, "batteryLevel", value)) {
+      level.add(hours, value);
+      hasBattery = true;
+    }
+    if (hasBattery) batteryRows++;
+  }
+
+  // Appends the statistics of the rows that follow this group's rows in the
+  // file, including the interval across the chunk boundary and the jitter
+  // samples on either side of it, so the result does not depend on how the
+  // file was split.
+  void append(const GroupStats& next, const AnalyzerConfig& config) {
+    if (rows == 0) {
+      *this = next;
+      return;
+    }
+    if (next.rows == 0) return;
+
+    double boundary = next.first - last;
+    addInterval(boundary, config);
+    if (previousInterval >= 0) addJitter(fabs(boundary - previousInterval));
+    if (next.firstInterval >= 0) addJitter(fabs(next.firstInterval - boundary));
+    if (firstInterval < 0) firstInterval = boundary;
+    intervals += next.intervals;
+    intervalSum += next.intervalSum;
+    intervalMin = std::min(intervalMin, next.intervalMin);
+    intervalMax = std::max(intervalMax, next.intervalMax);
+    intervalHistogram.merge(next.intervalHistogram);
+    jitters += next.jitters;
+    jitterSum += next.jitterSum;
+    jitterMax = std::max(jitterMax, next.jitterMax);
+    jitterHistogram.merge(next.jitterHistogram);
+    gaps.insert(gaps.end(), next.gaps.begin(), next.gaps.end());
+    for (const auto& minute : next.perMinute) perMinute[minute.first] += minute.second;
+    voltage.merge(next.voltage);
+    level.merge(next.level);
+
+    rows += next.rows;
+    batteryRows += next.batteryRows;
+    last = next.last;
+    previousInterval = next.intervals ? next.previousInterval : boundary;
+  }
+};
+
+typedef std::unordered_map<GroupKey, GroupStats, GroupKeyHash> GroupTable;
+
+struct ChunkResult {
+  GroupTable groups;
+  uint64_t rows = 0;
+  uint64_t badRows = 0;
+};
+
+static void analyzeChunk(std::string_view chunk, const AnalyzerConfig& config, ChunkResult& result) {
+  TelemetryRow row;
+  std::string scratch;
+  scratch.reserve(512);
+
+  size_t pos = 0;
+  while (pos < chunk.size()) {
+    const char* start = chunk.data() + pos;
+    const char* newline = static_cast<const char*>(memchr(start, '\n', chunk.size() - pos));
+    size_t length = newline ? (size_t)(newline - start) : chunk.size() - pos;
+    std::string_view line(start, length);
+    pos += length + 1;
+
+    if (line.empty() || (line.size() == 1 && line[0] == '\r')) continue;
+    if (!parseTelemetryRow(line, row, scratch)) {
+      result.badRows++;
+      continue;
+    }
+    result.rows++;
+    result.groups[GroupKey{row.runId, row.topic}].add(row, config);
+  }
+}
+
+// Splits data into up to count chunks, each ending just after a newline
+static std::vector<std::string_view> splitLines(std::string_view data, size_t count) {
+  std::vector<std::string_view> chunks;
+  size_t begin = 0;
+  for (size_t i = 1; i <= count && begin < data.size(); i++) {
+    size_t end = i == count ? data.size() : data.size() * i / count;
+    if (end < begin) end = begin;
+    if (end < data.size()) {
+      size_t newline = data.find('\n', end);
+      end = newline == std::string_view::npos ? data.size() : newline + 1;
+    }
+    chunks.push_back(data.substr(begin, end - begin));
+    begin = end;
+  }
+  return chunks;
+}
+
+static void printTimeline(const GroupStats& g) {
+  int64_t firstMinute = (int64_t)(g.first / 60);
+  int64_t minutes = (int64_t)(g.last / 60) - firstMinute + 1;
+  int64_t width = (minutes + TIMELINE_COLUMNS - 1) / TIMELINE_COLUMNS;
+  printf("  rate timeline, msgs per %lld min:\n   ", (long long)width);
+
+  for (int64_t column = 0; column * width < minutes; column++) {
+    uint64_t count = 0;
+    for (int64_t m = column * width; m < (column + 1) * width && m < minutes; m++) {
+      auto it = g.perMinute.find(firstMinute + m);
+      if (it != g.perMinute.end()) count += it->second;
+    }
+    printf(" %llu", (unsigned long long)count);
+    if (column % 20 == 19) printf("\n   ");
+  }
+  printf("\n");
+}
+
+static void printGroup(const GroupKey& key, GroupStats& g) {
+  double span = g.last - g.first;
+  printf("run %u  %.*s: %llu rows over %.1f min", key.runId, (int)key.topic.size(), key.topic.data(),
+         (unsigned long long)g.rows, span / 60);
+  if (span > 0) printf(", %.2f msg/min", (g.rows - 1) * 60.0 / span);
+  printf("\n");
+
+  if (g.intervals) {
+    printf("  interval: mean %.3f s, min %.3f s, max %.3f s\n", g.intervalSum / g.intervals, g.intervalMin,
+           g.intervalMax);
+    g.intervalHistogram.print("ms");
+  }
+  if (g.jitters) {
+    printf("  jitter: mean %.1f ms, max %.1f ms\n", g.jitterSum * 1000 / g.jitters, g.jitterMax * 1000);
+    g.jitterHistogram.print("ms");
+  }
+
+  std::sort(g.gaps.begin(), g.gaps.end(), [](const Gap& a, const Gap& b) { return a.length > b.length; });
+  double gapTotal = 0;
+  for (const Gap& gap : g.gaps) gapTotal += gap.length;
+  printf("  gaps: %zu, %.1f min in total\n", g.gaps.size(), gapTotal / 60);
+  for (size_t i = 0; i < g.gaps.size() && i < MAX_GAPS_SHOWN; i++) {
+    printf("    %.0f s after t=%.3f\n", g.gaps[i].length, g.gaps[i].start);
+  }
+
+  printTimeline(g);
+
+  if (g.voltage.valid() || g.level.valid()) {
+    printf("  battery (%llu rows):", (unsigned long long)g.batteryRows);
+    if (g.voltage.valid()) printf(" voltage %+.2f mV/h", g.voltage.slope() * 1000);
+    if (g.level.valid()) printf(", level %+.3f %%/h", g.level.slope());
+    printf("\n");
+  }
+  printf("\n");
+}
+
+static bool analyzeFile(const char* path, size_t threads, AnalyzerConfig config) {
+  auto start = std::chrono::steady_clock::now();
+  MappedFile file(path);
+  if (!file.isOpen()) {
+    fprintf(stderr, "Cannot open %s\n", path);
+    return false;
+  }
+
+  std::string_view data = file.view();
+  size_t headerEnd = data.find('\n');
+  data = headerEnd == std::string_view::npos ? std::string_view() : data.substr(headerEnd + 1);
+
+  // Slopes are taken against the first row so the sums stay well conditioned
+  {
+    TelemetryRow row;
+    std::string scratch;
+    size_t end = data.find('\n');
+    if (parseTelemetryRow(data.substr(0, end), row, scratch)) config.origin = row.unixTime;
+  }
+
+  size_t maxThreads = data.size() / MIN_CHUNK_BYTES + 1;
+  std::vector<std::string_view> chunks = splitLines(data, std::min(threads, maxThreads));
+  std::vector<ChunkResult> results(chunks.size());
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < chunks.size(); i++) {
+    workers.emplace_back(analyzeChunk, chunks[i], std::cref(config), std::ref(results[i]));
+  }
+  if (!chunks.empty()) analyzeChunk(chunks[0], config, results[0]);
+  for (std::thread& worker : workers) worker.join();
+
+  std::map<GroupKey, GroupStats> groups;
+  uint64_t rows = 0, badRows = 0;
+  for (ChunkResult& result : results) {
+    rows += result.rows;
+    badRows += result.badRows;
+    for (auto& entry : result.groups) groups[entry.first].append(entry.second, config);
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("%s: %llu rows, %zu groups, %.1f MB in %.3f s (%zu threads, %.0f MB/s)",
+         path, (unsigned long long)rows, groups.size(), file.view().size() / 1e6, seconds, chunks.size(),
+         file.view().size() / 1e6 / seconds);
+  if (badRows) printf(", %llu unparsable rows", (unsigned long long)badRows);
+  printf("\n\n");
+
+  for (auto& entry : groups) printGroup(entry.first, entry.second);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  AnalyzerConfig config;
+  size_t threads = std::thread::hardware_concurrency();
+  if (threads == 0) threads = 1;
+
+  int files = 0;
+  bool ok = true;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      threads = (size_t)std::max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+      config.gapThreshold = atof(argv[++i]);
+    } else {
+      ok = analyzeFile(argv[i], threads, config) && ok;
+      files++;
+    }
+  }
+  if (files == 0) {
+    ok = analyzeFile("../TimeBasedMqtt/TimeBasedMqtt.csv", threads, config) && ok;
+    ok = analyzeFile("../EventBasedMqtt/EventBasedMqtt.csv", threads, config) && ok;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,92 @@
+// Replays a broker log through every MQTT payload format and reports the
+// encoded size and encode time per message.
+//
+// usage: payload_bench [log.csv] [iterations]
+
+#include <ArduinoJson.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "PayloadFormat.h"
+#include "TelemetryCsv.h"
+
+static const PayloadFormat FORMATS[] = {PAYLOAD_JSON, PAYLOAD_MSGPACK, PAYLOAD_BINARY};
+
+// PUBLISH fixed header (1 + remaining-length bytes) + topic length prefix + topic
+static size_t mqttPacketSize(const char* topic, size_t payloadLen) {
+  size_t remaining = 2 + strlen(topic) + payloadLen;
+  size_t lengthBytes = remaining < 128 ? 1 : (remaining < 16384 ? 2 : 3);
+  return 1 + lengthBytes + remaining;
+}
+
+int main(int argc, char** argv) {
+  std::string path = argc > 1 ? argv[1] : "../TimeBasedMqtt/TimeBasedMqtt.csv";
+  int iterations = argc > 2 ? atoi(argv[2]) : 200;
+
+  TelemetryCsvReader reader(path);
+  if (!reader.isOpen()) {
+    fprintf(stderr, "Cannot open %s\n", path.c_str());
+    return 1;
+  }
+
+  std::vector<JsonDocument> docs;
+  std::string baseTopic;
+  TelemetryRow row;
+  while (reader.next(row)) {
+    JsonDocument doc;
+    if (deserializeJson(doc, row.message.data(), row.message.size())) continue;
+    if (baseTopic.empty()) baseTopic = std::string(row.topic);
+    docs.push_back(std::move(doc));
+  }
+  if (docs.empty()) {
+    fprintf(stderr, "No messages in %s\n", path.c_str());
+    return 1;
+  }
+
+  printf("%zu messages from %s, %d iterations\n\n", docs.size(), path.c_str(), iterations);
+  printf("%-8s %-22s %9s %9s %9s %11s %10s %8s\n",
+         "format", "topic", "avg B", "min B", "max B", "avg pkt B", "ns/msg", "ratio");
+
+  uint8_t buffer[512];
+  double jsonBytes = 0;
+  for (PayloadFormat format : FORMATS) {
+    char topic[64];
+    buildTopic(topic, sizeof(topic), baseTopic.c_str(), format);
+
+    size_t total = 0, packetTotal = 0, minLen = SIZE_MAX, maxLen = 0, failures = 0;
+    for (const JsonDocument& doc : docs) {
+      size_t len = encodePayload(doc, format, buffer, sizeof(buffer));
+      if (len == 0) {
+        failures++;
+        continue;
+      }
+      total += len;
+      packetTotal += mqttPacketSize(topic, len);
+      if (len < minLen) minLen = len;
+      if (len > maxLen) maxLen = len;
+    }
+
+    size_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+      for (const JsonDocument& doc : docs) {
+        sink += encodePayload(doc, format, buffer, sizeof(buffer));
+      }
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count() /
+                ((double)iterations * docs.size());
+
+    size_t encoded = docs.size() - failures;
+    double avg = encoded ? (double)total / encoded : 0;
+    if (format == PAYLOAD_JSON) jsonBytes = avg;
+    printf("%-8s %-22s %9.1f %9zu %9zu %11.1f %10.0f %7.2fx\n",
+           payloadFormatName(format), topic, avg, encoded ? minLen : 0, maxLen,
+           encoded ? (double)packetTotal / encoded : 0, ns, avg > 0 ? jsonBytes / avg : 0);
+    if (failures) printf("  %zu messages did not fit the %zu byte buffer\n", failures, sizeof(buffer));
+    if (sink == 1) printf("\n");  // keep the timed loop from being optimized away
+  }
+  return 0;
+}
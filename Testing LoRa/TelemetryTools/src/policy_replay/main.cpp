@@ -0,0 +1,301 @@
+// Replays broker logs through alternative send policies and compares what
+// each would have put on the air: messages, payload bytes, LoRa airtime,
+// delivery latency and how far the receiver's view lags the true readings.
+//
+// The receiver is modelled as sample-and-hold: between messages it keeps the
+// last value it got. Reconstruction error is measured at every logged sample.
+//
+// usage: policy_replay [-sf 7..12] log.csv...
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <vector>
+#include "ChangeDetector.h"
+#include "LoRaAirtime.h"
+#include "SensorFrame.h"
+#include "TelemetryCsv.h"
+
+enum {
+  FIELD_HUMIDITY,
+  FIELD_TEMPERATURE,
+  FIELD_EC,
+  FIELD_PH,
+  FIELD_NITROGEN,
+  FIELD_PHOSPHORUS,
+  FIELD_POTASSIUM,
+  FIELD_BATTERY_VOLTAGE,
+  FIELD_BATTERY_LEVEL,
+  FIELD_COUNT
+};
+
+// JSON keys as published by the MQTT transmitters
+static const char* FIELD_KEYS[FIELD_COUNT] = {
+  "humidity", "temperature", "ec", "ph", "nitrogen", "phosphorus", "potassium",
+  "batteryVoltage", "batteryLevel"
+};
+
+struct Sample {
+  double time;  // s since the first row
+  float values[FIELD_COUNT];
+  size_t jsonLength;
+};
+
+// Everything a policy hands to the radio ends up here
+class Channel {
+public:
+  Channel(const LoRaModulation& modulation) : _modulation(modulation) {}
+
+  // Delivers count readings ending with readings[count - 1] in one packet
+  void send(double now, size_t bytes, const Sample* readings, size_t count) {
+    messages++;
+    payloadBytes += bytes;
+    airtimeMicros += loraAirtimeMicros(_modulation, bytes);
+    for (size_t i = 0; i < count; i++) {
+      totalLatency += now - readings[i].time;
+      delivered++;
+    }
+    for (size_t f = 0; f < FIELD_COUNT; f++) held[f] = readings[count - 1].values[f];
+    hasHeld = true;
+  }
+
+  void measure(const Sample& truth) {
+    if (!hasHeld) return;
+    samples++;
+    for (size_t f = 0; f < FIELD_COUNT; f++) {
+      double error = truth.values[f] - held[f];
+      squaredError[f] += error * error;
+      if (fabs(error) > maxError[f]) maxError[f] = fabs(error);
+    }
+  }
+
+  double rmsError(size_t field) const { return samples ? sqrt(squaredError[field] / samples) : 0; }
+
+  unsigned long messages = 0;
+  unsigned long payloadBytes = 0;
+  unsigned long delivered = 0;
+  uint64_t airtimeMicros = 0;
+  double totalLatency = 0;
+
+private:
+  LoRaModulation _modulation;
+  float held[FIELD_COUNT] = {};
+  bool hasHeld = false;
+  unsigned long samples = 0;
+  double squaredError[FIELD_COUNT] = {};
+  double maxError[FIELD_COUNT] = {};
+};
+
+class SendPolicy {
+public:
+  virtual ~SendPolicy() {}
+  virtual const char* name() const = 0;
+  virtual void offer(const Sample& sample, Channel& channel) = 0;
+  virtual void finish(double now, Channel& channel) { (void)now; (void)channel; }
+};
+
+// Every nth sample, as the JSON the firmware published or as a SensorFrame
+class PeriodicPolicy : public SendPolicy {
+public:
+  PeriodicPolicy(const char* name, unsigned every, bool binary) : _name(name), _every(every), _binary(binary) {}
+  const char* name() const override { return _name; }
+
+  void offer(const Sample& sample, Channel& channel) override {
+    if (_count++ % _every != 0) return;
+    channel.send(sample.time, _binary ? SENSOR_FRAME_SIZE : sample.jsonLength, &sample, 1);
+  }
+
+private:
+  const char* _name;
+  unsigned _every;
+  bool _binary;
+  unsigned long _count = 0;
+};
+
+// ChangeDetector on temperature and humidity with the event firmware bands
+class DeadbandPolicy : public SendPolicy {
+public:
+  DeadbandPolicy(const char* name, float temperatureBand, float humidityBand)
+      : _name(name),
+        _configs{{temperatureBand, 0, 0, 0.25f}, {humidityBand, 0, 0, 0.25f}},
+        _detector(_configs, 900000) {}
+  const char* name() const override { return _name; }
+
+  void offer(const Sample& sample, Channel& channel) override {
+    float values[2] = {sample.values[FIELD_TEMPERATURE], sample.values[FIELD_HUMIDITY]};
+    unsigned long now = (unsigned long)(sample.time * 1000.0);
+    if (_detector.evaluate(values, now) == CHANGE_NONE) return;
+    _detector.commit(values, now);
+    channel.send(sample.time, SENSOR_FRAME_SIZE, &sample, 1);
+  }
+
+private:
+  const char* _name;
+  DeadbandConfig _configs[2];
+  ChangeDetector<2> _detector;
+};
+
+// size readings per packet: 2 byte count/id header, then the frame body
+// without magic and version for every reading
+class BatchingPolicy : public SendPolicy {
+public:
+  BatchingPolicy(const char* name, size_t size) : _name(name), _size(size) {}
+  const char* name() const override { return _name; }
+
+  void offer(const Sample& sample, Channel& channel) override {
+    _pending.push_back(sample);
+    if (_pending.size() == _size) flush(sample.time, channel);
+  }
+
+  void finish(double now, Channel& channel) override { flush(now, channel); }
+
+private:
+  void flush(double now, Channel& channel) {
+    if (_pending.empty()) return;
+    channel.send(now, 2 + _pending.size() * (SENSOR_FRAME_SIZE - 2), _pending.data(), _pending.size());
+    _pending.clear();
+  }
+
+  const char* _name;
+  size_t _size;
+  std::vector<Sample> _pending;
+};
+
+// Full SensorFrame every keyframeInterval messages, otherwise a delta frame:
+// 1 byte type, 2 byte mask of changed fields, zigzag varint per changed
+// field against the previous reading in fixed point. Lossless, so the
+// receiver's view matches a plain frame; only the size differs.
+class DeltaPolicy : public SendPolicy {
+public:
+  DeltaPolicy(const char* name, unsigned keyframeInterval) : _name(name), _keyframeInterval(keyframeInterval) {}
+  const char* name() const override { return _name; }
+
+  void offer(const Sample& sample, Channel& channel) override {
+    int32_t fixed[FIELD_COUNT];
+    for (size_t f = 0; f < FIELD_COUNT; f++) fixed[f] = toFixed(f, sample.values[f]);
+
+    size_t bytes = SENSOR_FRAME_SIZE;
+    if (_hasPrevious && _sinceKeyframe < _keyframeInterval) {
+      size_t delta = 3;
+      for (size_t f = 0; f < FIELD_COUNT; f++) {
+        if (fixed[f] != _previous[f]) delta += varintLength(zigzag(fixed[f] - _previous[f]));
+      }
+      if (delta < bytes) bytes = delta;
+    }
+    _sinceKeyframe = bytes == SENSOR_FRAME_SIZE ? 1 : _sinceKeyframe + 1;
+
+    memcpy(_previous, fixed, sizeof(fixed));
+    _hasPrevious = true;
+    channel.send(sample.time, bytes, &sample, 1);
+  }
+
+private:
+  // Same scaling as the SensorFrame slots
+  static int32_t toFixed(size_t field, float value) {
+    if (field == FIELD_BATTERY_VOLTAGE) return (int32_t)lroundf(value * 1000.0f);
+    if (field == FIELD_BATTERY_LEVEL) return (int32_t)lroundf(value);
+    return (int32_t)lroundf(value * 100.0f);
+  }
+
+  static uint32_t zigzag(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+
+  static size_t varintLength(uint32_t v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+      v >>= 7;
+      n++;
+    }
+    return n;
+  }
+
+  const char* _name;
+  unsigned _keyframeInterval;
+  unsigned _sinceKeyframe = 0;
+  int32_t _previous[FIELD_COUNT] = {};
+  bool _hasPrevious = false;
+};
+
+static std::vector<Sample> loadSamples(const char* path) {
+  std::vector<Sample> samples;
+  TelemetryCsvReader reader(path);
+  if (!reader.isOpen()) {
+    fprintf(stderr, "Cannot open %s\n", path);
+    return samples;
+  }
+
+  TelemetryRow row;
+  double startTime = -1;
+  while (reader.next(row)) {
+    Sample sample;
+    bool complete = true;
+    for (size_t f = 0; f < FIELD_COUNT && complete; f++) {
+      double value;
+      complete = jsonNumber(row.message, FIELD_KEYS[f], value);
+      sample.values[f] = (float)value;
+    }
+    if (!complete) continue;
+    if (startTime < 0) startTime = row.unixTime;
+    sample.time = row.unixTime - startTime;
+    sample.jsonLength = row.message.size();
+    samples.push_back(sample);
+  }
+  return samples;
+}
+
+static void replay(const char* path, const LoRaModulation& modulation) {
+  std::vector<Sample> samples = loadSamples(path);
+  if (samples.empty()) return;
+  double duration = samples.back().time;
+
+  std::vector<std::unique_ptr<SendPolicy>> policies;
+  policies.emplace_back(new PeriodicPolicy("periodic json", 1, false));
+  policies.emplace_back(new PeriodicPolicy("periodic frame", 1, true));
+  policies.emplace_back(new PeriodicPolicy("periodic 1/4", 4, true));
+  policies.emplace_back(new DeadbandPolicy("deadband 0.8/2", 0.8f, 2.0f));
+  policies.emplace_back(new DeadbandPolicy("deadband 3/5", 3.0f, 5.0f));
+  policies.emplace_back(new BatchingPolicy("batch 4", 4));
+  policies.emplace_back(new BatchingPolicy("batch 8", 8));
+  policies.emplace_back(new DeltaPolicy("delta k16", 16));
+
+  printf("%s: %zu samples over %.1f min, SF%u/%lu kHz\n", path, samples.size(), duration / 60,
+         modulation.spreadingFactor, (unsigned long)(modulation.bandwidth / 1000));
+  printf("%-16s %6s %8s %7s %11s %9s %9s %9s %9s\n", "policy", "msgs", "bytes", "B/msg",
+         "airtime ms", "duty %", "latency s", "temp rms", "hum rms");
+
+  for (auto& policy : policies) {
+    Channel channel(modulation);
+    for (const Sample& sample : samples) {
+      policy->offer(sample, channel);
+      channel.measure(sample);
+    }
+    policy->finish(duration, channel);
+
+    printf("%-16s %6lu %8lu %7.1f %11.1f %9.3f %9.1f %9.2f %9.2f\n", policy->name(), channel.messages,
+           channel.payloadBytes, channel.messages ? (double)channel.payloadBytes / channel.messages : 0,
+           channel.airtimeMicros / 1000.0, duration > 0 ? channel.airtimeMicros / (duration * 1e4) : 0,
+           channel.delivered ? channel.totalLatency / channel.delivered : 0,
+           channel.rmsError(FIELD_TEMPERATURE), channel.rmsError(FIELD_HUMIDITY));
+  }
+  printf("\n");
+}
+
+int main(int argc, char** argv) {
+  LoRaModulation modulation = LORA_DEFAULT_MODULATION;
+  int files = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-sf") == 0 && i + 1 < argc) {
+      modulation.spreadingFactor = (uint8_t)atoi(argv[++i]);
+    } else {
+      replay(argv[i], modulation);
+      files++;
+    }
+  }
+  if (files == 0) {
+    replay("../TimeBasedMqtt/TimeBasedMqtt.csv", modulation);
+    replay("../EventBasedMqtt/EventBasedMqtt.csv", modulation);
+  }
+  return 0;
+}
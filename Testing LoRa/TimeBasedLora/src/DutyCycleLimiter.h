@@ -0,0 +1,77 @@
+#pragma once
+
+// Token bucket over transmit airtime.
+//
+// The bucket holds up to dutyCycle * window of airtime and refills at
+// dutyCycle (microseconds of airtime per microsecond of wall time), so the
+// long-run average never exceeds the duty cycle while a burst of up to one
+// window's budget is still allowed. Time is passed in by the caller.
+
+#include <stdint.h>
+#include <stddef.h>
+
+class DutyCycleLimiter {
+public:
+  struct Stats {
+    unsigned long granted = 0;
+    unsigned long denied = 0;
+    uint64_t airtimeMicros = 0;  // total granted
+  };
+
+  // window in ms; dutyCycle as a fraction, e.g. 0.01 for 1%
+  DutyCycleLimiter(float dutyCycle, unsigned long window)
+      : _dutyCycle(dutyCycle),
+        _capacity((uint32_t)(dutyCycle * window * 1000.0f)),
+        _tokens(_capacity) {}
+
+  // Takes airtime from the bucket if there is enough of it.
+  bool tryConsume(uint32_t airtimeMicros, unsigned long now) {
+    refill(now);
+    if (airtimeMicros > _tokens) {
+      _stats.denied++;
+      return false;
+    }
+    _tokens -= airtimeMicros;
+    _stats.granted++;
+    _stats.airtimeMicros += airtimeMicros;
+    return true;
+  }
+
+  // ms until airtimeMicros is available, 0 if it is now
+  unsigned long waitTime(uint32_t airtimeMicros, unsigned long now) {
+    refill(now);
+    if (airtimeMicros <= _tokens) return 0;
+    if (airtimeMicros > _capacity) return (unsigned long)-1;  // never fits
+    return (unsigned long)((airtimeMicros - _tokens) / (_dutyCycle * 1000.0f)) + 1;
+  }
+
+  // Airtime left in the bucket, in microseconds
+  uint32_t remaining(unsigned long now) {
+    refill(now);
+    return _tokens;
+  }
+
+  uint32_t capacity() const { return _capacity; }
+  const Stats& stats() const { return _stats; }
+
+private:
+  void refill(unsigned long now) {
+    if (!_started) {
+      _lastRefill = now;
+      _started = true;
+      return;
+    }
+    unsigned long elapsed = now - _lastRefill;
+    uint32_t earned = (uint32_t)(elapsed * 1000.0f * _dutyCycle);
+    if (earned == 0) return;  // keep the remainder accumulating
+    _lastRefill = now;
+    _tokens = earned >= _capacity - _tokens ? _capacity : _tokens + earned;
+  }
+
+  float _dutyCycle;
+  uint32_t _capacity;
+  uint32_t _tokens;
+  unsigned long _lastRefill = 0;
+  bool _started = false;
+  Stats _stats;
+};
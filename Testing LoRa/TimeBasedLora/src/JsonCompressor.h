@@ -0,0 +1,180 @@
+#pragma once
+
+// Static-dictionary compression for the JSON uplinks.
+//
+// The dictionary holds the fixed parts of the document generateAndSendData()
+// builds (keys with their separators, in serialization order), some generic
+// JSON fragments for documents in another order, and the digit pairs
+// 00..99 for the numbers. The encoder replaces the longest dictionary
+// match at each position with one byte; everything else is copied.
+//
+//    0     1  JSON_DICT_MAGIC
+//    1     1  JSON_DICT_VERSION
+//    2     -  tokens: 0x00..0x7F literal byte, 0x80..0xFE dictionary entry
+//               (token - 0x80), 0xFF escape followed by one literal byte
+//
+// The dictionary is constant data; the encoder's index into it takes
+// about 400 bytes of RAM. The dictionary can only change together with
+// JSON_DICT_VERSION, on the transmitters and the gateway at once.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define JSON_DICT_MAGIC 0xC1
+#define JSON_DICT_VERSION 1
+#define JSON_DICT_HEADER_SIZE 2
+#define JSON_DICT_ESCAPE 0xFF
+
+namespace json_dictionary {
+
+static const char* const ENTRIES[] = {
+  // The document from generateAndSendData()
+  "{\"type\":\"sensor\",\"lahanID\":",
+  ",\"sensor\":{\"Humidity\":",
+  ",\"Temperature\":",
+  ",\"Ec\":",
+  ",\"Ph\":",
+  ",\"Nitrogen\":",
+  ",\"Phosporus\":",
+  ",\"Kalium\":",
+  "},\"battery\":{\"voltage\":",
+  ",\"dischargeCurrent\":",
+  ",\"percentage\":",
+  ",\"chargeCurrent\":",
+  "}}",
+  // Generic fragments
+  "\"type\":",
+  "\"sensor\"",
+  "\"lahanID\":",
+  "\"battery\":",
+  "\":{\"",
+  "},\"",
+  "\":\"",
+  "\",\"",
+  ",\"",
+  "\":",
+  "{\"",
+  "\"}",
+  "true",
+  "false",
+  // Digit pairs
+  "00", "01", "02", "03", "04", "05", "06", "07", "08", "09",
+  "10", "11", "12", "13", "14", "15", "16", "17", "18", "19",
+  "20", "21", "22", "23", "24", "25", "26", "27", "28", "29",
+  "30", "31", "32", "33", "34", "35", "36", "37", "38", "39",
+  "40", "41", "42", "43", "44", "45", "46", "47", "48", "49",
+  "50", "51", "52", "53", "54", "55", "56", "57", "58", "59",
+  "60", "61", "62", "63", "64", "65", "66", "67", "68", "69",
+  "70", "71", "72", "73", "74", "75", "76", "77", "78", "79",
+  "80", "81", "82", "83", "84", "85", "86", "87", "88", "89",
+  "90", "91", "92", "93", "94", "95", "96", "97", "98", "99",
+};
+
+static const size_t COUNT = sizeof(ENTRIES) / sizeof(ENTRIES[0]);
+static_assert(COUNT <= 0x7F, "Tokens 0x80..0xFE address at most 127 entries");
+
+// Entries chained by first byte, longest first, so the first match found
+// is the longest
+struct Index {
+  int8_t head[128];
+  int8_t next[COUNT];
+  uint8_t length[COUNT];
+
+  Index() {
+    memset(head, -1, sizeof(head));
+    for (size_t i = 0; i < COUNT; i++) {
+      length[i] = (uint8_t)strlen(ENTRIES[i]);
+      uint8_t first = (uint8_t)ENTRIES[i][0];
+      int8_t* link = &head[first];
+      while (*link >= 0 && length[*link] >= length[i]) link = &next[*link];
+      next[i] = *link;
+      *link = (int8_t)i;
+    }
+  }
+};
+
+inline const Index& index() {
+  static const Index i;
+  return i;
+}
+
+}  // namespace json_dictionary
+
+// Returns the compressed size, or 0 if it does not fit in capacity.
+inline size_t compressJson(const char* json, size_t len, uint8_t* out, size_t capacity) {
+  using namespace json_dictionary;
+  const Index& idx = index();
+  if (capacity < JSON_DICT_HEADER_SIZE) return 0;
+  out[0] = JSON_DICT_MAGIC;
+  out[1] = JSON_DICT_VERSION;
+  size_t n = JSON_DICT_HEADER_SIZE;
+
+  size_t i = 0;
+  while (i < len) {
+    uint8_t c = (uint8_t)json[i];
+    int8_t match = -1;
+    if (c < 0x80) {
+      for (int8_t e = idx.head[c]; e >= 0; e = idx.next[e]) {
+        if (idx.length[e] <= len - i && memcmp(ENTRIES[e], json + i, idx.length[e]) == 0) {
+          match = e;
+          break;
+        }
+      }
+    }
+
+    if (match >= 0) {
+      if (n + 1 > capacity) return 0;
+      out[n++] = (uint8_t)(0x80 + match);
+      i += idx.length[match];
+    } else if (c < 0x80) {
+      if (n + 1 > capacity) return 0;
+      out[n++] = c;
+      i++;
+    } else {
+      if (n + 2 > capacity) return 0;
+      out[n++] = JSON_DICT_ESCAPE;
+      out[n++] = c;
+      i++;
+    }
+  }
+  return n;
+}
+
+inline bool isCompressedJson(const uint8_t* data, size_t len) {
+  return len >= JSON_DICT_HEADER_SIZE && data[0] == JSON_DICT_MAGIC;
+}
+
+// Writes the JSON text to out and NUL-terminates it. Returns its length,
+// or 0 for an unknown dictionary version, a bad token or lack of room.
+inline size_t decompressJson(const uint8_t* data, size_t len, char* out, size_t capacity) {
+  using namespace json_dictionary;
+  if (!isCompressedJson(data, len) || data[1] != JSON_DICT_VERSION || capacity == 0) return 0;
+
+  size_t n = 0;
+  for (size_t i = JSON_DICT_HEADER_SIZE; i < len; i++) {
+    uint8_t token = data[i];
+    const char* text;
+    size_t textLen;
+    char literal;
+    if (token == JSON_DICT_ESCAPE) {
+      if (++i >= len) return 0;
+      literal = (char)data[i];
+      text = &literal;
+      textLen = 1;
+    } else if (token >= 0x80) {
+      if ((size_t)(token - 0x80) >= COUNT) return 0;
+      text = ENTRIES[token - 0x80];
+      textLen = strlen(text);
+    } else {
+      literal = (char)token;
+      text = &literal;
+      textLen = 1;
+    }
+    if (n + textLen >= capacity) return 0;
+    memcpy(out + n, text, textLen);
+    n += textLen;
+  }
+  out[n] = '\0';
+  return n;
+}
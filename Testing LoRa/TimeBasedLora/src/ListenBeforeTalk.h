@@ -0,0 +1,82 @@
+#pragma once
+
+// Listen-before-talk with randomised binary exponential backoff.
+//
+// Before a transmission the caller's cad() runs channel activity detection.
+// While the channel is busy, acquire() waits and checks again; the backoff
+// window doubles with each busy check from backoffMin up to backoffMax, and
+// the wait is drawn from [window / 2, window] so nodes that heard the same
+// transmission do not retry in lock-step. After maxAttempts busy checks the
+// transmission is left to the caller to defer. maxAttempts 0 disables LBT.
+//
+// The radio, delay and random source are passed in by the caller so the
+// class has no Arduino dependency.
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct LbtConfig {
+  uint8_t maxAttempts;       // CAD checks per transmission, 0 disables
+  unsigned long backoffMin;  // ms
+  unsigned long backoffMax;  // ms
+};
+
+enum CadResult : uint8_t {
+  CAD_CLEAR,
+  CAD_BUSY,
+  CAD_TIMEOUT  // No answer from the radio; treated as clear
+};
+
+class ListenBeforeTalk {
+public:
+  struct Stats {
+    unsigned long checks = 0;
+    unsigned long busy = 0;         // Busy checks, each one a deferral
+    unsigned long timeouts = 0;
+    unsigned long gaveUp = 0;       // Transmissions deferred after maxAttempts
+    unsigned long backoffMillis = 0;
+    unsigned long maxBackoff = 0;   // Longest single wait, ms
+  };
+
+  explicit ListenBeforeTalk(const LbtConfig& config) : _config(config) {}
+
+  bool enabled() const { return _config.maxAttempts > 0; }
+
+  // Returns true when the caller may transmit. cad() returns a CadResult,
+  // wait(ms) blocks, random(n) returns a value in [0, n).
+  template <typename CadFn, typename WaitFn, typename RandomFn>
+  bool acquire(CadFn cad, WaitFn wait, RandomFn random) {
+    if (!enabled()) return true;
+
+    for (uint8_t attempt = 0; attempt < _config.maxAttempts; attempt++) {
+      _stats.checks++;
+      CadResult result = cad();
+      if (result == CAD_TIMEOUT) _stats.timeouts++;
+      if (result != CAD_BUSY) return true;
+
+      _stats.busy++;
+      if (attempt + 1 == _config.maxAttempts) break;  // No point waiting to give up
+      unsigned long window = backoffWindow(attempt);
+      unsigned long backoff = window / 2 + random(window / 2 + 1);
+      _stats.backoffMillis += backoff;
+      if (backoff > _stats.maxBackoff) _stats.maxBackoff = backoff;
+      wait(backoff);
+    }
+    _stats.gaveUp++;
+    return false;
+  }
+
+  // Upper bound of the backoff after the attempt-th busy check, in ms
+  unsigned long backoffWindow(uint8_t attempt) const {
+    unsigned long window = _config.backoffMin;
+    for (uint8_t i = 0; i < attempt && window < _config.backoffMax; i++) window *= 2;
+    return window < _config.backoffMax ? window : _config.backoffMax;
+  }
+
+  const LbtConfig& config() const { return _config; }
+  const Stats& stats() const { return _stats; }
+
+private:
+  LbtConfig _config;
+  Stats _stats;
+};
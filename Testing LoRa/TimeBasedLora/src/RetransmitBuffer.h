@@ -0,0 +1,149 @@
+#pragma once
+
+// Retransmit buffer for acknowledged uplinks (ARQ), see LoRaProtocol.h.
+//
+// Each new uplink is stamped with the next 16-bit sequence number and kept
+// until an ACK covers it. An ACK carries the highest sequence the gateway
+// has received plus a bitmap of the ARQ_ACK_BITS before it, so one ACK can
+// confirm several packets and also names the ones that are missing; those
+// are due for retransmission straight away, while packets an ACK says
+// nothing about wait for retryTimeout. A packet is given up after
+// maxAttempts transmissions, and when the buffer is full the oldest packet
+// makes room for the new one.
+//
+// Time is passed in by the caller.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "LoRaProtocol.h"
+
+template <size_t CAPACITY, size_t MAX_FRAME>
+class RetransmitBuffer {
+public:
+  struct Entry {
+    bool used;
+    bool missing;          // An ACK reported it lost
+    uint16_t sequence;
+    uint8_t attempts;
+    unsigned long sentAt;  // Last transmission
+    size_t len;
+    uint8_t frame[MAX_FRAME];
+  };
+
+  struct Stats {
+    unsigned long sent = 0;         // New packets
+    unsigned long retransmits = 0;
+    unsigned long firstLosses = 0;  // Packets that needed at least one retransmission
+    unsigned long acked = 0;
+    unsigned long acks = 0;
+    unsigned long givenUp = 0;      // Out of attempts
+    unsigned long evicted = 0;      // Pushed out by newer packets
+  };
+
+  RetransmitBuffer(unsigned long retryTimeout, uint8_t maxAttempts)
+      : _retryTimeout(retryTimeout), _maxAttempts(maxAttempts) {
+    for (size_t i = 0; i < CAPACITY; i++) _entries[i].used = false;
+  }
+
+  // Start from a random sequence so the gateway does not take the first
+  // packets after a reboot for duplicates
+  void begin(uint16_t firstSequence) { _nextSequence = firstSequence; }
+
+  uint16_t nextSequence() const { return _nextSequence; }
+
+  // Keeps a frame that was just sent with nextSequence().
+  void add(const uint8_t* frame, size_t len, unsigned long now) {
+    if (len > MAX_FRAME) return;
+    Entry* slot = nullptr;
+    for (size_t i = 0; i < CAPACITY && slot == nullptr; i++) {
+      if (!_entries[i].used) slot = &_entries[i];
+    }
+    if (slot == nullptr) {
+      slot = oldest();
+      _stats.evicted++;
+    }
+    slot->used = true;
+    slot->missing = false;
+    slot->sequence = _nextSequence++;
+    slot->attempts = 1;
+    slot->sentAt = now;
+    slot->len = len;
+    memcpy(slot->frame, frame, len);
+    _stats.sent++;
+  }
+
+  // Returns the number of buffered packets the ACK confirmed.
+  size_t acknowledge(const ArqAck& ack) {
+    size_t confirmed = 0;
+    _stats.acks++;
+    for (size_t i = 0; i < CAPACITY; i++) {
+      Entry& e = _entries[i];
+      if (!e.used) continue;
+      if (arqAcknowledges(ack, e.sequence)) {
+        e.used = false;
+        _stats.acked++;
+        confirmed++;
+      } else {
+        int16_t behind = (int16_t)(ack.sequence - e.sequence);
+        if (behind > 0 && behind <= ARQ_ACK_BITS) e.missing = true;
+      }
+    }
+    return confirmed;
+  }
+
+  // The oldest packet due for retransmission, or nullptr. Packets that
+  // are out of attempts are dropped here.
+  Entry* due(unsigned long now) {
+    Entry* next = nullptr;
+    for (size_t i = 0; i < CAPACITY; i++) {
+      Entry& e = _entries[i];
+      if (!e.used || (!e.missing && now - e.sentAt < _retryTimeout)) continue;
+      if (e.attempts >= _maxAttempts) {
+        e.used = false;
+        _stats.givenUp++;
+        continue;
+      }
+      if (next == nullptr || (int16_t)(e.sequence - next->sequence) < 0) next = &e;
+    }
+    return next;
+  }
+
+  void retransmitted(Entry& e, unsigned long now) {
+    if (e.attempts == 1) _stats.firstLosses++;
+    e.attempts++;
+    e.sentAt = now;
+    e.missing = false;
+    _stats.retransmits++;
+  }
+
+  size_t pending() const {
+    size_t n = 0;
+    for (size_t i = 0; i < CAPACITY; i++) {
+      if (_entries[i].used) n++;
+    }
+    return n;
+  }
+
+  // Fraction of new packets that were not acknowledged on the first try
+  float lossRate() const {
+    return _stats.sent ? (float)_stats.firstLosses / _stats.sent : 0.0f;
+  }
+
+  const Stats& stats() const { return _stats; }
+
+private:
+  Entry* oldest() {
+    Entry* e = &_entries[0];
+    for (size_t i = 1; i < CAPACITY; i++) {
+      if ((int16_t)(_entries[i].sequence - e->sequence) < 0) e = &_entries[i];
+    }
+    return e;
+  }
+
+  Entry _entries[CAPACITY];
+  uint16_t _nextSequence = 0;
+  unsigned long _retryTimeout;
+  uint8_t _maxAttempts;
+  Stats _stats;
+};
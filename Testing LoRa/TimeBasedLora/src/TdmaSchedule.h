@@ -0,0 +1,73 @@
+#pragma once
+
+// Slot timing for beacon-synchronised transmission.
+//
+// The gateway broadcasts a beacon every superframe. A node's slot is
+//   beacon end + first slot offset + ((lahanID - 1) % slot count) * slot length
+// so nodes with different lahanIDs never overlap as long as there are no
+// more of them than slots. Between beacons the schedule runs on the
+// node's own clock; a missed beacon is replaced by the expected one, and
+// the node drops out of sync after maxMissed in a row.
+//
+// Times are millis() values passed in by the caller.
+
+#include <stdint.h>
+#include <stddef.h>
+#include "LoRaProtocol.h"
+
+class TdmaSchedule {
+public:
+  TdmaSchedule(uint16_t lahanID, unsigned long guard, uint8_t maxMissed)
+      : _lahanID(lahanID), _guard(guard), _maxMissed(maxMissed) {}
+
+  // receivedAt is when the beacon finished arriving
+  void onBeacon(const BeaconInfo& beacon, unsigned long receivedAt) {
+    _beacon = beacon;
+    _beaconAt = receivedAt;
+    _synced = true;
+    _missed = 0;
+    _slotDone = false;
+  }
+
+  // Moves on to the next superframe without a beacon. Returns false once
+  // too many were missed and the node has to search again.
+  bool missBeacon() {
+    _beaconAt += _beacon.period;
+    _slotDone = false;
+    if (++_missed > _maxMissed) _synced = false;
+    return _synced;
+  }
+
+  bool synced() const { return _synced; }
+  uint8_t missed() const { return _missed; }
+  const BeaconInfo& beacon() const { return _beacon; }
+
+  uint16_t slotIndex() const {
+    return _beacon.slotCount ? (uint16_t)((_lahanID - 1) % _beacon.slotCount) : 0;
+  }
+
+  unsigned long slotStart() const {
+    return _beaconAt + _beacon.firstSlotOffset + (unsigned long)slotIndex() * _beacon.slotLength;
+  }
+
+  // The receiver should be on from beaconWindowStart() until
+  // beaconWindowEnd() to catch the next beacon
+  unsigned long nextBeaconAt() const { return _beaconAt + _beacon.period; }
+  unsigned long beaconWindowStart(unsigned long beaconAirtime) const {
+    return nextBeaconAt() - beaconAirtime - _guard * (_missed + 1);
+  }
+  unsigned long beaconWindowEnd() const { return nextBeaconAt() + _guard * (_missed + 1); }
+
+  bool slotDone() const { return _slotDone; }
+  void markSlotDone() { _slotDone = true; }
+
+private:
+  uint16_t _lahanID;
+  unsigned long _guard;
+  uint8_t _maxMissed;
+  BeaconInfo _beacon = {};
+  unsigned long _beaconAt = 0;
+  uint8_t _missed = 0;
+  bool _synced = false;
+  bool _slotDone = false;
+};
@@ -1,14 +1,42 @@
 #include <Arduino.h>
+#include <esp_timer.h>
 #include <axp20x.h>
+#include "SensorFrame.h"
+#include "SensorJson.h"
+#include "LoRaAirtime.h"
+#include "DutyCycleLimiter.h"
+#include "ListenBeforeTalk.h"
+#include "LoRaProtocol.h"
+#include "TdmaSchedule.h"
+#include "RetransmitBuffer.h"
+#include "ReedSolomon.h"
+#include "JsonCompressor.h"
+#include "Log.h"
+#include "StageTrace.h"
+#include "GpsTime.h"
 #include <ArduinoJson.h>
 #include <Wire.h>
 #include <LoRa.h>
 
+// Logging, see Log.h. loop() only queues records; logTask() formats and
+// prints them from core 0, next to the otherwise idle protocol CPU.
+#define LOG_DRAIN_MS 20
+Logger<LOG_QUEUE_SIZE> logger(millis);
+
 // Data settings
 const int LAHAN_ID = 1;
 const unsigned long SEND_INTERVAL = 120000; // 2 minutes in milliseconds
 unsigned long lastSendTime = 0;
 
+// After each send one group of statistics is printed, in turn, so a send
+// never puts more than 1 + STAGE_COUNT records in the log ring at once
+enum { REPORT_DUTY_CYCLE, REPORT_LINK, REPORT_HEAP, REPORT_TRACE,
+#ifdef GPS_TIME
+       REPORT_GPS,
+#endif
+       REPORT_COUNT };
+uint8_t nextReport = REPORT_DUTY_CYCLE;
+
 // LoRa settings
 #define SS 18
 #define RST 14
@@ -16,13 +44,213 @@ unsigned long lastSendTime = 0;
 #define SCK 5
 #define MISO 19
 #define MOSI 27
+#define LORA_MAX_PAYLOAD 255
+
+// Modulation applied in setupLoRa(); airtime estimates are computed from it
+constexpr LoRaModulation LORA_MODULATION = {7, 125000, 5, 8, true, false};  // SF7, 125 kHz, 4/5
+static_assert(loraAirtimeMicros(LORA_MODULATION, LORA_MAX_PAYLOAD) <= 400000,
+              "Largest packet exceeds the 400 ms US915 dwell time");
+
+// Duty-cycle budget, see DutyCycleLimiter.h. A packet over budget is held
+// until the bucket refills; a newer packet replaces the held one.
+const float DUTY_CYCLE = 0.01;                   // 1% of airtime
+const unsigned long DUTY_CYCLE_WINDOW = 600000;  // Bursts of up to 10 minutes' budget
+DutyCycleLimiter dutyCycle(DUTY_CYCLE, DUTY_CYCLE_WINDOW);
+uint8_t heldPacket[LORA_MAX_PAYLOAD];
+size_t heldPacketLen = 0;
+unsigned long packetsMerged = 0;
+
+// The send path works in fixed buffers: readings go into a SensorReading
+// on the stack, are written into jsonFrame by writeSensorJson() (no
+// JsonDocument, see SensorJson.h) and handed to the radio as a pointer and
+// length, so nothing between taking a sample and transmitting it touches
+// the heap. The free heap and its low-water mark are captured when the
+// sample is taken and checked again just before TX, see checkHeap().
+char jsonFrame[LORA_MAX_PAYLOAD + 1];  // writeSensorJson() adds a NUL
+#ifdef LORA_JSON_COMPRESSION
+uint8_t compressedFrame[LORA_MAX_PAYLOAD];
+#endif
+
+// Stage latency, see StageTrace.h. Send 't' over Serial for the
+// histograms, 'r' to reset them. With -D TRACE_TELEMETRY_EVERY=<n> a
+// summary (p50, p90 and max per stage, in us) also goes out as its own
+// {"type":"trace"} packet after every n readings; readings take priority
+// and replace it if it has to be held.
+enum { STAGE_SENSORS, STAGE_AXP, STAGE_SERIALIZE, STAGE_LBT, STAGE_LORA_TX, STAGE_RX_WINDOW, STAGE_COUNT };
+const char* const STAGE_NAMES[STAGE_COUNT] = {"sensors", "axp", "serialize", "lbt", "lora_tx", "rx_window"};
+StageTracer<STAGE_COUNT> tracer(STAGE_NAMES, esp_timer_get_time);
+#ifndef TRACE_TELEMETRY_EVERY
+#define TRACE_TELEMETRY_EVERY 0
+#endif
+#if TRACE_TELEMETRY_EVERY > 0
+char traceFrame[LORA_MAX_PAYLOAD + 1];
+unsigned long readingsSinceTrace = 0;
+bool tracePending = false;
+#endif
+
+#ifdef GPS_TIME
+// GPS time, see GpsTime.h. Readings carry their capture time as "ts" (Unix
+// ms) once the clock has a source. The GPS is powered from LDO3 and talks
+// NMEA on UART1; its PPS output is not routed to the ESP32 on v1.x boards,
+// so set -D GPS_PPS_PIN=<gpio> only where a wire was added.
+#define GPS_RX 34
+#define GPS_TX 12
+#define GPS_BAUD 9600
+#ifndef GPS_PPS_PIN
+#define GPS_PPS_PIN -1
+#endif
+// Echoed sentences are logged by pointer, see Log.h. A slot is only reused
+// once LOG_QUEUE_SIZE later lines were queued, so its record has drained.
+#define GPS_ECHO_LINES (LOG_QUEUE_SIZE + 1)
+NmeaParser nmea;
+GpsClock gpsClock;
+volatile int64_t ppsMicros = 0;
+volatile uint32_t ppsCount = 0;
+uint32_t ppsSeen = 0;
+int64_t lastGpsPoll = 0;
+bool gpsEcho = false;
+char gpsEchoLines[GPS_ECHO_LINES][NMEA_MAX_SENTENCE + 1];
+size_t gpsEchoNext = 0;
+#endif
+
+struct HeapStats {
+  unsigned long checks = 0;
+  unsigned long violations = 0;  // Heap used between sample and TX
+  uint32_t worstDrop = 0;        // bytes
+} heapStats;
+bool heapCheckArmed = false;
+uint32_t heapAtSample = 0;
+uint32_t heapMinAtSample = 0;
+
+// Listen-before-talk, see ListenBeforeTalk.h. Each transmission is preceded
+// by channel activity detection; if the channel stays busy the packet is
+// held like one over the duty-cycle budget. Tune per deployment with e.g.
+// -D LBT_MAX_ATTEMPTS=8, or disable with -D LBT_MAX_ATTEMPTS=0.
+#ifndef LBT_MAX_ATTEMPTS
+#define LBT_MAX_ATTEMPTS 5
+#endif
+#ifndef LBT_BACKOFF_MIN_MS
+#define LBT_BACKOFF_MIN_MS 20
+#endif
+#ifndef LBT_BACKOFF_MAX_MS
+#define LBT_BACKOFF_MAX_MS 640
+#endif
+#define CAD_TIMEOUT_SYMBOLS 4  // CAD takes about two symbols
+const LbtConfig LBT_CONFIG = {LBT_MAX_ATTEMPTS, LBT_BACKOFF_MIN_MS, LBT_BACKOFF_MAX_MS};
+ListenBeforeTalk lbt(LBT_CONFIG);
+bool lbtDeferred = false;  // LBT gave up; the held packet waits LBT_BACKOFF_MAX_MS
+unsigned long lbtDeferredAt = 0;
+volatile bool cadDone = false;
+volatile bool cadDetected = false;
+
+#ifdef LORA_FEC
+// Reed-Solomon FEC, see ReedSolomon.h: LORA_FEC_PARITY check bytes repair
+// up to half as many corrupted bytes at the gateway
+#ifndef LORA_FEC_PARITY
+#define LORA_FEC_PARITY 16
+#endif
+#define FEC_OVERHEAD (FEC_HEADER_SIZE + FEC_CHECK_SIZE + LORA_FEC_PARITY)
+static_assert(!LORA_MODULATION.crc, "With radio CRC on, damaged packets never reach the FEC decoder");
+ReedSolomon fec(LORA_FEC_PARITY);
+uint8_t fecFrame[LORA_MAX_PAYLOAD];
+#else
+#define FEC_OVERHEAD 0
+#endif
+
+#ifdef LORA_ARQ
+// Acknowledged uplinks, see RetransmitBuffer.h. Packets carry a sequence
+// number; the gateway's ACK arrives in the receive window after the uplink.
+#define ARQ_WINDOW 8                 // Unacknowledged packets kept for retransmission
+#define ARQ_RETRY_MS 30000           // Retransmit if no ACK covered a packet by then
+#define ARQ_MAX_ATTEMPTS 4
+#define LORA_MAX_DATA (LORA_MAX_PAYLOAD - FEC_OVERHEAD - ARQ_HEADER_SIZE)
+RetransmitBuffer<ARQ_WINDOW, LORA_MAX_PAYLOAD> arq(ARQ_RETRY_MS, ARQ_MAX_ATTEMPTS);
+uint8_t arqFrame[LORA_MAX_PAYLOAD];
+#else
+#define LORA_MAX_DATA (LORA_MAX_PAYLOAD - FEC_OVERHEAD)
+#endif
+
+// Adaptive data rate: after each uplink the node listens briefly for a
+// downlink from the gateway and applies the SF/TX power it recommends
+#define LORA_TX_POWER 17            // dBm, LoRa.begin() default
+#define RX_WINDOW_MS 200            // Gateway turnaround; the downlink airtime is added
+#define ADR_FALLBACK_UPLINKS 32     // Back to defaults after this many uplinks without a downlink
+LoRaModulation modulation = LORA_MODULATION;  // Current settings, changed by ADR
+int8_t txPower = LORA_TX_POWER;
+uint8_t uplinksSinceDownlink = 0;
+
+struct LinkStats {
+  unsigned long windows = 0;
+  unsigned long downlinks = 0;
+  unsigned long adrChanges = 0;
+  unsigned long fallbacks = 0;
+  unsigned long rxOnMillis = 0;  // Receiver on time: RX windows and beacon listening
+} linkStats;
+
+#ifdef LORA_TDMA
+// Time-slotted uplinks, see TdmaSchedule.h. The gateway must be built with
+// LORA_TDMA too. The radio sleeps between the beacon and the node's slot;
+// until the first beacon is heard the node keeps its unslotted behaviour.
+#define TDMA_GUARD_MS 50      // Beacon window widening each side, per missed beacon
+#define TDMA_MAX_MISSED 3     // Search again after this many missed beacons
+#define TDMA_SEARCH_MS 1000   // Listening stretch while searching for a beacon
+#define TDMA_WAKE_MS 5        // Radio wake-up ahead of the slot
+TdmaSchedule tdma(LAHAN_ID, TDMA_GUARD_MS, TDMA_MAX_MISSED);
+
+struct TdmaStats {
+  unsigned long beacons = 0;
+  unsigned long missedBeacons = 0;
+  unsigned long syncLosses = 0;
+  unsigned long slots = 0;
+  unsigned long lateSlots = 0;
+} tdmaStats;
+#endif
 
 AXP20X_Class axp;
 
+void logTask(void* parameter);
 void setupLoRa();
-void sendLoRaMessage(String message);
+void sendLoRaMessage(const uint8_t* data, size_t len);
+void queueLoRaPacket(const uint8_t* data, size_t len);
+bool transmitLoRaPacket(const uint8_t* data, size_t len);
+bool sendRadioPacket(const uint8_t* data, size_t len);
+bool radioAvailable(size_t len);
+void sendHeldPacket();
+void printDutyCycleStats();
+void armHeapCheck();
+void checkHeap();
+void printHeapStats();
+void serviceSerialCommands();
+void printTraceStats();
+#ifdef GPS_TIME
+void setupGps();
+void serviceGps();
+void printGpsStats();
+#endif
+#if TRACE_TELEMETRY_EVERY > 0
+void sendTraceTelemetry();
+#endif
+void onCadDone(bool detected);
+CadResult runCad();
+void printLbtStats();
+void openReceiveWindow();
+bool handleDownlink(const uint8_t* data, size_t len, uint8_t& type);
+void applyLinkSettings(uint8_t spreadingFactor, int8_t power);
+void printLinkStats();
+#ifdef LORA_ARQ
+void serviceArq();
+#endif
+#ifdef LORA_TDMA
+void runTdma();
+bool listenForBeacon(unsigned long deadline);
+void onSlot();
+#endif
 void generateAndSendData();
-void getBatteryInfo(JsonObject& battery);
+void printNextReport();
+void getBatteryInfo(SensorReading& reading);
+#ifdef LORA_BINARY_FRAME
+void sendLoRaFrame(const uint8_t* frame, size_t len);
+#endif
 
 float randomFloat(float min, float max) {
   return (float)random(min * 100, max * 100) / 100;
@@ -30,38 +258,83 @@ float randomFloat(float min, float max) {
 
 void setup() {
   Serial.begin(115200);
+  xTaskCreatePinnedToCore(logTask, "log", 4096, nullptr, 1, nullptr, 0);
   randomSeed(analogRead(0));
 
   // Initialize I2C for AXP192
   Wire.begin(21, 22);
   if (axp.begin(Wire, AXP192_SLAVE_ADDRESS) == AXP_FAIL) {
-    Serial.println(F("Failed to initialize communication with AXP192"));
+    LOG_ERROR("Failed to initialize communication with AXP192");
   }
 
   // Setup LoRa
   setupLoRa();
+#ifdef GPS_TIME
+  setupGps();
+#endif
+#ifdef LORA_ARQ
+  arq.begin((uint16_t)random(0x10000));
+#endif
 
-  Serial.println("Periodic Sensor Data Transmitter Started!");
+  LOG_INFO("Periodic Sensor Data Transmitter Started!");
 }
 
 void loop() {
+#ifdef GPS_TIME
+  serviceGps();
+#endif
+  serviceSerialCommands();
+#if TRACE_TELEMETRY_EVERY > 0
+  if (tracePending && heldPacketLen == 0) {
+    sendTraceTelemetry();
+  }
+#endif
+#ifdef LORA_TDMA
+  runTdma();
+  if (tdma.synced()) {
+    return;  // Readings are taken in the slot, see onSlot()
+  }
+#endif
   unsigned long currentTime = millis();
   if (currentTime - lastSendTime >= SEND_INTERVAL) {
     generateAndSendData();
     lastSendTime = currentTime;
   }
+  sendHeldPacket();
+#ifdef LORA_ARQ
+  serviceArq();
+#endif
+}
+
+void logTask(void* parameter) {
+  for (;;) {
+    logger.drain([](const char* line, size_t len) { Serial.write((const uint8_t*)line, len); });
+    vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_MS));
+  }
 }
 
 void setupLoRa() {
   LoRa.setPins(SS, RST, DIO0);
   if (!LoRa.begin(915E6)) {
-    Serial.println("Starting LoRa failed!");
+    LOG_ERROR("Starting LoRa failed!");
     while (1);
   }
-  Serial.println("LoRa initialized");
+  LoRa.setSpreadingFactor(LORA_MODULATION.spreadingFactor);
+  LoRa.setSignalBandwidth(LORA_MODULATION.bandwidth);
+  LoRa.setCodingRate4(LORA_MODULATION.codingRate);
+  LoRa.setPreambleLength(LORA_MODULATION.preambleLength);
+  LoRa.setTxPower(LORA_TX_POWER);
+  if (LORA_MODULATION.crc) {
+    LoRa.enableCrc();
+  } else {
+    LoRa.disableCrc();
+  }
+  LOG_INFO("LoRa initialized, SF%u, %lu ms airtime budget",
+           LORA_MODULATION.spreadingFactor, (unsigned long)(dutyCycle.capacity() / 1000));
 }
 
-void getBatteryInfo(JsonObject& battery) {
+void getBatteryInfo(SensorReading& reading) {
+  TRACE_SCOPE(tracer, STAGE_AXP);
   float batteryVoltage = axp.getBattVoltage();
   float batteryPercentage = (batteryVoltage - 3300) / (4200 - 3300) * 100;
   if (batteryPercentage > 100) batteryPercentage = 100;
@@ -70,23 +343,556 @@ void getBatteryInfo(JsonObject& battery) {
   float chargeCurrent = axp.getBattChargeCurrent();
   float dischargeCurrent = axp.getBattDischargeCurrent();
 
-  battery["voltage"] = batteryVoltage;
-  battery["dischargeCurrent"] = dischargeCurrent;
-  battery["percentage"] = batteryPercentage;
-  battery["chargeCurrent"] = chargeCurrent;
+  reading.batteryVoltage = batteryVoltage;
+  reading.dischargeCurrent = dischargeCurrent;
+  reading.batteryPercentage = batteryPercentage;
+  reading.chargeCurrent = chargeCurrent;
 }
 
-void sendLoRaMessage(String message) {
+void sendLoRaMessage(const uint8_t* data, size_t len) {
+#ifdef LORA_JSON_COMPRESSION
+  // Same JSON, dictionary-compressed, see JsonCompressor.h
+  size_t compressedLen = compressJson((const char*)data, len, compressedFrame, sizeof(compressedFrame));
+  if (compressedLen > 0) {
+    LOG_DEBUG("JSON compressed %u -> %u bytes", (unsigned)len, (unsigned)compressedLen);
+    queueLoRaPacket(compressedFrame, compressedLen);
+    return;
+  }
+#endif
+  queueLoRaPacket(data, len);
+}
+
+// Sends now if the duty-cycle budget allows, otherwise holds the packet for
+// sendHeldPacket(). Only one packet is held: a newer one carries the latest
+// readings, so it replaces (merges into) whatever was waiting.
+void queueLoRaPacket(const uint8_t* data, size_t len) {
+  if (len > LORA_MAX_DATA) {
+    LOG_WARN("Packet of %u bytes exceeds the LoRa maximum, dropped", (unsigned)len);
+    return;
+  }
+  bool sendNow = heldPacketLen == 0;
+#ifdef LORA_TDMA
+  sendNow = sendNow && !tdma.synced();  // Wait for the slot
+#endif
+  if (sendNow && transmitLoRaPacket(data, len)) {
+    return;
+  }
+
+  if (heldPacketLen > 0) {
+    packetsMerged++;
+    LOG_WARN("Held packet replaced by newer reading");
+  }
+  memcpy(heldPacket, data, len);
+  heldPacketLen = len;
+#ifdef LORA_TDMA
+  if (tdma.synced()) {
+    return;
+  }
+#endif
+  unsigned long wait = dutyCycle.waitTime(loraAirtimeMicros(modulation, len + FEC_OVERHEAD), millis());
+  if (wait > 0) {
+    LOG_WARN("Duty-cycle budget exhausted, packet held for %lu ms", wait);
+  } else {
+    LOG_WARN("Channel busy, packet held");
+  }
+}
+
+// Sends a new packet, stamped with the next ARQ sequence when enabled
+bool transmitLoRaPacket(const uint8_t* data, size_t len) {
+#ifdef LORA_ARQ
+  ArqHeader header = {LAHAN_ID, arq.nextSequence()};
+  size_t frameLen = encodeArqUplink(header, data, len, arqFrame, sizeof(arqFrame));
+  if (!sendRadioPacket(arqFrame, frameLen)) {
+    return false;
+  }
+  arq.add(arqFrame, frameLen, millis());
+#else
+  if (!sendRadioPacket(data, len)) {
+    return false;
+  }
+#endif
+  openReceiveWindow();
+  return true;
+}
+
+// Transmits once the channel is clear and the duty-cycle budget allows
+bool sendRadioPacket(const uint8_t* data, size_t len) {
+  uint32_t airtime = loraAirtimeMicros(modulation, len + FEC_OVERHEAD);
+  // Only listen when the budget allows sending, and only spend the budget
+  // once the channel is clear
+  if (dutyCycle.waitTime(airtime, millis()) == 0) {
+    int64_t lbtStart = tracer.now();
+    bool clear = lbt.acquire(runCad, delay, [](unsigned long n) { return (unsigned long)random((long)n); });
+    tracer.recordSince(STAGE_LBT, lbtStart);
+    if (!clear) {
+      lbtDeferred = true;
+      lbtDeferredAt = millis();
+      return false;
+    }
+  }
+  lbtDeferred = false;
+  if (!dutyCycle.tryConsume(airtime, millis())) {
+    return false;
+  }
+#ifdef LORA_FEC
+  len = encodeFecFrame(fec, data, len, fecFrame, sizeof(fecFrame));
+  data = fecFrame;
+#endif
+  checkHeap();
+  int64_t txStart = tracer.now();
   LoRa.beginPacket();
-  LoRa.print(message);
+  LoRa.write(data, len);
   LoRa.endPacket();
-  Serial.println("LoRa message sent: " + message);
+  tracer.recordSince(STAGE_LORA_TX, txStart);
+  LOG_INFO("LoRa packet sent (%u bytes, %.1f ms airtime, %.1f ms budget left)",
+           (unsigned)len, airtime / 1000.0, dutyCycle.remaining(millis()) / 1000.0);
+  return true;
 }
 
-void generateAndSendData() {
-  StaticJsonDocument<300> doc;
+// False while the duty-cycle budget or a recent LBT give-up holds sending back
+bool radioAvailable(size_t len) {
+  if (lbtDeferred && millis() - lbtDeferredAt < LBT_BACKOFF_MAX_MS) {
+    return false;
+  }
+  return dutyCycle.waitTime(loraAirtimeMicros(modulation, len + FEC_OVERHEAD), millis()) == 0;
+}
 
+// Blocks for the turnaround plus the airtime of a downlink. The gateway
+// answers as soon as it has decoded the uplink, before forwarding it, so
+// the window can stay short. With ARQ an ADR command, if any, comes before
+// the ACK, and the window ends with the ACK.
+void openReceiveWindow() {
+  TRACE_SCOPE(tracer, STAGE_RX_WINDOW);
+  uint8_t buffer[LORA_MAX_PAYLOAD];
+  bool heard = false;
+  bool done = false;
+  unsigned long window = RX_WINDOW_MS + loraAirtimeMicros(modulation, DOWNLINK_ADR_SIZE) / 1000;
+#ifdef LORA_ARQ
+  window += loraAirtimeMicros(modulation, DOWNLINK_ACK_SIZE) / 1000;
+#endif
+
+  linkStats.windows++;
+  LoRa.enableInvertIQ();
+  unsigned long start = millis();
+  while (!done && millis() - start < window) {
+    int packetSize = LoRa.parsePacket();
+    if (packetSize == 0) {
+      continue;
+    }
+    size_t len = 0;
+    while (LoRa.available()) {
+      int b = LoRa.read();
+      if (len < sizeof(buffer)) {
+        buffer[len++] = (uint8_t)b;
+      }
+    }
+    uint8_t type;
+    if (handleDownlink(buffer, len, type)) {
+      heard = true;
+#ifdef LORA_ARQ
+      done = type == DOWNLINK_ACK;
+#else
+      done = true;
+#endif
+    }
+  }
+  LoRa.disableInvertIQ();
+  LoRa.idle();
+  linkStats.rxOnMillis += millis() - start;
+
+  if (heard) {
+    uplinksSinceDownlink = 0;
+  } else if (++uplinksSinceDownlink >= ADR_FALLBACK_UPLINKS &&
+             (modulation.spreadingFactor != LORA_MODULATION.spreadingFactor || txPower != LORA_TX_POWER)) {
+    LOG_WARN("ADR: no downlink for too long, back to default settings");
+    linkStats.fallbacks++;
+    applyLinkSettings(LORA_MODULATION.spreadingFactor, LORA_TX_POWER);
+  }
+}
+
+// Returns true if data is a downlink addressed to this node
+bool handleDownlink(const uint8_t* data, size_t len, uint8_t& type) {
+  uint16_t target;
+  if (!decodeDownlinkHeader(data, len, type, target) || target != LAHAN_ID) {
+    return false;
+  }
+  linkStats.downlinks++;
+
+  AdrCommand command;
+  if (type == DOWNLINK_ADR && decodeAdrDownlink(data, len, command)) {
+    applyLinkSettings(command.spreadingFactor, command.txPower);
+  }
+#ifdef LORA_ARQ
+  ArqAck ack;
+  if (type == DOWNLINK_ACK && decodeAckDownlink(data, len, ack)) {
+    arq.acknowledge(ack);
+  }
+#endif
+  return true;
+}
+
+void applyLinkSettings(uint8_t spreadingFactor, int8_t power) {
+  if (spreadingFactor == modulation.spreadingFactor && power == txPower) {
+    return;
+  }
+  LOG_INFO("ADR: SF%u -> SF%u, %d -> %d dBm",
+           modulation.spreadingFactor, spreadingFactor, txPower, power);
+  modulation.spreadingFactor = spreadingFactor;
+  txPower = power;
+  LoRa.setSpreadingFactor(spreadingFactor);
+  LoRa.setTxPower(power);
+  linkStats.adrChanges++;
+}
+
+void printLinkStats() {
+  LOG_INFO("Link Statistics:");
+  LOG_INFO("SF%u, %d dBm, RX windows: %lu, Downlinks: %lu, ADR changes: %lu, Fallbacks: %lu",
+           modulation.spreadingFactor, txPower, linkStats.windows, linkStats.downlinks,
+           linkStats.adrChanges, linkStats.fallbacks);
+  LOG_INFO("Receiver on: %lu ms", linkStats.rxOnMillis);
+#ifdef LORA_ARQ
+  const auto& arqStats = arq.stats();
+  LOG_INFO("ARQ: next seq %u, Sent: %lu, Acked: %lu, Retransmits: %lu, Given up: %lu, Evicted: %lu, "
+           "Pending: %u, Loss: %.1f%%",
+           arq.nextSequence(), arqStats.sent, arqStats.acked, arqStats.retransmits, arqStats.givenUp,
+           arqStats.evicted, (unsigned)arq.pending(), arq.lossRate() * 100);
+#endif
+#ifdef LORA_TDMA
+  LOG_INFO("TDMA %s, slot %u: Beacons: %lu, Missed: %lu, Sync lost: %lu, Slots: %lu, Late: %lu",
+           tdma.synced() ? "synced" : "searching", tdma.slotIndex(), tdmaStats.beacons,
+           tdmaStats.missedBeacons, tdmaStats.syncLosses, tdmaStats.slots, tdmaStats.lateSlots);
+#endif
+}
+
+#ifdef LORA_TDMA
+// Called from loop(). Listens for the beacon around its expected time,
+// transmits in the node's slot and keeps the radio asleep otherwise.
+void runTdma() {
+  if (!tdma.synced()) {
+    // Short stretches so loop() keeps running while searching
+    listenForBeacon(millis() + TDMA_SEARCH_MS);
+    LoRa.sleep();
+    return;
+  }
+
+  unsigned long now = millis();
+  if (!tdma.slotDone() && (long)(now - (tdma.slotStart() - TDMA_WAKE_MS)) >= 0) {
+    tdma.markSlotDone();
+    if ((long)(now - tdma.slotStart()) > (long)(tdma.beacon().slotLength / 2)) {
+      // Too late to finish before the next node's slot
+      tdmaStats.lateSlots++;
+      return;
+    }
+    LoRa.idle();
+    while ((long)(millis() - tdma.slotStart()) < 0) {
+    }
+    tdmaStats.slots++;
+    onSlot();
+    LoRa.sleep();
+    return;
+  }
+
+  unsigned long beaconAirtime = loraAirtimeMicros(modulation, DOWNLINK_BEACON_SIZE) / 1000;
+  if ((long)(now - tdma.beaconWindowStart(beaconAirtime)) >= 0) {
+    if (!listenForBeacon(tdma.beaconWindowEnd())) {
+      tdmaStats.missedBeacons++;
+      if (!tdma.missBeacon()) {
+        tdmaStats.syncLosses++;
+        LOG_WARN("TDMA: beacons lost, searching");
+      }
+    }
+    LoRa.sleep();
+  }
+}
+
+// Beacons are sent with inverted IQ like other downlinks. Returns true
+// once one was received before deadline.
+bool listenForBeacon(unsigned long deadline) {
+  uint8_t buffer[LORA_MAX_PAYLOAD];
+  bool heard = false;
+
+  LoRa.enableInvertIQ();
+  unsigned long start = millis();
+  while (!heard && (long)(millis() - deadline) < 0) {
+    int packetSize = LoRa.parsePacket();
+    if (packetSize == 0) {
+      continue;
+    }
+    size_t len = 0;
+    while (LoRa.available()) {
+      int b = LoRa.read();
+      if (len < sizeof(buffer)) {
+        buffer[len++] = (uint8_t)b;
+      }
+    }
+    BeaconInfo beacon;
+    if (decodeBeaconDownlink(buffer, len, beacon)) {
+      tdma.onBeacon(beacon, millis());
+      heard = true;
+    }
+  }
+  LoRa.disableInvertIQ();
+  LoRa.idle();
+  linkStats.rxOnMillis += millis() - start;
+
+  if (heard) {
+    tdmaStats.beacons++;
+    LOG_DEBUG("TDMA: beacon %u, slot %u of %u at +%lu ms", tdma.beacon().sequence,
+              tdma.slotIndex(), tdma.beacon().slotCount, tdma.slotStart() - millis());
+  }
+  return heard;
+}
+
+// The beacon period replaces SEND_INTERVAL while synced
+void onSlot() {
+  generateAndSendData();
+  sendHeldPacket();  // Still held if the duty-cycle budget ran out earlier
+}
+#endif
+
+#ifdef LORA_ARQ
+// Retransmits the oldest unacknowledged packet that is due. New readings
+// go first, so nothing is retransmitted while a packet is held.
+void serviceArq() {
+  if (heldPacketLen > 0) {
+    return;
+  }
+  auto* entry = arq.due(millis());
+  if (entry == nullptr || !radioAvailable(entry->len) || !sendRadioPacket(entry->frame, entry->len)) {
+    return;
+  }
+  arq.retransmitted(*entry, millis());
+  LOG_INFO("ARQ: retransmitted %u, attempt %u", entry->sequence, entry->attempts);
+  openReceiveWindow();
+}
+#endif
+
+void sendHeldPacket() {
+  if (heldPacketLen == 0 || !radioAvailable(heldPacketLen)) {
+    return;
+  }
+  if (transmitLoRaPacket(heldPacket, heldPacketLen)) {
+    heldPacketLen = 0;
+  }
+}
+
+void armHeapCheck() {
+  heapAtSample = ESP.getFreeHeap();
+  heapMinAtSample = ESP.getMinFreeHeap();
+  heapCheckArmed = true;
+}
+
+// Compares the heap with the state captured by armHeapCheck(). A drop in
+// free heap means something is still allocated; a lower low-water mark
+// means something was allocated and freed again on the way.
+void checkHeap() {
+  if (!heapCheckArmed) {
+    return;
+  }
+  heapCheckArmed = false;
+  uint32_t freeHeap = ESP.getFreeHeap();
+  uint32_t minFreeHeap = ESP.getMinFreeHeap();
+  heapStats.checks++;
+  if (freeHeap >= heapAtSample && minFreeHeap >= heapMinAtSample) {
+    return;
+  }
+  uint32_t drop = heapAtSample > freeHeap ? heapAtSample - freeHeap : heapMinAtSample - minFreeHeap;
+  heapStats.violations++;
+  if (drop > heapStats.worstDrop) heapStats.worstDrop = drop;
+  LOG_WARN("Heap used between sample and TX: free %lu -> %lu, low-water %lu -> %lu bytes",
+           (unsigned long)heapAtSample, (unsigned long)freeHeap,
+           (unsigned long)heapMinAtSample, (unsigned long)minFreeHeap);
+}
+
+void printHeapStats() {
+  LOG_INFO("Heap: free %lu, low-water %lu bytes; send path checks: %lu, allocations: %lu (worst %lu bytes)",
+           (unsigned long)ESP.getFreeHeap(), (unsigned long)ESP.getMinFreeHeap(),
+           heapStats.checks, heapStats.violations, (unsigned long)heapStats.worstDrop);
+}
+
+// 't' prints the stage histograms, 'r' resets them. With GPS_TIME, 'g'
+// prints the clock state and 'n' toggles raw NMEA output for gps_replay.
+void serviceSerialCommands() {
+  while (Serial.available() > 0) {
+    int command = Serial.read();
+    if (command == 't') {
+      printTraceStats();
+    } else if (command == 'r') {
+      tracer.reset();
+      LOG_INFO("Stage histograms reset");
+#ifdef GPS_TIME
+    } else if (command == 'g') {
+      printGpsStats();
+    } else if (command == 'n') {
+      gpsEcho = !gpsEcho;
+#endif
+    }
+  }
+}
+
+void printTraceStats() {
+  LOG_INFO("Stage Latency (us):");
+  for (size_t i = 0; i < tracer.size(); i++) {
+    const StageHistogram& h = tracer.histogram(i);
+    if (h.count == 0) continue;
+    LOG_INFO("%-9s n=%lu avg %lu, p50 %lu, p90 %lu, p99 %lu, max %lu", tracer.name(i),
+             (unsigned long)h.count, (unsigned long)traceAverage(h), (unsigned long)tracePercentile(h, 0.5f),
+             (unsigned long)tracePercentile(h, 0.9f), (unsigned long)tracePercentile(h, 0.99f),
+             (unsigned long)h.maxMicros);
+  }
+}
+
+#ifdef GPS_TIME
+void IRAM_ATTR onPps() {
+  ppsMicros = esp_timer_get_time();
+  ppsCount++;
+}
+
+void setupGps() {
+  axp.setPowerOutPut(AXP192_LDO3, AXP202_ON);
+  Serial1.begin(GPS_BAUD, SERIAL_8N1, GPS_RX, GPS_TX);
+#if GPS_PPS_PIN >= 0
+  pinMode(GPS_PPS_PIN, INPUT);
+  attachInterrupt(digitalPinToInterrupt(GPS_PPS_PIN), onPps, RISING);
+#endif
+  lastGpsPoll = esp_timer_get_time();
+}
+
+// A sentence is timed by the window between this poll and the previous
+// one, so the fallback time is only as good as loop() is frequent.
+void serviceGps() {
+  uint32_t count;
+  int64_t edge;
+  do {
+    count = ppsCount;
+    edge = ppsMicros;
+  } while (count != ppsCount);  // The interrupt fired mid-read
+  if (count != ppsSeen) {
+    ppsSeen = count;
+    gpsClock.onPulse(edge);
+    if (gpsEcho) {
+      LOG_INFO("%lld PPS", (long long)edge);
+    }
+  }
+
+  while (Serial1.available() > 0) {
+    NmeaEvent event = nmea.feed((char)Serial1.read());
+    if (event == NMEA_NONE) continue;
+    int64_t now = esp_timer_get_time();
+    if (event == NMEA_TIME) {
+      gpsClock.onNmeaTime(nmea.unixMicros(), lastGpsPoll, now);
+    }
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+    if (gpsEcho) {
+      // "<local us> $<sentence>", the format gps_replay reads. The slot only
+      // advances when the record was queued; a dropped one leaves it free
+      char* line = gpsEchoLines[gpsEchoNext];
+      strncpy(line, nmea.sentence(), NMEA_MAX_SENTENCE);
+      line[NMEA_MAX_SENTENCE] = '\0';
+      if (logger.log(LOG_LEVEL_INFO, "%lld $%s", (long long)now, line)) {
+        gpsEchoNext = (gpsEchoNext + 1) % GPS_ECHO_LINES;
+      }
+    }
+#endif
+  }
+  lastGpsPoll = esp_timer_get_time();
+}
+
+void printGpsStats() {
+  int64_t now = esp_timer_get_time();
+  const NmeaParser::Stats& parser = nmea.stats();
+  const GpsClock::Stats& clock = gpsClock.stats();
+  LOG_INFO("GPS time: %s, Unix %llu ms, drift %.2f ppm", gpsTimeSourceName(gpsClock.source(now)),
+           (unsigned long long)gpsClock.unixMillis(now), gpsClock.driftPpb() / 1000.0);
+  LOG_INFO("NMEA: %lu sentences, %lu checksum errors, %lu times, %lu without fix",
+           parser.sentences, parser.checksumErrors, parser.times, parser.noFix);
+  LOG_INFO("PPS: %lu pulses, %lu rejected, %lu locks, %lu mismatches, residual %ld us (max %lu)",
+           clock.pulses, clock.rejected, clock.locks, clock.mismatches,
+           (long)clock.lastResidual, (unsigned long)clock.maxResidual);
+}
+#endif
+
+#if TRACE_TELEMETRY_EVERY > 0
+void sendTraceTelemetry() {
+  tracePending = false;
+  StaticJsonDocument<384> doc;
+  doc["type"] = "trace";
+  doc["lahanID"] = LAHAN_ID;
+  JsonObject stages = doc.createNestedObject("us");
+  for (size_t i = 0; i < tracer.size(); i++) {
+    const StageHistogram& h = tracer.histogram(i);
+    if (h.count == 0) continue;
+    JsonArray stage = stages.createNestedArray(tracer.name(i));
+    stage.add(tracePercentile(h, 0.5f));
+    stage.add(tracePercentile(h, 0.9f));
+    stage.add(h.maxMicros);
+  }
+  size_t len = measureJson(doc);
+  if (len > LORA_MAX_DATA) {
+    LOG_WARN("Trace telemetry of %u bytes exceeds the LoRa maximum, dropped", (unsigned)len);
+    return;
+  }
+  serializeJson(doc, traceFrame, sizeof(traceFrame));
+  LOG_DEBUG("Trace telemetry: %s", traceFrame);
+  queueLoRaPacket((const uint8_t*)traceFrame, len);
+}
+#endif
+
+void printDutyCycleStats() {
+  const DutyCycleLimiter::Stats& stats = dutyCycle.stats();
+  LOG_INFO("Duty Cycle Statistics:");
+  LOG_INFO("Sent: %lu, Deferred: %lu, Merged: %lu, Held: %s",
+           stats.granted, stats.denied, packetsMerged, heldPacketLen ? "yes" : "no");
+  LOG_INFO("Airtime: %.1f s total, budget left %.1f of %.1f s",
+           stats.airtimeMicros / 1e6, dutyCycle.remaining(millis()) / 1e6, dutyCycle.capacity() / 1e6);
+  printLbtStats();
+}
+
+void IRAM_ATTR onCadDone(bool detected) {
+  cadDetected = detected;
+  cadDone = true;
+}
+
+// Runs one channel activity detection and waits for its interrupt. The
+// DIO0 interrupt is only attached for the CAD: outside it DIO0 signals
+// RxDone, and the library's handler would clear the flags parsePacket()
+// polls for, losing every downlink and beacon.
+CadResult runCad() {
+  unsigned long timeout = CAD_TIMEOUT_SYMBOLS * loraSymbolMicros(modulation) + 1000;
+  cadDone = false;
+  LoRa.onCadDone(onCadDone);
+  LoRa.channelActivityDetection();
+  unsigned long start = micros();
+  while (!cadDone && micros() - start < timeout) {
+  }
+  LoRa.onCadDone(NULL);
+  LoRa.idle();
+  if (!cadDone) {
+    return CAD_TIMEOUT;
+  }
+  return cadDetected ? CAD_BUSY : CAD_CLEAR;
+}
+
+void printLbtStats() {
+  if (!lbt.enabled()) {
+    return;
+  }
+  const ListenBeforeTalk::Stats& stats = lbt.stats();
+  LOG_INFO("LBT: CAD checks: %lu, Busy: %lu, Gave up: %lu, Timeouts: %lu",
+           stats.checks, stats.busy, stats.gaveUp, stats.timeouts);
+  LOG_INFO("LBT backoff: total %lu ms, max %lu ms", stats.backoffMillis, stats.maxBackoff);
+}
+
+#ifdef LORA_BINARY_FRAME
+void sendLoRaFrame(const uint8_t* frame, size_t len) {
+  LOG_INFO("LoRa binary frame (%u bytes)", (unsigned)len);
+  queueLoRaPacket(frame, len);
+}
+#endif
+
+void generateAndSendData() {
   // Generate sensor data
+  int64_t sensorsStart = tracer.now();
   float humidity = randomFloat(20, 35);
   float temperature = randomFloat(20, 35);
   float ec = randomFloat(0, 100);
@@ -94,29 +900,62 @@ void generateAndSendData() {
   float nitrogen = randomFloat(0, 5);
   float phosphorus = randomFloat(0, 10);
   float potassium = randomFloat(0, 15);
+  tracer.recordSince(STAGE_SENSORS, sensorsStart);
+  armHeapCheck();
 
-  doc["type"] = "sensor";
-  doc["lahanID"] = LAHAN_ID;
+  SensorReading reading;
+  reading.lahanID = LAHAN_ID;
+#ifdef GPS_TIME
+  reading.capturedAt = gpsClock.unixMillis(sensorsStart);
+#endif
+
+  reading.humidity = humidity;
+  reading.temperature = temperature;
+  reading.ec = ec;
+  reading.ph = ph;
+  reading.nitrogen = nitrogen;
+  reading.phosphorus = phosphorus;
+  reading.potassium = potassium;
+  getBatteryInfo(reading);
+
+#ifdef LORA_BINARY_FRAME
+  uint8_t frame[SENSOR_FRAME_MAX_SIZE];
+  int64_t serializeStart = tracer.now();
+  size_t frameLen = encodeSensorFrame(reading, frame, sizeof(frame));
+  tracer.recordSince(STAGE_SERIALIZE, serializeStart);
+  sendLoRaFrame(frame, frameLen);
+#else
+  int64_t serializeStart = tracer.now();
+  size_t jsonLen = writeSensorJson(reading, jsonFrame, sizeof(jsonFrame));
+  tracer.recordSince(STAGE_SERIALIZE, serializeStart);
+  if (jsonLen > 0) {
+    LOG_DEBUG("LoRa message: %s", jsonFrame);  // Valid until the next reading
+    sendLoRaMessage((const uint8_t*)jsonFrame, jsonLen);
+  } else {
+    LOG_WARN("JSON document exceeds the %u-byte frame buffer, dropped", (unsigned)sizeof(jsonFrame));
+  }
+#endif
+  checkHeap();  // If the packet was held rather than sent
+#if TRACE_TELEMETRY_EVERY > 0
+  if (++readingsSinceTrace >= TRACE_TELEMETRY_EVERY) {
+    readingsSinceTrace = 0;
+    tracePending = true;
+  }
+#endif
+
+  LOG_INFO("Data sent at: %lu ms", millis());
+  printNextReport();
+}
 
-  JsonObject sensor = doc.createNestedObject("sensor");
-  sensor["Humidity"] = humidity;
-  sensor["Temperature"] = temperature;
-  sensor["Ec"] = ec;
-  sensor["Ph"] = ph;
-  sensor["Nitrogen"] = nitrogen;
-  sensor["Phosporus"] = phosphorus;
-  sensor["Kalium"] = potassium;
-
-  // Add battery information
-  JsonObject battery = doc.createNestedObject("battery");
-  getBatteryInfo(battery);
-
-  String jsonString;
-  serializeJson(doc, jsonString);
-  sendLoRaMessage(jsonString);
-
-  // Print the data to Serial for debugging
-  serializeJsonPretty(doc, Serial);
-  Serial.println();
-  Serial.printf("Data sent at: %lu ms\n", millis());
+void printNextReport() {
+  switch (nextReport) {
+    case REPORT_DUTY_CYCLE: printDutyCycleStats(); break;
+    case REPORT_LINK: printLinkStats(); break;
+    case REPORT_HEAP: printHeapStats(); break;
+    case REPORT_TRACE: printTraceStats(); break;
+#ifdef GPS_TIME
+    case REPORT_GPS: printGpsStats(); break;
+#endif
+  }
+  nextReport = (nextReport + 1) % REPORT_COUNT;
 }
\ No newline at end of file
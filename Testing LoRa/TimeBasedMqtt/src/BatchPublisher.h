@@ -0,0 +1,173 @@
+#pragma once
+
+// Coalesces readings into batches and tracks unacknowledged batches in a
+// bounded window.
+//
+// A batch is closed when it holds BATCH_SIZE readings or its first reading
+// is older than maxAge. Closed batches are handed to the send function and
+// stay in flight until acknowledge() is called with their id; batches that
+// are not acknowledged within ackTimeout are sent again, up to maxAttempts.
+//
+// Time is passed in by the caller (millis() on the board), so the class can
+// also be driven by the host-side simulator.
+
+#include <stdint.h>
+#include <stddef.h>
+
+template <typename T, size_t BATCH_SIZE, size_t WINDOW>
+class BatchPublisher {
+public:
+  enum SlotState : uint8_t { FREE, OPEN, IN_FLIGHT };
+
+  struct Batch {
+    uint16_t id;
+    uint8_t count;
+    uint8_t attempts;
+    SlotState state;
+    unsigned long openedAt;
+    unsigned long firstSentAt;
+    unsigned long lastSentAt;
+    T items[BATCH_SIZE];
+  };
+
+  struct Stats {
+    unsigned long readingsQueued = 0;
+    unsigned long readingsAcked = 0;
+    unsigned long batchesSent = 0;
+    unsigned long batchesAcked = 0;
+    unsigned long retries = 0;
+    unsigned long batchesDropped = 0;  // gave up after maxAttempts
+    unsigned long duplicateAcks = 0;
+    unsigned long windowFull = 0;      // add() refused for lack of a free slot
+    unsigned long totalAckLatency = 0;
+    unsigned long maxAckLatency = 0;
+  };
+
+  BatchPublisher(unsigned long maxAge, unsigned long ackTimeout, uint8_t maxAttempts)
+      : _maxAge(maxAge), _ackTimeout(ackTimeout), _maxAttempts(maxAttempts) {
+    for (size_t i = 0; i < WINDOW + 1; i++) _slots[i].state = FREE;
+  }
+
+  // Returns false when every slot is in flight or holds a full batch; the
+  // caller should keep the reading and try again later.
+  bool add(const T& item, unsigned long now) {
+    Batch* open = openBatch();
+    if (open == nullptr) {
+      open = startBatch(now);
+      if (open == nullptr) {
+        _stats.windowFull++;
+        return false;
+      }
+    }
+    open->items[open->count++] = item;
+    _stats.readingsQueued++;
+    return true;
+  }
+
+  // Sends batches that are due: retries first, then batches that are full
+  // or old enough. send(const Batch&) returns true if the batch was
+  // handed to the transport.
+  template <typename SendFn>
+  void service(unsigned long now, SendFn send) {
+    for (size_t i = 0; i < WINDOW + 1; i++) {
+      Batch& b = _slots[i];
+      if (b.state != IN_FLIGHT || now - b.lastSentAt < _ackTimeout) continue;
+      if (b.attempts >= _maxAttempts) {
+        _stats.batchesDropped++;
+        b.state = FREE;
+        continue;
+      }
+      if (send(b)) {
+        b.attempts++;
+        b.lastSentAt = now;
+        _stats.retries++;
+      }
+    }
+
+    // Closed batches go out oldest first while the window has room
+    while (inFlightCount() < WINDOW) {
+      Batch* due = nullptr;
+      for (size_t i = 0; i < WINDOW + 1; i++) {
+        Batch& b = _slots[i];
+        if (b.state != OPEN || b.count == 0) continue;
+        if (b.count < BATCH_SIZE && now - b.openedAt < _maxAge) continue;
+        if (due == nullptr || (long)(b.openedAt - due->openedAt) < 0) due = &b;
+      }
+      if (due == nullptr || !send(*due)) return;
+      due->state = IN_FLIGHT;
+      due->attempts = 1;
+      due->firstSentAt = due->lastSentAt = now;
+      _stats.batchesSent++;
+    }
+  }
+
+  // Returns false for unknown or already acknowledged ids.
+  bool acknowledge(uint16_t id, unsigned long now) {
+    for (size_t i = 0; i < WINDOW + 1; i++) {
+      Batch& b = _slots[i];
+      if (b.state != IN_FLIGHT || b.id != id) continue;
+      unsigned long latency = now - b.firstSentAt;
+      _stats.totalAckLatency += latency;
+      if (latency > _stats.maxAckLatency) _stats.maxAckLatency = latency;
+      _stats.batchesAcked++;
+      _stats.readingsAcked += b.count;
+      b.state = FREE;
+      return true;
+    }
+    _stats.duplicateAcks++;
+    return false;
+  }
+
+  size_t inFlightCount() const {
+    size_t n = 0;
+    for (size_t i = 0; i < WINDOW + 1; i++) {
+      if (_slots[i].state == IN_FLIGHT) n++;
+    }
+    return n;
+  }
+
+  size_t pendingReadings() const {
+    size_t n = 0;
+    for (size_t i = 0; i < WINDOW + 1; i++) {
+      if (_slots[i].state != FREE) n += _slots[i].count;
+    }
+    return n;
+  }
+
+  const Stats& stats() const { return _stats; }
+
+  unsigned long averageAckLatency() const {
+    return _stats.batchesAcked ? _stats.totalAckLatency / _stats.batchesAcked : 0;
+  }
+
+private:
+  // The batch still accepting readings. Full batches waiting for room in
+  // the window stay OPEN until sent, so there may be several OPEN slots.
+  Batch* openBatch() {
+    for (size_t i = 0; i < WINDOW + 1; i++) {
+      if (_slots[i].state == OPEN && _slots[i].count < BATCH_SIZE) return &_slots[i];
+    }
+    return nullptr;
+  }
+
+  Batch* startBatch(unsigned long now) {
+    for (size_t i = 0; i < WINDOW + 1; i++) {
+      Batch& b = _slots[i];
+      if (b.state != FREE) continue;
+      b.state = OPEN;
+      b.id = _nextId++;
+      b.count = 0;
+      b.attempts = 0;
+      b.openedAt = now;
+      return &b;
+    }
+    return nullptr;
+  }
+
+  Batch _slots[WINDOW + 1];
+  uint16_t _nextId = 1;
+  unsigned long _maxAge;
+  unsigned long _ackTimeout;
+  uint8_t _maxAttempts;
+  Stats _stats;
+};
@@ -0,0 +1,169 @@
+#include "ConnectivityManager.h"
+#include "Log.h"
+
+ConnectivityManager::ConnectivityManager(PubSubClient& client, WiFiClient& socket, const char* mqttHost,
+                                         uint16_t mqttPort, const char* ssid, const char* password,
+                                         const char* mqttUsername, const char* mqttPassword)
+    : _client(client),
+      _socket(socket),
+      _mqttHost(mqttHost),
+      _mqttPort(mqttPort),
+      _ssid(ssid),
+      _password(password),
+      _mqttUsername(mqttUsername),
+      _mqttPassword(mqttPassword) {}
+
+void ConnectivityManager::begin() {
+  WiFi.mode(WIFI_STA);
+  _client.setSocketTimeout(MQTT_SOCKET_TIMEOUT);
+  _offlineSince = millis();
+  startWiFi();
+}
+
+void ConnectivityManager::loop() {
+  unsigned long now = millis();
+
+  switch (_state) {
+    case WIFI_CONNECTING:
+      if (WiFi.status() == WL_CONNECTED) {
+        IPAddress ip = WiFi.localIP();
+        LOG_INFO("WiFi connected, IP address: %u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+        _wifiBackoff = BACKOFF_MIN;
+        _state = MQTT_CONNECTING;
+        _retryAt = now;
+      } else if (now - _stateSince >= WIFI_CONNECT_TIMEOUT) {
+        LOG_ERROR("WiFi connection failed!");
+        WiFi.disconnect();
+        scheduleRetry(WIFI_BACKOFF, _wifiBackoff);
+      }
+      break;
+
+    case WIFI_BACKOFF:
+      if ((long)(now - _retryAt) >= 0) {
+        startWiFi();
+      }
+      break;
+
+    case MQTT_CONNECTING:
+    case MQTT_BACKOFF:
+      if (WiFi.status() != WL_CONNECTED) {
+        LOG_WARN("WiFi connection lost. Reconnecting...");
+        startWiFi();
+      } else if ((long)(now - _retryAt) >= 0) {
+        tryMqtt();
+      }
+      break;
+
+    case CONNECTED:
+      if (WiFi.status() != WL_CONNECTED) {
+        LOG_WARN("WiFi connection lost. Reconnecting...");
+        onLinkLost();
+        startWiFi();
+      } else if (!_client.connected()) {
+        LOG_WARN("MQTT connection lost, rc=%d", _client.state());
+        onLinkLost();
+        _state = MQTT_CONNECTING;
+        _retryAt = now;
+      } else {
+        _client.loop();  // Handle MQTT keep-alive
+      }
+      break;
+  }
+}
+
+void ConnectivityManager::startWiFi() {
+  LOG_INFO("Connecting to WiFi..");
+  _stats.wifiAttempts++;
+  WiFi.begin(_ssid, _password);
+  // The new association may come with a different DNS server
+  _brokerResolved = false;
+  _state = WIFI_CONNECTING;
+  _stateSince = millis();
+}
+
+// A literal address needs no lookup; a name is looked up once and the
+// answer kept until WiFi reconnects
+bool ConnectivityManager::resolveBroker() {
+  if (_brokerResolved) return true;
+  if (!_brokerIp.fromString(_mqttHost) && WiFi.hostByName(_mqttHost, _brokerIp) != 1) {
+    LOG_WARN("Cannot resolve MQTT broker %s", _mqttHost);
+    return false;
+  }
+  LOG_INFO("MQTT broker %s is %u.%u.%u.%u", _mqttHost, _brokerIp[0], _brokerIp[1], _brokerIp[2],
+           _brokerIp[3]);
+  _client.setServer(_brokerIp, _mqttPort);
+  _brokerResolved = true;
+  return true;
+}
+
+void ConnectivityManager::tryMqtt() {
+  LOG_INFO("Attempting MQTT connection...");
+  _stats.mqttAttempts++;
+  if (!resolveBroker()) {
+    _stats.mqttFailures++;
+    scheduleRetry(MQTT_BACKOFF, _mqttBackoff);
+    return;
+  }
+
+  // PubSubClient's own connect has no TCP timeout; with the socket already
+  // open it goes straight to the CONNECT packet
+  _socket.stop();
+  if (!_socket.connect(_brokerIp, _mqttPort, MQTT_CONNECT_TIMEOUT)) {
+    _stats.mqttFailures++;
+    LOG_WARN("MQTT broker unreachable");
+    scheduleRetry(MQTT_BACKOFF, _mqttBackoff);
+    return;
+  }
+
+  String clientId = "ESP32Client-";
+  clientId += String(random(0xffff), HEX);
+  if (_client.connect(clientId.c_str(), _mqttUsername, _mqttPassword)) {
+    LOG_INFO("MQTT connected");
+    onConnected();
+  } else {
+    _stats.mqttFailures++;
+    LOG_WARN("MQTT connection failed, rc=%d", _client.state());
+    scheduleRetry(MQTT_BACKOFF, _mqttBackoff);
+  }
+}
+
+void ConnectivityManager::scheduleRetry(State backoffState, unsigned long& backoff) {
+  // Full jitter in [backoff/2, backoff] so a fleet that lost the same
+  // access point does not reconnect in lock-step
+  unsigned long wait = backoff / 2 + random(backoff / 2 + 1);
+  LOG_INFO("Retrying in %lu ms", wait);
+
+  _retryAt = millis() + wait;
+  _state = backoffState;
+  backoff = backoff * 2 > BACKOFF_MAX ? BACKOFF_MAX : backoff * 2;
+}
+
+void ConnectivityManager::onConnected() {
+  unsigned long latency = millis() - _offlineSince;
+  _stats.lastConnectLatency = latency;
+  if (latency > _stats.maxConnectLatency) _stats.maxConnectLatency = latency;
+  _stats.totalDowntime += latency;
+
+  _mqttBackoff = BACKOFF_MIN;
+  _state = CONNECTED;
+  if (_onConnect) _onConnect();
+}
+
+void ConnectivityManager::onLinkLost() {
+  _stats.disconnects++;
+  _offlineSince = millis();
+}
+
+unsigned long ConnectivityManager::currentDowntime() const {
+  return _state == CONNECTED ? 0 : millis() - _offlineSince;
+}
+
+void ConnectivityManager::printStats() const {
+  LOG_INFO("Connectivity Statistics:");
+  LOG_INFO("WiFi attempts: %lu, MQTT attempts: %lu, MQTT failures: %lu, Disconnects: %lu",
+           _stats.wifiAttempts, _stats.mqttAttempts, _stats.mqttFailures, _stats.disconnects);
+  LOG_INFO("Connect latency: last %lu ms, max %lu ms",
+           _stats.lastConnectLatency, _stats.maxConnectLatency);
+  LOG_INFO("Downtime: total %lu ms, current %lu ms",
+           _stats.totalDowntime, currentDowntime());
+}
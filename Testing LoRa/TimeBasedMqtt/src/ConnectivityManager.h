@@ -0,0 +1,90 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <PubSubClient.h>
+
+// Non-blocking WiFi + MQTT connection state machine.
+//
+// loop() must be called from the sketch loop(). WiFi is polled through
+// WiFi.status() and failed attempts are retried with exponential backoff
+// plus random jitter instead of delay().
+//
+// An MQTT attempt is the one place that blocks, so it is bounded: the
+// broker's address is resolved once per WiFi association and cached (DNS
+// can take seconds), the TCP connect to it is capped at
+// MQTT_CONNECT_TIMEOUT, and the CONNECT/CONNACK exchange at
+// MQTT_SOCKET_TIMEOUT.
+class ConnectivityManager {
+public:
+  enum State {
+    WIFI_CONNECTING,
+    WIFI_BACKOFF,
+    MQTT_CONNECTING,
+    MQTT_BACKOFF,
+    CONNECTED
+  };
+
+  struct Stats {
+    unsigned long wifiAttempts = 0;
+    unsigned long mqttAttempts = 0;
+    unsigned long mqttFailures = 0;
+    unsigned long disconnects = 0;
+    unsigned long lastConnectLatency = 0;  // ms from link loss to MQTT connected
+    unsigned long maxConnectLatency = 0;
+    unsigned long totalDowntime = 0;       // ms spent offline, excluding the current outage
+  };
+
+  typedef void (*ConnectedCallback)();
+
+  ConnectivityManager(PubSubClient& client, WiFiClient& socket, const char* mqttHost, uint16_t mqttPort,
+                      const char* ssid, const char* password, const char* mqttUsername,
+                      const char* mqttPassword);
+
+  void begin();
+  void loop();
+
+  // Called after every successful MQTT connect, e.g. to renew subscriptions
+  void onConnect(ConnectedCallback callback) { _onConnect = callback; }
+
+  bool isConnected() const { return _state == CONNECTED; }
+  State state() const { return _state; }
+  const Stats& stats() const { return _stats; }
+  unsigned long currentDowntime() const;
+  void printStats() const;
+
+  // Backoff tuning
+  static const unsigned long WIFI_CONNECT_TIMEOUT = 20000;
+  static const unsigned long BACKOFF_MIN = 1000;
+  static const unsigned long BACKOFF_MAX = 60000;
+  static const int32_t MQTT_CONNECT_TIMEOUT = 3000;   // ms, TCP connect to the broker
+  static const uint16_t MQTT_SOCKET_TIMEOUT = 2;      // s, waiting for the broker's reply
+
+private:
+  void startWiFi();
+  bool resolveBroker();
+  void tryMqtt();
+  void scheduleRetry(State backoffState, unsigned long& backoff);
+  void onConnected();
+  void onLinkLost();
+
+  PubSubClient& _client;
+  WiFiClient& _socket;
+  const char* _mqttHost;
+  uint16_t _mqttPort;
+  IPAddress _brokerIp;
+  bool _brokerResolved = false;
+  const char* _ssid;
+  const char* _password;
+  const char* _mqttUsername;
+  const char* _mqttPassword;
+
+  State _state = WIFI_CONNECTING;
+  unsigned long _stateSince = 0;
+  unsigned long _retryAt = 0;
+  unsigned long _wifiBackoff = BACKOFF_MIN;
+  unsigned long _mqttBackoff = BACKOFF_MIN;
+  unsigned long _offlineSince = 0;
+  Stats _stats;
+  ConnectedCallback _onConnect = nullptr;
+};
@@ -0,0 +1,283 @@
+#pragma once
+
+// Levelled, deferred logging.
+//
+// LOG_ERROR/LOG_WARN/LOG_INFO/LOG_DEBUG take a printf format and its
+// arguments. Formatting is deferred: a call only stores the format pointer,
+// the raw argument values and a timestamp in a lock-free single-producer,
+// single-consumer ring, which costs a few microseconds. drain(), run from a
+// low-priority task, formats the records and writes them out, so the
+// sending task never waits for the UART.
+//
+// Levels above LOG_LEVEL (-D LOG_LEVEL=LOG_LEVEL_DEBUG, default INFO) are
+// compiled out: the call sits in a branch that is never taken, so its
+// arguments are not evaluated and cost nothing, but a variable kept only
+// for logging still counts as used.
+//
+// Rules that follow from the deferral:
+//  - the format must be a string literal
+//  - %s arguments are kept by pointer, so they must be literals or buffers
+//    that stay valid until the record has been drained
+//  - only one task may log; a full ring drops the new record and the drop
+//    is reported with the next drained line
+//  - no '*' width/precision; integer length modifiers are ignored, every
+//    integer is carried as 64 bits
+//
+// The firmware defines the global `logger` the macros write to, once:
+//   Logger<LOG_QUEUE_SIZE> logger(millis);
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+#ifndef LOG_QUEUE_SIZE
+#define LOG_QUEUE_SIZE 32  // Records
+#endif
+#define LOG_MAX_ARGS 8
+#define LOG_LINE_SIZE 320  // Longest formatted line, longer ones are cut
+
+#define LOG_DISCARD(...) do { if (0) logger.log(LOG_LEVEL_NONE, __VA_ARGS__); } while (0)
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logger.log(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) LOG_DISCARD(__VA_ARGS__)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) logger.log(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) LOG_DISCARD(__VA_ARGS__)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) logger.log(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) LOG_DISCARD(__VA_ARGS__)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logger.log(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) LOG_DISCARD(__VA_ARGS__)
+#endif
+
+union LogArg {
+  long long i;
+  double f;
+  const char* s;
+  const void* p;
+};
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, LogArg>::type logArg(T value) {
+  LogArg arg;
+  arg.i = (long long)value;
+  return arg;
+}
+
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value, LogArg>::type logArg(T value) {
+  LogArg arg;
+  arg.f = value;
+  return arg;
+}
+
+inline LogArg logArg(const char* value) {
+  LogArg arg;
+  arg.s = value;
+  return arg;
+}
+
+inline LogArg logArg(const void* value) {
+  LogArg arg;
+  arg.p = value;
+  return arg;
+}
+
+struct LogRecord {
+  uint32_t time;
+  uint8_t level;
+  uint8_t argCount;
+  const char* format;
+  LogArg args[LOG_MAX_ARGS];
+};
+
+inline char logLevelLetter(uint8_t level) {
+  static const char LETTERS[] = "-EWID";
+  return level <= LOG_LEVEL_DEBUG ? LETTERS[level] : '?';
+}
+
+// Formats a record as "[<ms> <level>] <message>\n". Returns the length,
+// at most cap - 1; the line is always NUL-terminated.
+inline size_t formatLogRecord(const LogRecord& record, char* out, size_t cap) {
+  if (cap < 2) return 0;
+  size_t pos = 0;
+  // Clamps pos after each snprintf so truncation just stops the line
+  auto advance = [&](int written) {
+    if (written > 0) pos += (size_t)written;
+    if (pos > cap - 2) pos = cap - 2;  // Room for '\n' and NUL
+  };
+
+  advance(snprintf(out, cap, "[%lu %c] ", (unsigned long)record.time, logLevelLetter(record.level)));
+
+  size_t argIndex = 0;
+  for (const char* f = record.format; *f != '\0' && pos < cap - 2; f++) {
+    if (*f != '%') {
+      out[pos++] = *f;
+      continue;
+    }
+    if (f[1] == '%') {
+      out[pos++] = '%';
+      f++;
+      continue;
+    }
+
+    // Rebuild the conversion with a length modifier that matches LogArg
+    char spec[16] = "%";
+    size_t specLen = 1;
+    const char* c = f + 1;
+    while (*c != '\0' && strchr("-+ #0123456789.", *c) != nullptr) {
+      if (specLen < sizeof(spec) - 4) spec[specLen++] = *c;
+      c++;
+    }
+    while (*c != '\0' && strchr("hlLqjzt", *c) != nullptr) c++;
+    if (*c == '\0') break;
+    f = c;
+
+    if (argIndex >= record.argCount) {
+      out[pos++] = '?';
+      continue;
+    }
+    const LogArg& arg = record.args[argIndex++];
+    switch (*c) {
+      case 'd':
+      case 'i':
+        spec[specLen++] = 'l';
+        spec[specLen++] = 'l';
+        spec[specLen++] = *c;
+        spec[specLen] = '\0';
+        advance(snprintf(out + pos, cap - pos - 1, spec, arg.i));
+        break;
+      case 'u':
+      case 'o':
+      case 'x':
+      case 'X':
+        spec[specLen++] = 'l';
+        spec[specLen++] = 'l';
+        spec[specLen++] = *c;
+        spec[specLen] = '\0';
+        advance(snprintf(out + pos, cap - pos - 1, spec, (unsigned long long)arg.i));
+        break;
+      case 'c':
+        out[pos++] = (char)arg.i;
+        break;
+      case 'f':
+      case 'F':
+      case 'e':
+      case 'E':
+      case 'g':
+      case 'G':
+        spec[specLen++] = *c;
+        spec[specLen] = '\0';
+        advance(snprintf(out + pos, cap - pos - 1, spec, arg.f));
+        break;
+      case 's':
+        spec[specLen++] = 's';
+        spec[specLen] = '\0';
+        advance(snprintf(out + pos, cap - pos - 1, spec, arg.s != nullptr ? arg.s : "(null)"));
+        break;
+      case 'p':
+        advance(snprintf(out + pos, cap - pos - 1, "%p", arg.p));
+        break;
+      default:
+        out[pos++] = '?';
+        break;
+    }
+  }
+  out[pos++] = '\n';
+  out[pos] = '\0';
+  return pos;
+}
+
+template <size_t N>
+class Logger {
+public:
+  typedef unsigned long (*ClockFn)();
+
+  static_assert((N & (N - 1)) == 0, "Logger size must be a power of two");
+
+  explicit Logger(ClockFn clock) : _clock(clock) {}
+
+  // Returns false if the ring was full and the record was dropped.
+  template <typename... Args>
+  bool log(uint8_t level, const char* format, Args... args) {
+    static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "Too many log arguments, see LOG_MAX_ARGS");
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    if (head - _tail.load(std::memory_order_acquire) >= N) {
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    LogRecord& record = _records[head % N];
+    record.time = (uint32_t)_clock();
+    record.level = level;
+    record.format = format;
+    record.argCount = (uint8_t)sizeof...(Args);
+    const LogArg values[sizeof...(Args) + 1] = {logArg(args)...};
+    for (size_t i = 0; i < sizeof...(Args); i++) record.args[i] = values[i];
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Formats up to maxRecords queued records and passes each line to
+  // sink(const char* line, size_t len). Call from the consuming task only.
+  // Returns the number of records drained.
+  template <typename Sink>
+  size_t drain(Sink sink, size_t maxRecords = N) {
+    char line[LOG_LINE_SIZE];
+    size_t count = 0;
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    while (count < maxRecords && tail != _head.load(std::memory_order_acquire)) {
+      size_t len = formatLogRecord(_records[tail % N], line, sizeof(line));
+      _tail.store(++tail, std::memory_order_release);
+      sink(line, len);
+      count++;
+    }
+    _drained += count;
+
+    uint32_t dropped = _dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0) {
+      _totalDropped += dropped;
+      int len = snprintf(line, sizeof(line), "[%lu W] %lu log records dropped\n",
+                         (unsigned long)_clock(), (unsigned long)dropped);
+      sink(line, len < (int)sizeof(line) ? (size_t)len : sizeof(line) - 1);
+    }
+    return count;
+  }
+
+  size_t pending() const {
+    return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+  }
+  size_t capacity() const { return N; }
+  unsigned long drained() const { return _drained; }
+  unsigned long dropped() const { return _totalDropped + _dropped.load(std::memory_order_relaxed); }
+
+private:
+  ClockFn _clock;
+  LogRecord _records[N];
+  std::atomic<uint32_t> _head{0};     // Written by the producer
+  std::atomic<uint32_t> _tail{0};     // Written by the consumer
+  std::atomic<uint32_t> _dropped{0};  // Not yet reported by drain()
+  unsigned long _totalDropped = 0;
+  unsigned long _drained = 0;
+};
+
+extern Logger<LOG_QUEUE_SIZE> logger;
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+
+// Fixed-capacity FIFO. When full, push() overwrites the oldest entry so the
+// most recent samples are kept; the number of dropped entries is counted.
+template <typename T, size_t N>
+class RingBuffer {
+public:
+  bool push(const T& item) {
+    bool overwrote = false;
+    if (_count == N) {
+      _head = (_head + 1) % N;
+      _count--;
+      _dropped++;
+      overwrote = true;
+    }
+    _items[(_head + _count) % N] = item;
+    _count++;
+    return !overwrote;
+  }
+
+  bool peek(T& item) const {
+    if (_count == 0) return false;
+    item = _items[_head];
+    return true;
+  }
+
+  bool pop(T& item) {
+    if (!peek(item)) return false;
+    pop();
+    return true;
+  }
+
+  void pop() {
+    if (_count == 0) return;
+    _head = (_head + 1) % N;
+    _count--;
+  }
+
+  size_t size() const { return _count; }
+  bool empty() const { return _count == 0; }
+  bool full() const { return _count == N; }
+  size_t capacity() const { return N; }
+  unsigned long dropped() const { return _dropped; }
+
+private:
+  T _items[N];
+  size_t _head = 0;
+  size_t _count = 0;
+  unsigned long _dropped = 0;
+};
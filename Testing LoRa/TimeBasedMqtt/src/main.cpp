@@ -4,13 +4,27 @@
 #include <axp20x.h>
 #include <Wire.h>
 #include <PubSubClient.h>
+#include "ConnectivityManager.h"
+#include "RingBuffer.h"
+#include "BufferedPrint.h"
+#include "PayloadFormat.h"
+#include "BatchPublisher.h"
+#include "Log.h"
+
+// Logging, see Log.h. loop() only queues records; logTask() formats and
+// prints them at low priority on core 0
+#define LOG_DRAIN_MS 20
+Logger<LOG_QUEUE_SIZE> logger(millis);
 
 // WiFi credentials
 const char* ssid = "MAKER 2024";
 const char* password = "Makerdotindo24";
 
 // MQTT Broker settings
-const char *mqtt_broker = "broker.emqx.io";
+#ifndef MQTT_BROKER_HOST
+#define MQTT_BROKER_HOST "broker.emqx.io"
+#endif
+const char *mqtt_broker = MQTT_BROKER_HOST;
 const char *mqtt_username = "emqx";
 const char *mqtt_password = "public";
 const int mqtt_port = 1883;
@@ -18,14 +32,57 @@ const int mqtt_port = 1883;
 // MQTT Topic
 const char *topic = "TimeBasedMqtt";
 
+// Payload format per topic; non-JSON formats get a content-type suffix
+// (see PayloadFormat.h). Override with -D MQTT_PAYLOAD_FORMAT=PAYLOAD_MSGPACK
+#ifndef MQTT_PAYLOAD_FORMAT
+#define MQTT_PAYLOAD_FORMAT PAYLOAD_JSON
+#endif
+PublishTarget publishTargets[] = {
+  {topic, MQTT_PAYLOAD_FORMAT},
+};
+const size_t PUBLISH_TARGET_COUNT = sizeof(publishTargets) / sizeof(publishTargets[0]);
+char publishTopics[PUBLISH_TARGET_COUNT][64];
+
 // Data settings
 const int LAHAN_ID = 1;
 unsigned long lastSendTime = 0;
 const long sendInterval = 120000;  // 5 seconds interval
 
-// WiFi reconnect settings
-unsigned long lastWiFiCheckTime = 0;
-const long wifiCheckInterval = 30000;  // Check WiFi every 30 seconds
+// Readings taken while offline are kept here and published on reconnect
+struct SensorSample {
+  unsigned long takenAt;
+  float humidity, temperature, ec, ph, nitrogen, phosphorus, potassium;
+  float vbat, batCurrent, batPower;
+  int batChargeCurrent, batLevel;
+};
+RingBuffer<SensorSample, 32> offlineBuffer;
+
+#ifdef MQTT_BATCH_MODE
+// Batch mode: readings are coalesced into one message per batch. PubSubClient
+// only publishes at QoS0 and does not surface PUBACK, so a batch counts as
+// delivered when the broker echoes it back on our own subscription. The echo
+// is QoS0 too; a lost one just means a retry, which the consumer drops by
+// batchId.
+const size_t BATCH_READINGS = 8;
+const size_t BATCH_WINDOW = 4;                  // Max unacknowledged batches
+const unsigned long BATCH_MAX_AGE = 600000;     // Send a partial batch after 10 minutes
+const unsigned long BATCH_ACK_TIMEOUT = 15000;
+const uint8_t BATCH_MAX_ATTEMPTS = 5;
+const PayloadFormat BATCH_FORMAT = MQTT_PAYLOAD_FORMAT == PAYLOAD_BINARY ? PAYLOAD_MSGPACK : MQTT_PAYLOAD_FORMAT;
+
+// The echo comes back through PubSubClient's receive buffer, which silently
+// drops packets that do not fit (256 bytes by default), so it is sized for
+// the largest batch. A reading has 13 keys (127 bytes of names) with quotes,
+// colon, comma and a value of up to 16 characters each; MessagePack is
+// smaller than this JSON bound.
+const size_t BATCH_READING_MAX_SIZE = 127 + 13 * (3 + 16 + 1) + 2;
+const size_t BATCH_MAX_PAYLOAD = 64 + BATCH_READINGS * BATCH_READING_MAX_SIZE;  // + header fields
+
+typedef BatchPublisher<SensorSample, BATCH_READINGS, BATCH_WINDOW> SampleBatcher;
+SampleBatcher batcher(BATCH_MAX_AGE, BATCH_ACK_TIMEOUT, BATCH_MAX_ATTEMPTS);
+char batchTopic[64];
+const size_t BATCH_PACKET_SIZE = MQTT_MAX_HEADER_SIZE + 2 + sizeof(batchTopic) + BATCH_MAX_PAYLOAD;
+#endif
 
 // AXP20X BATTERY MANAGEMENT 
 AXP20X_Class axp;
@@ -33,163 +90,279 @@ bool isPowerMonitorFound = false;
 
 WiFiClient espClient;
 PubSubClient client(espClient);
+ConnectivityManager connectivity(client, espClient, mqtt_broker, mqtt_port, ssid, password, mqtt_username,
+                                 mqtt_password);
+bool wasConnected = false;
 
 // Function declarations remain the same
-void setup_wifi();
-void reconnect();
 void sendSensorData();
+void sampleSensorData(SensorSample &sample);
+bool publishSample(const SensorSample &sample);
+void fillSample(JsonObject obj, const SensorSample &sample);
+#ifdef MQTT_BATCH_MODE
+bool publishBatch(const SampleBatcher::Batch &batch);
+void subscribeBatchTopic();
+void batchCallback(char* msgTopic, byte* payload, unsigned int length);
+void printBatchStats();
+#endif
+bool publishAll(const JsonDocument& doc);
+bool publishDocument(const char* publishTopic, PayloadFormat format, const JsonDocument& doc);
 void initPowerMonitor();
 void getBatteryStats(float &vbat, float &batCurrent, float &batPower, int &batChargeCurrent, int &batLevel);
 float randomFloat(float min, float max);
+void logTask(void* parameter);
 
 void setup() {
   Serial.begin(115200);
+  xTaskCreatePinnedToCore(logTask, "log", 4096, nullptr, 1, nullptr, 0);
   
   // AXP20X INIT
   initPowerMonitor();
   
-  setup_wifi();
-  client.setServer(mqtt_broker, mqtt_port);
+  for (size_t i = 0; i < PUBLISH_TARGET_COUNT; i++) {
+    buildTopic(publishTopics[i], sizeof(publishTopics[i]), publishTargets[i].topic, publishTargets[i].format);
+    LOG_INFO("Publishing %s to %s", payloadFormatName(publishTargets[i].format), publishTopics[i]);
+  }
+#ifdef MQTT_BATCH_MODE
+  snprintf(batchTopic, sizeof(batchTopic), "%s/batch%s", topic, payloadFormatSuffix(BATCH_FORMAT));
+  LOG_INFO("Batching %u readings per message to %s", (unsigned)BATCH_READINGS, batchTopic);
+  client.setCallback(batchCallback);
+  if (!client.setBufferSize(BATCH_PACKET_SIZE)) {
+    LOG_ERROR("Cannot allocate the %u-byte MQTT buffer, batches will not be acknowledged",
+              (unsigned)BATCH_PACKET_SIZE);
+  }
+  connectivity.onConnect(subscribeBatchTopic);
+#endif
+  connectivity.begin();
   
-  Serial.println("MQTT-based Sensor Data Generator Started!");
+  LOG_INFO("MQTT-based Sensor Data Generator Started!");
 }
 
 void loop() {
   unsigned long currentMillis = millis();
 
-  // Check WiFi connection
-  if (currentMillis - lastWiFiCheckTime >= wifiCheckInterval) {
-    if (WiFi.status() != WL_CONNECTED) {
-      Serial.println("WiFi connection lost. Reconnecting...");
-      setup_wifi();
-    }
-    lastWiFiCheckTime = currentMillis;
-  }
-
-  // Check MQTT connection
-  if (!client.connected()) {
-    reconnect();
+  // Drive WiFi/MQTT reconnection and keep-alive without blocking
+  connectivity.loop();
+  if (connectivity.isConnected() != wasConnected) {
+    wasConnected = connectivity.isConnected();
+    connectivity.printStats();
   }
-  client.loop();  // Handle MQTT keep-alive
 
-  // Send data every 5 seconds
+  // Sample every interval, online or not
   if (currentMillis - lastSendTime >= sendInterval) {
     sendSensorData();
     lastSendTime = currentMillis;
   }
-}
 
-void setup_wifi() {
-  delay(10);
-  Serial.println("Connecting to WiFi..");
-  WiFi.begin(ssid, password);
-  
-  // Wait up to 20 seconds for connection
-  int timeout = 0;
-  while (WiFi.status() != WL_CONNECTED && timeout < 40) {
-    delay(500);
-    Serial.print(".");
-    timeout++;
+  SensorSample pending;
+#ifdef MQTT_BATCH_MODE
+  // Move readings the batcher refused earlier, then send due batches
+  while (offlineBuffer.peek(pending) && batcher.add(pending, currentMillis)) {
+    offlineBuffer.pop();
   }
-  
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.println("\nWiFi connected");
-    Serial.println("IP address: ");
-    Serial.println(WiFi.localIP());
-  } else {
-    Serial.println("\nWiFi connection failed!");
+  if (connectivity.isConnected()) {
+    batcher.service(currentMillis, publishBatch);
   }
-}
-
-void reconnect() {
-  int attempts = 0;
-  while (!client.connected() && attempts < 3) {
-    Serial.print("Attempting MQTT connection...");
-    String clientId = "ESP32Client-";
-    clientId += String(random(0xffff), HEX);
-    
-    // Try to connect with username and password
-    if (client.connect(clientId.c_str(), mqtt_username, mqtt_password)) {
-      Serial.println("connected");
-    } else {
-      Serial.print("failed, rc=");
-      Serial.print(client.state());
-      Serial.println(" retrying in 5 seconds");
-      delay(5000);
+#else
+  // Flush one buffered reading per pass so the loop stays responsive
+  if (connectivity.isConnected() && offlineBuffer.peek(pending)) {
+    if (publishSample(pending)) {
+      offlineBuffer.pop();
     }
-    attempts++;
   }
+#endif
 }
 
+void logTask(void* parameter) {
+  for (;;) {
+    logger.drain([](const char* line, size_t len) { Serial.write((const uint8_t*)line, len); });
+    vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_MS));
+  }
+}
 
 void sendSensorData() {
+  SensorSample sample;
+  sampleSensorData(sample);
+
+  // Log sensor and battery info
+  LOG_INFO("Sending data: humidity %.2f%%, temperature %.2f°C, EC %.2f, pH %.2f, NPK %.2f, %.2f, %.2f",
+           sample.humidity, sample.temperature, sample.ec, sample.ph,
+           sample.nitrogen, sample.phosphorus, sample.potassium);
+  if (isPowerMonitorFound) {
+    LOG_INFO("Battery: %.2fV, %.2fmA, %.2fmW, charge %dmA, level %d%%",
+             sample.vbat, sample.batCurrent, sample.batPower, sample.batChargeCurrent, sample.batLevel);
+  }
+
+  // Publish now, or keep it until the connection is back
+#ifdef MQTT_BATCH_MODE
+  if (offlineBuffer.empty() && batcher.add(sample, millis())) {
+    return;
+  }
+#else
+  if (connectivity.isConnected() && offlineBuffer.empty() && publishSample(sample)) {
+    return;
+  }
+#endif
+  if (!offlineBuffer.push(sample)) {
+    LOG_WARN("Offline buffer full, oldest reading dropped");
+  }
+  LOG_INFO("Reading buffered (%u pending, offline for %lu ms)",
+           (unsigned)offlineBuffer.size(), connectivity.currentDowntime());
+}
+
+void sampleSensorData(SensorSample &sample) {
   // Generate sensor data
-  float humidity = randomFloat(20, 35);
-  float temperature = randomFloat(20, 35);
-  float ec = randomFloat(0, 100);
-  float ph = randomFloat(0, 14);
-  float nitrogen = randomFloat(0, 5);
-  float phosphorus = randomFloat(0, 10);
-  float potassium = randomFloat(0, 15);
+  sample.takenAt = millis();
+  sample.humidity = randomFloat(20, 35);
+  sample.temperature = randomFloat(20, 35);
+  sample.ec = randomFloat(0, 100);
+  sample.ph = randomFloat(0, 14);
+  sample.nitrogen = randomFloat(0, 5);
+  sample.phosphorus = randomFloat(0, 10);
+  sample.potassium = randomFloat(0, 15);
 
   // Get battery data
-  float vbat = 0, batCurrent = 0, batPower = 0;
-  int batChargeCurrent = 0, batLevel = 0;
-  getBatteryStats(vbat, batCurrent, batPower, batChargeCurrent, batLevel);
+  getBatteryStats(sample.vbat, sample.batCurrent, sample.batPower, sample.batChargeCurrent, sample.batLevel);
+}
 
+bool publishSample(const SensorSample &sample) {
   // Create JSON object
   StaticJsonDocument<256> doc;
   doc["lahanID"] = LAHAN_ID;
-  doc["humidity"] = humidity;
-  doc["temperature"] = temperature;
-  doc["ec"] = ec;
-  doc["ph"] = ph;
-  doc["nitrogen"] = nitrogen;
-  doc["phosphorus"] = phosphorus;
-  doc["potassium"] = potassium;
-  doc["batteryVoltage"] = vbat;
-  doc["batteryCurrent"] = batCurrent;
-  doc["batteryPower"] = batPower;
-  doc["batteryChargeCurrent"] = batChargeCurrent;
-  doc["batteryLevel"] = batLevel;
-
-  // Serialize JSON to string
-  String jsonString;
-  serializeJson(doc, jsonString);
-
-  // Print sensor and battery info to Serial
-  Serial.println("\n=== Sending Data ===");
-  Serial.printf("Humidity: %.2f%%\n", humidity);
-  Serial.printf("Temperature: %.2f°C\n", temperature);
-  Serial.printf("EC: %.2f\n", ec);
-  Serial.printf("pH: %.2f\n", ph);
-  Serial.printf("NPK: %.2f, %.2f, %.2f\n", nitrogen, phosphorus, potassium);
-  
-  if (isPowerMonitorFound) {
-    Serial.println("Battery Status:");
-    Serial.printf("Voltage: %.2fV\n", vbat);
-    Serial.printf("Current: %.2fmA\n", batCurrent);
-    Serial.printf("Power: %.2fmW\n", batPower);
-    Serial.printf("Charge Current: %dmA\n", batChargeCurrent);
-    Serial.printf("Battery Level: %d%%\n", batLevel);
+  fillSample(doc.as<JsonObject>(), sample);
+
+  // Readings replayed from the offline buffer carry their age
+  unsigned long age = millis() - sample.takenAt;
+  if (age >= 1000) {
+    doc["ageMs"] = age;
   }
 
   // Publish the message to MQTT broker
-  if (client.connected()) {
-    if (client.publish(topic, jsonString.c_str())) {
-      Serial.println("Message published successfully");
+  if (publishAll(doc)) {
+    LOG_INFO("Message published successfully");
+    return true;
+  }
+  LOG_ERROR("Failed to publish message");
+  return false;
+}
+
+void fillSample(JsonObject obj, const SensorSample &sample) {
+  obj["humidity"] = sample.humidity;
+  obj["temperature"] = sample.temperature;
+  obj["ec"] = sample.ec;
+  obj["ph"] = sample.ph;
+  obj["nitrogen"] = sample.nitrogen;
+  obj["phosphorus"] = sample.phosphorus;
+  obj["potassium"] = sample.potassium;
+  obj["batteryVoltage"] = sample.vbat;
+  obj["batteryCurrent"] = sample.batCurrent;
+  obj["batteryPower"] = sample.batPower;
+  obj["batteryChargeCurrent"] = sample.batChargeCurrent;
+  obj["batteryLevel"] = sample.batLevel;
+}
+
+#ifdef MQTT_BATCH_MODE
+bool publishBatch(const SampleBatcher::Batch &batch) {
+  StaticJsonDocument<2048> doc;
+  doc["lahanID"] = LAHAN_ID;
+  doc["batchId"] = batch.id;
+  doc["attempt"] = batch.attempts + 1;
+
+  // Each reading carries its age at send time so the consumer can
+  // reconstruct when it was taken
+  unsigned long now = millis();
+  JsonArray readings = doc.createNestedArray("readings");
+  for (uint8_t i = 0; i < batch.count; i++) {
+    JsonObject reading = readings.createNestedObject();
+    fillSample(reading, batch.items[i]);
+    reading["ageMs"] = now - batch.items[i].takenAt;
+  }
+
+  size_t length = measurePayload(doc, BATCH_FORMAT);
+  if (length > BATCH_MAX_PAYLOAD) {
+    LOG_ERROR("Batch %u is %u bytes, its echo will not fit the %u-byte buffer",
+              batch.id, (unsigned)length, (unsigned)BATCH_MAX_PAYLOAD);
+  }
+  bool ok = publishDocument(batchTopic, BATCH_FORMAT, doc);
+  LOG_INFO("Batch %u (%u readings, attempt %u) %s", batch.id, batch.count,
+           batch.attempts + 1, ok ? "published" : "failed");
+  return ok;
+}
+
+void subscribeBatchTopic() {
+  if (!client.subscribe(batchTopic, 0)) {
+    LOG_ERROR("Failed to subscribe to batch topic");
+  }
+}
+
+void batchCallback(char* msgTopic, byte* payload, unsigned int length) {
+  if (strcmp(msgTopic, batchTopic) != 0) return;
+
+  StaticJsonDocument<64> filter;
+  filter["lahanID"] = true;
+  filter["batchId"] = true;
+
+  StaticJsonDocument<64> doc;
+  DeserializationError error = BATCH_FORMAT == PAYLOAD_MSGPACK
+      ? deserializeMsgPack(doc, payload, length, DeserializationOption::Filter(filter))
+      : deserializeJson(doc, payload, length, DeserializationOption::Filter(filter));
+  if (error || doc["lahanID"].as<int>() != LAHAN_ID) return;
+
+  if (batcher.acknowledge(doc["batchId"].as<uint16_t>(), millis())) {
+    printBatchStats();
+  }
+}
+
+void printBatchStats() {
+  const SampleBatcher::Stats &stats = batcher.stats();
+  float uptime = millis() / 1000.0;
+  LOG_INFO("Batch Statistics:");
+  LOG_INFO("Sent: %lu, Acked: %lu, Retries: %lu, Dropped: %lu, In flight: %u",
+           stats.batchesSent, stats.batchesAcked, stats.retries, stats.batchesDropped,
+           (unsigned)batcher.inFlightCount());
+  LOG_INFO("Ack latency: avg %lu ms, max %lu ms", batcher.averageAckLatency(), stats.maxAckLatency);
+  LOG_INFO("Throughput: %.2f readings/min acknowledged",
+           uptime > 0 ? stats.readingsAcked * 60.0 / uptime : 0.0);
+}
+#endif
+
+bool publishAll(const JsonDocument& doc) {
+  bool ok = true;
+  for (size_t i = 0; i < PUBLISH_TARGET_COUNT; i++) {
+    ok = publishDocument(publishTopics[i], publishTargets[i].format, doc) && ok;
+  }
+  return ok;
+}
+
+bool publishDocument(const char* publishTopic, PayloadFormat format, const JsonDocument& doc) {
+  if (format == PAYLOAD_BINARY) {
+    uint8_t frame[SENSOR_FRAME_SIZE];
+    size_t length = encodePayload(doc, format, frame, sizeof(frame));
+    return length > 0 && client.publish(publishTopic, frame, length);
+  }
+
+  // Stream the serialization straight into the MQTT packet: the length is
+  // known up front, so no intermediate String or PubSubClient buffer copy
+  // is needed and payloads may exceed the client's buffer size
+  size_t length = measurePayload(doc, format);
+  if (!client.beginPublish(publishTopic, length, false)) {
+    return false;
+  }
+  {
+    BufferedPrint<64> out(client);
+    if (format == PAYLOAD_MSGPACK) {
+      serializeMsgPack(doc, out);
     } else {
-      Serial.println("Failed to publish message");
+      serializeJson(doc, out);
     }
-  } else {
-    Serial.println("Client not connected. Cannot publish message.");
   }
+  return client.endPublish() == 1;
 }
 
 void initPowerMonitor() {
     Wire.begin(21, 22); // SDA, SCL
     if (!axp.begin(Wire, AXP192_SLAVE_ADDRESS)) {
-        Serial.println("AXP192 Power monitor initialized!");
+        LOG_INFO("AXP192 Power monitor initialized!");
         isPowerMonitorFound = true;
         
         // Configure power output
@@ -200,7 +373,7 @@ void initPowerMonitor() {
         axp.setPowerOutPut(AXP192_DCDC1, AXP202_ON);
         axp.setChgLEDMode(AXP20X_LED_LOW_LEVEL);
     } else {
-        Serial.println("AXP192 Power monitor not found!");
+        LOG_WARN("AXP192 Power monitor not found!");
         isPowerMonitorFound = false;
     }
 }